@@ -1,104 +1,273 @@
-#include <queue>
-#include <future>
-#include <chrono>
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <pthread.h>
 
 #include "keyvalue.h"
+#include "event_count.h"
 #include "buck_index.h"
 
 namespace  buckindex{
 
-enum RequestType {
-    read,
-    write
-};
+/**
+ * Asynchronous interface of BLI, for event-loop servers that must not block a thread per request
+ * Each client (i.e., each event-loop thread) registers once, and gets its own submission ring.
+ * Lookups are served on the calling thread, without waiting (see BuckIndex::lookup()).
+ * Inserts are written to the ring of the client and applied by the owner thread, the only writer of the index.
+ * An insert returns a completion token at once; its result is taken by done()/result()/wait(), or passed to
+ * a callback, run by the client thread in poll().
+ * The inserts of a client complete in order; at most RING_SIZE of them are outstanding (backpressure: a
+ * further insert polls, and waits for the oldest one if it is still not complete).
+ * NOTE: a lookup does not wait for the outstanding inserts of its client; wait() for their tokens first
+ */
+template<typename T, typename V, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE>
+class BLI_async {
+public:
+    static constexpr size_t MAX_CLIENTS = 128;
+    static constexpr size_t RING_SIZE = 64; // max outstanding inserts per client
+    using KeyValueType = KeyValue<T, V>;
+    using Callback = std::function<void(bool)>;
 
-template<typename T, typename V>
-struct Request {
-    RequestType type;
-    KeyValue<T, V> kv;
-};
+    // the completion token of an insert; ordered like the inserts of its client
+    struct Token {
+        uint64_t seq;
+    };
 
-// The Timer class would need to be defined by you to handle the timing of write requests
-class Timer {
-public:
-    void set_timer(int milliseconds) {
-        // Implement this method
+    /**
+     * A client of the index; all its calls come from one thread at a time
+     */
+    class Client {
+    public:
+        /**
+         * Run the callbacks of the completed inserts, in order, and free their slots
+         * @return the number of completed inserts
+         */
+        size_t poll() {
+            uint64_t completed = completed_.load(std::memory_order_acquire);
+            size_t num_completed = completed - retired_;
+            for (; retired_ < completed; retired_++) {
+                Slot &slot = slots_[retired_ % RING_SIZE];
+                if (slot.callback) {
+                    Callback callback = std::move(slot.callback);
+                    slot.callback = nullptr;
+                    callback(slot.result);
+                }
+            }
+            return num_completed;
+        }
+
+        /**
+         * @return true if the insert of token is complete
+         */
+        bool done(Token token) const { return token.seq < completed_.load(std::memory_order_acquire); }
+
+        /**
+         * @param token: a complete insert; its result stays available until RING_SIZE later inserts are issued
+         * @return the result of the insert (see BuckIndex::insert())
+         */
+        bool result(Token token) const {
+            assert(done(token) && token.seq + RING_SIZE >= submitted_.load(std::memory_order_relaxed));
+            return slots_[token.seq % RING_SIZE].result;
+        }
+
+        /**
+         * Wait until the insert of token is complete
+         * @return the result of the insert
+         */
+        bool wait(Token token) {
+            replies_.await([this, token]() { return done(token); });
+            return result(token);
+        }
+
+        /**
+         * Wait until all the inserts issued so far are complete, and run their callbacks
+         */
+        void drain() {
+            uint64_t submitted = submitted_.load(std::memory_order_relaxed);
+            replies_.await([this, submitted]() { return completed_.load(std::memory_order_acquire) >= submitted; });
+            poll();
+        }
+
+        /**
+         * @return the number of inserts not complete yet
+         */
+        size_t num_outstanding() const {
+            return submitted_.load(std::memory_order_relaxed) - completed_.load(std::memory_order_acquire);
+        }
+
+    private:
+        friend class BLI_async;
+
+        struct Slot {
+            KeyValueType kv; // written by the client, read by the owner
+            bool result; // written by the owner, read by the client
+            Callback callback; // client only
+        };
+
+        // the ring: the client fills the slots [submitted_, ...) and publishes them by advancing submitted_;
+        // the owner applies [completed_, submitted_) and publishes the results by advancing completed_;
+        // the client reuses a slot once retired_ has passed it
+        Slot slots_[RING_SIZE];
+        alignas(64) std::atomic<uint64_t> submitted_{0};
+        uint64_t retired_ = 0; // client only
+        alignas(64) std::atomic<uint64_t> completed_{0};
+        EventCount replies_; // the client waits for completions
+    };
+
+    /**
+     * @param fill_ratio: the initial fill ratio of the index
+     * @param error_bound: the segmentation error bound of the index
+     * @param owner_cpu: pin the owner thread to this core; -1 for no pinning
+     */
+    BLI_async(double fill_ratio=0.7, int error_bound=8, int owner_cpu=-1)
+        : idx_(fill_ratio, error_bound), num_clients_(0), stop_(false) {
+        owner_ = std::thread(&BLI_async::run, this, owner_cpu);
     }
 
-    bool expired() {
-        // Implement this method
+    // the outstanding inserts are applied before the owner thread exits
+    ~BLI_async() {
+        stop_.store(true, std::memory_order_release);
+        requests_.notify_all();
+        owner_.join();
     }
-};
 
-template<typename T, typename V, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE>
-class BLI_async {
-    static constexpr size_t N_MAX_THREAD = 24;
-    static constexpr int WRITE_ETA = 1000;
-public:
-    BLI_async(size_t n_thread): n_thread_(n_thread) {
-        //TODO: call idx.init(fill_ratio);
-        for (int i = 0; i < n_thread; i++) {
-            int ret = pthread_create(&threads[i], nullptr, run, &i);
+    BLI_async(const BLI_async&) = delete;
+    BLI_async& operator=(const BLI_async&) = delete;
+
+    /**
+     * Register a client; it lives as long as the index
+     * @return the client, to be used by one thread at a time
+     */
+    Client& register_client() {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        size_t n = num_clients_.load(std::memory_order_relaxed);
+        assert(n < MAX_CLIENTS);
+        clients_[n].reset(new Client());
+        num_clients_.store(n + 1, std::memory_order_release);
+        return *clients_[n];
+    }
+
+    /**
+     * Bulk load the user key value onto the index
+     * NOTE: no insert may be outstanding
+     */
+    void bulk_load(std::vector<KeyValueType> &kvs) {
+        idx_.bulk_load(kvs);
+    }
+
+    /**
+     * Lookup, served on the calling thread
+     * @return true if the key is found, else false
+     */
+    bool lookup(T key, V &value) {
+        EpochGuard guard = idx_.enter_epoch();
+        return idx_.lookup(key, value);
+    }
+
+    /**
+     * Lookup, served on the calling thread; the callback is run before the function returns
+     */
+    void lookup_async(T key, const std::function<void(bool, V)> &callback) {
+        V value = V();
+        bool found = lookup(key, value);
+        callback(found, value);
+    }
+
+    /**
+     * Issue an insert to the owner thread
+     * @param client: the client of the calling thread
+     * @param kv: the Key-Value pair to be inserted
+     * @param callback: if set, run with the result by client.poll() once the insert is complete
+     * @return the completion token of the insert
+     */
+    Token insert_async(Client &client, const KeyValueType &kv, Callback callback = nullptr) {
+        uint64_t seq = client.submitted_.load(std::memory_order_relaxed);
+        if (seq - client.retired_ == RING_SIZE) { // the ring is full
+            if (client.poll() == 0) {
+                client.wait(Token{client.retired_});
+                client.poll();
+            }
         }
+        typename Client::Slot &slot = client.slots_[seq % RING_SIZE];
+        slot.kv = kv;
+        slot.callback = std::move(callback);
+        client.submitted_.store(seq + 1, std::memory_order_release);
+        requests_.notify_all();
+        return Token{seq};
+    }
+
+    /**
+     * Insert, waiting for the owner thread
+     * @return true if kv in inserted, false else
+     */
+    bool insert(Client &client, const KeyValueType &kv) {
+        return client.wait(insert_async(client, kv));
     }
 
 private:
-    size_t n_thread_ = 0; // number of background threads
-    static BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE> idx;
-    pthread_t threads[N_MAX_THREAD]; // the first one is the RW thread
-    // create n queues of n threads
-    std::queue<Request<T, V>> input_queues_[N_MAX_THREAD];
-    std::queue<std::pair<KeyValue<T, V>, std::promise<int>>> O2M_queue; // other threads to main thread queue
-
-void* run(void *arg) {
-    int thread_id = *((int *)arg);
-    std::queue<KeyValue<T, V>> &input_queue_ = input_queues_[thread_id];
-
-    std::promise<int> outstanding_write; // Only one outstanding write is allowed at a time
-    std::future<int> write_future;
-    bool has_outstanding_write;
-
-    Timer timer;
-
-    while (!input_queue_.empty()) {
-        KeyValue<T, V> request = input_queue_.front();
-        input_queue_.pop();
-        bool ret;
-
-        if (request.type == read) {
-            ret = idx.lookup(request.key_, request.value_);
-        } else { // request.type == write
-            if (idx == 0) { // main thread
-                ret = idx.write(request);
-            } else { // all other threads
-                if (has_outstanding_write) {
-                    write_future = outstanding_write.get_future();
-                    int write_request_ret = write_future.get(); // wait for the previous write request to finish before sending another one.
-                    has_outstanding_write = false;
-                }
-                O2M_queue.push({request, std::move(outstanding_write)});
-                has_outstanding_write = true;
-                timer.set_timer(WRITE_ETA); // Define WRITE_ETA as the timeout for write operations
-            }
+    static constexpr size_t MAX_BATCH = 16; // max inserts of a client applied at once
+
+    // the owner thread: applies the inserts of the clients, round robin
+    void run(int cpu) {
+        if (cpu >= 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
         }
-        if (idx == 0) { // Replace "main" with the thread ID of the main thread
-            if (has_outstanding_write && timer.expired()) {
-                write_future = outstanding_write.get_future();
-                int write_request_ret = write_future.get();
-                has_outstanding_write = false;
+        while (true) {
+            bool stop = stop_.load(std::memory_order_acquire);
+            size_t num_applied = 0;
+            size_t num_clients = num_clients_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < num_clients; i++) num_applied += apply(*clients_[i]);
+            if (num_applied > 0) continue;
+            if (stop) return; // nothing was outstanding after stop_ was set
+            requests_.await([this]() { return stop_.load(std::memory_order_acquire) || has_requests(); });
+        }
+    }
+
+    // apply a batch of the outstanding inserts of a client
+    // @return the number of inserts applied
+    size_t apply(Client &client) {
+        uint64_t completed = client.completed_.load(std::memory_order_relaxed);
+        uint64_t end = std::min<uint64_t>(client.submitted_.load(std::memory_order_acquire), completed + MAX_BATCH);
+        if (end == completed) return 0;
+        {
+            // the nodes replaced by the inserts are not reclaimed during concurrent lookups
+            EpochGuard guard = idx_.enter_epoch();
+            for (uint64_t seq = completed; seq < end; seq++) {
+                typename Client::Slot &slot = client.slots_[seq % RING_SIZE];
+                slot.result = idx_.insert(slot.kv);
             }
         }
+        client.completed_.store(end, std::memory_order_release);
+        client.replies_.notify_all();
+        return end - completed;
     }
-    if (idx == 0) { // Replace "main" with the thread ID of the main thread
-        while (!O2M_queue.empty()) { // check the O2M_queue for all the write request from all other threads.
-            auto& [O2M_write_request, O2M_write_promise] = O2M_queue.front(); // get the write_request and write_promise from the queue.
-            O2M_queue.pop();
-            int M2O_ret = idx.insert(O2M_write_request.kv);
-            O2M_write_promise.set_value(M2O_ret); // this will unblock the thread O's write_future.get();
+
+    bool has_requests() const {
+        size_t num_clients = num_clients_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < num_clients; i++) {
+            const Client &client = *clients_[i];
+            if (client.submitted_.load(std::memory_order_acquire) != client.completed_.load(std::memory_order_relaxed)) {
+                return true;
+            }
         }
+        return false;
     }
-}
+
+    BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE> idx_;
+    std::unique_ptr<Client> clients_[MAX_CLIENTS]; // fixed, so the owner reads it while clients register
+    std::atomic<size_t> num_clients_;
+    std::mutex clients_mutex_; // serializes register_client()
+    std::atomic<bool> stop_;
+    EventCount requests_; // the owner waits for inserts
+    std::thread owner_;
 };
 
-} // namespace buckindex
\ No newline at end of file
+} // namespace buckindex
@@ -2,35 +2,50 @@
 #include <future>
 #include <chrono>
 #include <pthread.h>
-#include <tbb/concurrent_queue.h>
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <algorithm>
 
+#include "atomic_queue/atomic_queue.h"
 #include "keyvalue.h"
+#include "event_count.h"
 #include "buck_index.h"
 
 namespace  buckindex{
 
 /**
  * Concurrent interface of BLI; used by GRE
+ * Lookups run directly in the calling threads (see BuckIndex::lookup())
+ * Inserts are combined by default (flat combining): a writer publishes its insert, and whichever writer takes
+ * the combiner role applies up to MAX_COMBINE published inserts at once, sorted by key, so the inserts into
+ * the same D-Bucket share one traversal (see BuckIndex::insert_batch()); then it publishes all the results.
+ * The other writers wait adaptively (spin, then sleep; see EventCount) for their result or for the combiner role,
+ * and also while the publication ring is full (backpressure). No thread runs while no insert is in flight.
+ * Without combining, writers insert directly and in parallel (see BuckIndex::insert())
 */
 template<typename T, typename V, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE>
 class BLI_concurrent {
 public:
-    BLI_concurrent() {
+    static constexpr size_t MAX_COMBINE = 64; // max inserts applied by a combiner at once
+    static constexpr unsigned PUBLICATION_QUEUE_SIZE = 4096; // max published inserts
+
+    BLI_concurrent() : idx(nullptr), publication_queue(nullptr), combining(false) {
     }
 
     ~BLI_concurrent() {
-        consumer_thread->join();
         delete idx;
-        delete write_queue;
+        delete publication_queue;
     }
 
-    void init(double fill_ratio, int error_bound) {
+    /**
+     * @param fill_ratio: the initial fill ratio of the index
+     * @param error_bound: the segmentation error bound of the index
+     * @param combine_writes: combine the inserts of concurrent writers; otherwise the writers insert in parallel
+     */
+    void init(double fill_ratio, int error_bound, bool combine_writes = true) {
         idx = new BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE>(fill_ratio, error_bound);
-        write_queue = new tbb::concurrent_queue<std::pair<KeyValue<T, V>, int *>>();
-       
-        consumer_thread = new std::thread(run, write_queue, idx);
+        if (combine_writes) publication_queue = new atomic_queue::AtomicQueue<WriteRequest*, PUBLICATION_QUEUE_SIZE>();
     }
 
     void bulk_load(std::vector<KeyValue<T, V>> &kvs) {
@@ -38,14 +53,40 @@ public:
     }
 
     bool lookup(const T key, V& value) {
+       // lock-free: the lookup validates what it reads against the versions bumped by the writer,
+       // and the nodes replaced by concurrent inserts are not reclaimed during the lookup
+       EpochGuard guard = idx->enter_epoch();
        return idx->lookup(key, value);
     }
 
     void insert(const KeyValue<T, V> &kv, int *ret) {
-        write_queue->push({kv, ret}); // std::promise is not copyable, so we need to use std::move.
-        while(*ret == -1){
-            std::this_thread::yield();
-        }
+       if (publication_queue == nullptr) {
+           // writers lock only the nodes they modify, so inserts into different D-Buckets run in parallel
+           EpochGuard guard = idx->enter_epoch();
+           KeyValue<T, V> kv_copy = kv;
+           *ret = idx->insert(kv_copy);
+           return;
+       }
+
+       WriteRequest request(kv);
+       // the ring is full: drain it, or wait for the combiner to
+       while (!publication_queue->try_push(&request)) {
+           if (!try_combine()) {
+               batch_done.await([this]() {
+                   return !combining.load(std::memory_order_relaxed) || !publication_queue->was_full();
+               });
+           }
+       }
+       // wait for a combiner to apply the insert, or become the combiner
+       int result;
+       while ((result = request.result.load(std::memory_order_acquire)) == -1) {
+           if (!try_combine()) {
+               batch_done.await([this, &request]() {
+                   return request.result.load(std::memory_order_acquire) != -1 || !combining.load(std::memory_order_relaxed);
+               });
+           }
+       }
+       *ret = result;
     }
 
     void print_lookup_stat(){
@@ -55,26 +96,62 @@ public:
     void dump() {
         idx->dump();
     }
-    
+
 private:
-    using PromiseWriteType = std::pair<KeyValue<T, V>, int *>;
-    
-    tbb::concurrent_queue<PromiseWriteType> *write_queue; // other threads to main thread queue
-    BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE> *idx; // TODO: remove runtime stats updates in BLI, to avoid synchronization overhead.
+    // a published insert; lives on the stack of the writer until result is set
+    struct alignas(64) WriteRequest {
+        explicit WriteRequest(const KeyValue<T, V> &kv_) : kv(kv_), result(-1) {}
+        KeyValue<T, V> kv;
+        std::atomic<int> result; // -1 until the insert is applied
+    };
 
-    std::thread *consumer_thread;
+    // take the combiner role if it is free, and apply a batch
+    // @return false if another writer holds the role
+    bool try_combine() {
+        if (combining.load(std::memory_order_relaxed) || combining.exchange(true, std::memory_order_acquire)) {
+            return false;
+        }
+        combine();
+        combining.store(false, std::memory_order_release);
+        // wakes the writers of the batch, and those waiting for the role or for a free slot
+        batch_done.notify_all();
+        return true;
+    }
 
-    static void run(tbb::concurrent_queue<PromiseWriteType> *write_queue, BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE> *idx) {
-        std::pair<KeyValue<T, V>, int *> kv_promise_pair;
+    // NOTE: only called by the combiner
+    void combine() {
+        WriteRequest *request;
+        while (batch_requests.size() < MAX_COMBINE && publication_queue->try_pop(request)) {
+            batch_requests.push_back(request);
+        }
+        if (batch_requests.empty()) return;
+
+        // equal keys are applied in the order they were published
+        std::stable_sort(batch_requests.begin(), batch_requests.end(),
+                         [](const WriteRequest *a, const WriteRequest *b) { return a->kv.key_ < b->kv.key_; });
+        batch_kvs.clear();
+        for (auto r : batch_requests) batch_kvs.push_back(r->kv);
+        {
+            EpochGuard guard = idx->enter_epoch();
+            idx->insert_batch(batch_kvs, batch_results);
+        }
 
-        while(true){
-            if(write_queue->try_pop(kv_promise_pair)){
-                auto& [kv, ret_addr] = kv_promise_pair;
-                *ret_addr = idx->insert(kv);
-            }
-            std::this_thread::yield();
+        for (size_t i = 0; i < batch_requests.size(); i++) {
+            batch_requests[i]->result.store(batch_results[i], std::memory_order_release);
         }
+        batch_requests.clear();
     }
+
+    BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE> *idx; // TODO: remove runtime stats updates in BLI, to avoid synchronization overhead.
+
+    // inserts published to the combiner; nullptr if the writes are not combined
+    atomic_queue::AtomicQueue<WriteRequest*, PUBLICATION_QUEUE_SIZE> *publication_queue;
+    std::atomic<bool> combining; // whether a writer holds the combiner role
+    EventCount batch_done; // notified when the combiner releases the role
+    // the batch of the combiner, reused across batches
+    std::vector<WriteRequest*> batch_requests;
+    std::vector<KeyValue<T, V>> batch_kvs;
+    std::vector<bool> batch_results;
 };
 
-} // namespace buckindex
\ No newline at end of file
+} // namespace buckindex
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "keyvalue.h"
+#include "buck_index.h"
+#include "write_ahead_log.h"
+
+namespace  buckindex{
+
+/**
+ * Durable interface of BLI: the inserts are logged in a write-ahead log (see WriteAheadLog), and the index is
+ * checkpointed with snapshots (see BuckIndex::save()), so it survives a crash without a full rebuild
+ * Directory layout: "wal", the log, and "snapshot-<LSN>", the latest checkpoint, which covers the records up to LSN.
+ * Recovery (in the constructor) loads the latest checkpoint, then replays the records of the log after it, in
+ * parallel chunks sorted by key (see BuckIndex::insert_batch()).
+ * An insert is logged, applied, then waits for the group commit of its record; the batch insert waits once for the
+ * whole batch, and a writer that does not need to wait uses insert_nowait() and sync().
+ * NOTE: a lookup may see an insert that is not durable yet
+ * NOTE: lookups and inserts are thread-safe; checkpoint() waits for the inserts in flight, and blocks new ones
+ */
+template<typename T, typename V, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE>
+class BLI_durable {
+public:
+    using KeyValueType = KeyValue<T, V>;
+    using IndexType = BuckIndex<T, V, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE>;
+    static constexpr size_t REPLAY_GRAIN = 4096; // log records per replay task
+
+    /**
+     * Open the index in dir, recovering its content if dir holds one
+     * @param dir: the directory of the log and the checkpoints; created if needed
+     * @param commit_interval: the latency budget of the group commit (see WriteAheadLog)
+     * @param fill_ratio: the initial fill ratio of the index
+     * @param error_bound: the segmentation error bound of the index
+     * @param task_pool: runs the parallel replay and the parallel work of the index; TaskPool::shared() by default
+     * @throw std::runtime_error if dir holds a log or a checkpoint that cannot be recovered
+     */
+    BLI_durable(const std::string &dir, std::chrono::microseconds commit_interval = std::chrono::microseconds(200),
+                double fill_ratio = 0.7, int error_bound = 8, TaskPool *task_pool = nullptr)
+        : dir_(dir), idx_(fill_ratio, error_bound),
+          task_pool_(task_pool ? task_pool : &TaskPool::shared()) {
+        idx_.set_task_pool(task_pool_);
+        std::filesystem::create_directories(dir_);
+        uint64_t checkpoint_lsn = recover();
+        wal_.reset(new WriteAheadLog<T, V>(wal_path(), commit_interval, checkpoint_lsn));
+        if (wal_->last_lsn() < checkpoint_lsn) throw std::runtime_error("log older than the checkpoint in " + dir_);
+    }
+
+    BLI_durable(const BLI_durable&) = delete;
+    BLI_durable& operator=(const BLI_durable&) = delete;
+
+    bool lookup(T key, V &value) {
+        EpochGuard guard = idx_.enter_epoch();
+        return idx_.lookup(key, value);
+    }
+
+    size_t scan(T start_key, size_t num_to_scan, std::pair<T, V> *kvs) {
+        EpochGuard guard = idx_.enter_epoch();
+        return idx_.scan(start_key, num_to_scan, kvs);
+    }
+
+    /**
+     * Insert, and wait until it is durable
+     * @return true if kv in inserted, false else
+     */
+    bool insert(const KeyValueType &kv) {
+        uint64_t lsn;
+        bool result = insert_nowait(kv, &lsn);
+        wal_->wait_durable(lsn);
+        return result;
+    }
+
+    /**
+     * Insert without waiting for the group commit; sync() makes it durable
+     * @param lsn: if not nullptr, set to the LSN of the insert, for WriteAheadLog::wait_durable()
+     * @return true if kv in inserted, false else
+     */
+    bool insert_nowait(const KeyValueType &kv, uint64_t *lsn = nullptr) {
+        std::shared_lock<std::shared_mutex> lock(checkpoint_mutex_);
+        uint64_t l = wal_->append(WAL_INSERT, kv); // logged before it is applied
+        if (lsn) *lsn = l;
+        EpochGuard guard = idx_.enter_epoch();
+        KeyValueType copy = kv;
+        return idx_.insert(copy);
+    }
+
+    /**
+     * Insert a batch, with one wait for the group commit
+     * @param kvs: the key-value pairs, sorted by key
+     * @param results: set to the result of each insert
+     * @return the number of inserted pairs
+     */
+    size_t insert_batch(std::vector<KeyValueType> &kvs, std::vector<bool> &results) {
+        uint64_t last_lsn = 0;
+        size_t num_inserted;
+        {
+            std::shared_lock<std::shared_mutex> lock(checkpoint_mutex_);
+            for (const KeyValueType &kv : kvs) last_lsn = wal_->append(WAL_INSERT, kv);
+            EpochGuard guard = idx_.enter_epoch();
+            num_inserted = idx_.insert_batch(kvs, results);
+        }
+        if (!kvs.empty()) wal_->wait_durable(last_lsn);
+        return num_inserted;
+    }
+
+    /**
+     * Make all the inserts so far durable
+     */
+    void sync() {
+        wal_->flush();
+    }
+
+    /**
+     * Save a checkpoint of the index and restart the log, so the recovery only replays the inserts after it
+     * The inserts wait while the snapshot is written
+     */
+    void checkpoint() {
+        std::unique_lock<std::shared_mutex> lock(checkpoint_mutex_);
+        wal_->flush();
+        uint64_t lsn = wal_->last_lsn();
+
+        // the snapshot is complete and synced before it replaces the previous one, then the log is restarted;
+        // a crash in between recovers from the new snapshot and skips the records it covers
+        std::string tmp_path = dir_ + "/snapshot.tmp";
+        idx_.save(tmp_path);
+        sync_file(tmp_path);
+        std::string path = snapshot_path(lsn);
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("cannot write checkpoint " + path);
+        }
+        sync_file(dir_);
+        wal_->restart();
+        for (const std::string &old_path : list_snapshots()) {
+            if (old_path != path) std::remove(old_path.c_str());
+        }
+    }
+
+    /**
+     * @return the LSN of the last durable insert
+     */
+    uint64_t durable_lsn() const { return wal_->durable_lsn(); }
+
+    IndexType& index() { return idx_; }
+
+private:
+    std::string wal_path() const { return dir_ + "/wal"; }
+
+    std::string snapshot_path(uint64_t lsn) const {
+        char name[32];
+        snprintf(name, sizeof(name), "snapshot-%020llu", (unsigned long long)lsn); // sorted by LSN
+        return dir_ + "/" + name;
+    }
+
+    // the checkpoints in dir_, oldest first
+    std::vector<std::string> list_snapshots() const {
+        std::vector<std::string> paths;
+        for (const auto &entry : std::filesystem::directory_iterator(dir_)) {
+            std::string name = entry.path().filename().string();
+            if (name.rfind("snapshot-", 0) == 0) paths.push_back(entry.path().string());
+        }
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    static void sync_file(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0 || fsync(fd) != 0) {
+            if (fd >= 0) close(fd);
+            throw std::runtime_error("cannot sync " + path);
+        }
+        close(fd);
+    }
+
+    // load the latest checkpoint, and replay the log after it
+    // @return the LSN of the checkpoint; 0 without checkpoint
+    uint64_t recover() {
+        uint64_t checkpoint_lsn = 0;
+        std::vector<std::string> snapshots = list_snapshots();
+        if (!snapshots.empty()) {
+            const std::string &path = snapshots.back();
+            checkpoint_lsn = std::stoull(path.substr(path.rfind('-') + 1));
+            idx_.load(path);
+        }
+        if (!std::filesystem::exists(wal_path())) return checkpoint_lsn;
+
+        std::vector<KeyValueType> kvs;
+        uint64_t base_lsn;
+        WriteAheadLog<T, V>::replay(wal_path(), checkpoint_lsn, [&kvs](uint64_t, WalRecordType, const KeyValueType &kv) {
+            kvs.push_back(kv);
+        }, &base_lsn);
+        if (base_lsn > checkpoint_lsn) throw std::runtime_error("log newer than the checkpoint in " + dir_);
+        if (kvs.empty()) return checkpoint_lsn;
+
+        // the same keys in log order
+        task_pool_->parallel_stable_sort(kvs.begin(), kvs.end(), [](const KeyValueType &a, const KeyValueType &b) {
+            return a.key_ < b.key_;
+        });
+        size_t begin = 0;
+        if (idx_.get_num_levels() == 0) {
+            replay_chunks(kvs, 0, 1); // the first insert creates the tree; then the chunks run in parallel
+            begin = 1;
+        }
+        replay_chunks(kvs, begin, kvs.size());
+        return checkpoint_lsn;
+    }
+
+    // insert kvs[begin, end) in parallel chunks
+    void replay_chunks(std::vector<KeyValueType> &kvs, size_t begin, size_t end) {
+        task_pool_->parallel_for(begin, end, REPLAY_GRAIN, [&](size_t b, size_t e) {
+            std::vector<KeyValueType> chunk(kvs.begin() + b, kvs.begin() + e);
+            std::vector<bool> results;
+            EpochGuard guard = idx_.enter_epoch();
+            idx_.insert_batch(chunk, results);
+        });
+    }
+
+    std::string dir_;
+    IndexType idx_;
+    TaskPool *task_pool_;
+    std::unique_ptr<WriteAheadLog<T, V>> wal_; // declared after idx_: flushed and closed first
+    std::shared_mutex checkpoint_mutex_; // shared by the inserts, exclusive for checkpoint()
+};
+
+} // namespace buckindex
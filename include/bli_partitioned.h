@@ -0,0 +1,437 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+
+#include "atomic_queue/atomic_queue.h"
+#include "keyvalue.h"
+#include "version_lock.h"
+#include "event_count.h"
+#include "buck_index.h"
+
+namespace buckindex {
+
+/**
+ * Shared-nothing interface of BLI: the key space is cut into ranges, and each range (shard) is a separate
+ * BuckIndex owned by one thread, optionally pinned to a core. A client routes a request by its key to the
+ * owner of the range, through the request ring of the owner, and waits for the reply.
+ * An index is only touched by its owner thread (which also allocates it), so no index cache line is shared.
+ * The ranges are uniform over the key domain initially, and taken from the quantiles of the keys by bulk_load().
+ * rebalance() evens out the sizes of neighboring shards by moving keys from one to the other.
+ * The owners and the clients wait adaptively (spin, then sleep; see EventCount): an idle owner sleeps until a
+ * request arrives, and a client whose request ring is full sleeps until the owner frees a slot (backpressure).
+ * NOTE: as with BuckIndex, keys smaller than the smallest bulk loaded key can not be inserted afterwards;
+ * such inserts fail
+ */
+template<typename KeyType, typename ValueType, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE>
+class BLI_partitioned {
+public:
+    using IndexType = BuckIndex<KeyType, ValueType, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE>;
+    using KeyValueType = KeyValue<KeyType, ValueType>;
+    static constexpr unsigned QUEUE_SIZE = 1024; // max requests in flight per shard
+    static constexpr size_t MIN_REBALANCE_KEYS = 1024; // smaller differences between shards are not rebalanced
+
+    /**
+     * @param num_shards: the number of shards, i.e., owner threads
+     * @param fill_ratio: the initial fill ratio of the indexes
+     * @param error_bound: the segmentation error bound of the indexes
+     * @param pin_threads: pin the owner of shard i to core i (modulo the number of cores)
+     */
+    BLI_partitioned(size_t num_shards, double fill_ratio=0.7, int error_bound=8, bool pin_threads=true)
+        : fill_ratio_(fill_ratio), error_bound_(error_bound), boundaries_(num_shards) {
+        assert(num_shards > 0);
+        // uniform ranges over the key domain
+        KeyType min_key = std::numeric_limits<KeyType>::min();
+        KeyType max_key = std::numeric_limits<KeyType>::max();
+        for (size_t i = 0; i < num_shards; i++) {
+            boundaries_[i] = min_key + (KeyType)((max_key - min_key) / num_shards * i);
+        }
+
+        size_t num_cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < num_shards; i++) {
+            shards_.emplace_back(new Shard());
+            Shard &shard = *shards_[i];
+            shard.lo = boundaries_[i];
+            shard.hi = i + 1 < num_shards ? boundaries_[i+1] : max_key;
+            shard.is_first = i == 0;
+            shard.is_last = i + 1 == num_shards;
+            shard.first_key = min_key;
+            shard.thread = std::thread(&BLI_partitioned::run, this, std::ref(shard), pin_threads ? (int)(i % num_cores) : -1);
+        }
+    }
+
+    ~BLI_partitioned() {
+        for (auto &shard : shards_) {
+            Request req(OpType::STOP, KeyType());
+            enqueue(*shard, req);
+            wait(*shard, req);
+            shard->thread.join();
+        }
+    }
+
+    BLI_partitioned(const BLI_partitioned&) = delete;
+    BLI_partitioned& operator=(const BLI_partitioned&) = delete;
+
+    /**
+     * Bulk load sorted key-value pairs, and cut the ranges at their quantiles
+     * Each owner loads its range in parallel
+     * NOTE: the shards must be empty
+     * @param kvs: the sorted key-value pairs
+     */
+    void bulk_load(std::vector<KeyValueType> &kvs) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        size_t num_shards = shards_.size();
+        for (auto &shard : shards_) pause(*shard);
+
+        std::vector<size_t> starts(num_shards + 1, kvs.size());
+        starts[0] = 0;
+        for (size_t i = 1; i < num_shards; i++) {
+            size_t start = std::max(starts[i-1], kvs.size() * i / num_shards);
+            // equal keys stay in one shard
+            while (start > 0 && start < kvs.size() && kvs[start].key_ == kvs[start-1].key_) start++;
+            starts[i] = start;
+        }
+
+        {
+            typename VersionLock<uint64_t>::WriteGuard guard(boundaries_version_);
+            for (size_t i = 1; i < num_shards; i++) {
+                boundaries_[i] = starts[i] < kvs.size() ? kvs[starts[i]].key_ : std::numeric_limits<KeyType>::max();
+            }
+        }
+        for (size_t i = 0; i < num_shards; i++) {
+            auto reload = std::make_unique<std::vector<KeyValueType>>(kvs.begin() + starts[i], kvs.begin() + starts[i+1]);
+            resume(*shards_[i], boundaries_[i], i + 1 < num_shards ? boundaries_[i+1] : std::numeric_limits<KeyType>::max(),
+                   std::move(reload));
+        }
+        for (auto &shard : shards_) sync(*shard);
+    }
+
+    /**
+     * Lookup function
+     * @param key: lookup key
+     * @param value: corresponding value to be returned
+     * @return true if the key is found, else false
+     */
+    bool lookup(KeyType key, ValueType &value) {
+        Request req(OpType::LOOKUP, key);
+        bool found = submit(req) == SUCCESS;
+        value = req.value;
+        return found;
+    }
+
+    /**
+     * Insert function
+     * @param kv: the Key-Value pair to be inserted
+     * @return true if kv in inserted, false else
+     */
+    bool insert(const KeyValueType &kv) {
+        Request req(OpType::INSERT, kv.key_);
+        req.value = kv.value_;
+        return submit(req) == SUCCESS;
+    }
+
+    /**
+     * Scan function; continues into the next shards until enough key-value pairs are scanned
+     * @param start_key: scan from the first key that is >= start_key
+     * @param num_to_scan: the number of key-value pairs to be scanned
+     * @param kvs: the scanned key-value pairs
+     * @return the number of key-value pairs scanned(<= num_to_scan)
+     */
+    size_t scan(KeyType start_key, size_t num_to_scan, std::pair<KeyType, ValueType> *kvs) {
+        size_t num_scanned = 0;
+        KeyType key = start_key;
+        while (num_scanned < num_to_scan) {
+            Request req(OpType::SCAN, key);
+            req.num = num_to_scan - num_scanned;
+            req.out = kvs + num_scanned;
+            submit(req);
+            num_scanned += req.num;
+            if (req.is_last) break;
+            key = req.next_key; // the start of the next range
+        }
+        return num_scanned;
+    }
+
+    /**
+     * Even out the sizes of neighboring shards: if one has more than max_ratio times the keys of the other,
+     * both are rebuilt from their keys, with the boundary between them moved to their median key
+     * Only the two shards are paused meanwhile; the requests to the other shards go on
+     * @param max_ratio: the tolerated size ratio between neighbors
+     * @return the number of rebalanced pairs of shards
+     */
+    size_t rebalance(double max_ratio = 2.0) {
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        size_t num_rebalanced = 0;
+        for (size_t i = 0; i + 1 < shards_.size(); i++) {
+            size_t n1 = shards_[i]->num_keys.load(std::memory_order_relaxed);
+            size_t n2 = shards_[i+1]->num_keys.load(std::memory_order_relaxed);
+            size_t small = std::min(n1, n2), large = std::max(n1, n2);
+            if (large < small + MIN_REBALANCE_KEYS || large <= small * max_ratio) continue;
+            if (rebalance_pair(i)) num_rebalanced++;
+        }
+        return num_rebalanced;
+    }
+
+    /**
+     * @return the number of shards
+     */
+    size_t get_num_shards() const { return shards_.size(); }
+
+    /**
+     * @return the number of keys in each shard (approximate while inserts are running)
+     */
+    std::vector<size_t> get_shard_sizes() const {
+        std::vector<size_t> sizes;
+        for (auto &shard : shards_) sizes.push_back(shard->num_keys.load(std::memory_order_relaxed));
+        return sizes;
+    }
+
+    /**
+     * @return the first key of each range
+     */
+    std::vector<KeyType> get_boundaries() const {
+        std::vector<KeyType> boundaries;
+        uint64_t version;
+        do {
+            version = boundaries_version_.read_begin();
+            boundaries = boundaries_;
+        } while (!boundaries_version_.read_validate(version));
+        return boundaries;
+    }
+
+private:
+    enum class OpType : uint8_t { LOOKUP, INSERT, SCAN, PAUSE, SYNC, STOP };
+    enum Status : int { PENDING = -1, FAILURE = 0, SUCCESS = 1, RETRY = 2 }; // RETRY: the key is not in the range
+
+    // a request lives on the stack of the client, which waits for the reply
+    struct alignas(64) Request {
+        Request(OpType op_, KeyType key_) : op(op_), key(key_), value(), num(0), out(nullptr),
+                                           next_key(), is_last(false), status(PENDING) {}
+        OpType op;
+        KeyType key;
+        ValueType value;
+        size_t num; // SCAN: the max number of kvs to scan; reply: the number scanned
+        std::pair<KeyType, ValueType> *out; // SCAN: the output
+        KeyType next_key; // SCAN reply: the end of the range
+        bool is_last; // SCAN reply: whether the range is the last one
+        std::atomic<int> status;
+    };
+
+    struct alignas(64) Shard {
+        atomic_queue::AtomicQueue<Request*, QUEUE_SIZE> queue;
+        std::thread thread;
+        // owned by the owner thread; modified by a client only while the owner is paused
+        std::unique_ptr<IndexType> index;
+        KeyType lo; // the range of the shard is [lo, hi), or [lo, max] for the last shard
+        KeyType hi;
+        bool is_first;
+        bool is_last;
+        KeyType first_key; // the smallest key in index, if bulk loaded; keys below it can not be inserted
+        std::unique_ptr<std::vector<KeyValueType>> reload; // if set on resume, the index is rebuilt from it
+        std::atomic<bool> paused{false};
+        std::atomic<size_t> num_keys{0};
+        EventCount requests; // the owner waits for a request, or to be resumed
+        EventCount replies; // the clients wait for a reply, or for a free slot in the ring
+
+        bool in_range(KeyType key) const { return key >= lo && (is_last || key < hi); }
+    };
+
+    // route the request to the owner of its key, and wait for the reply; retry if the ranges changed meanwhile
+    int submit(Request &req) {
+        while (true) {
+            req.status.store(PENDING, std::memory_order_relaxed);
+            Shard &shard = *shards_[route(req.key)];
+            enqueue(shard, req);
+            int status = wait(shard, req);
+            if (status != RETRY) return status;
+        }
+    }
+
+    // push the request to the ring of the shard; waits while the ring is full
+    static void enqueue(Shard &shard, Request &req) {
+        while (!shard.queue.try_push(&req)) {
+            shard.replies.await([&shard]() { return !shard.queue.was_full(); });
+        }
+        shard.requests.notify_all();
+    }
+
+    static int wait(Shard &shard, Request &req) {
+        int status;
+        shard.replies.await([&req, &status]() {
+            return (status = req.status.load(std::memory_order_acquire)) != PENDING;
+        });
+        return status;
+    }
+
+    size_t route(KeyType key) const {
+        size_t shard_id;
+        uint64_t version;
+        do {
+            version = boundaries_version_.read_begin();
+            shard_id = std::upper_bound(boundaries_.begin() + 1, boundaries_.end(), key) - boundaries_.begin() - 1;
+        } while (!boundaries_version_.read_validate(version));
+        return shard_id;
+    }
+
+    // park the owner of the shard; the caller then has exclusive access to the shard until resume()
+    void pause(Shard &shard) {
+        shard.paused.store(true, std::memory_order_relaxed);
+        Request req(OpType::PAUSE, KeyType());
+        enqueue(shard, req);
+        wait(shard, req);
+    }
+
+    // wait until the owner of the shard has processed the requests before, e.g., resumed and rebuilt its index
+    void sync(Shard &shard) {
+        Request req(OpType::SYNC, KeyType());
+        enqueue(shard, req);
+        wait(shard, req);
+    }
+
+    // set the new range of a paused shard, and the key-value pairs its index is rebuilt from (if any)
+    // NOTE: the shard must not be paused again before sync()
+    void resume(Shard &shard, KeyType lo, KeyType hi, std::unique_ptr<std::vector<KeyValueType>> reload) {
+        shard.lo = lo;
+        shard.hi = hi;
+        shard.reload = std::move(reload);
+        shard.paused.store(false, std::memory_order_release);
+        shard.requests.notify_all();
+    }
+
+    // NOTE: control_mutex_ must be held
+    bool rebalance_pair(size_t i) {
+        Shard &left = *shards_[i], &right = *shards_[i+1];
+        pause(left);
+        pause(right);
+
+        // BuckIndex can not remove keys, so both indexes are rebuilt from their merged keys
+        std::vector<KeyValueType> kvs;
+        collect(left, kvs);
+        collect(right, kvs);
+        size_t mid = std::max<size_t>(kvs.size() / 2, 1);
+        while (mid < kvs.size() && (kvs[mid].key_ <= left.lo || kvs[mid].key_ == kvs[mid-1].key_)) mid++;
+        if (mid >= kvs.size()) { // no boundary inside the left range
+            resume(left, left.lo, left.hi, nullptr);
+            resume(right, right.lo, right.hi, nullptr);
+            sync(left);
+            sync(right);
+            return false;
+        }
+        KeyType boundary = kvs[mid].key_;
+
+        {
+            typename VersionLock<uint64_t>::WriteGuard guard(boundaries_version_);
+            boundaries_[i+1] = boundary;
+        }
+        resume(left, left.lo, boundary, std::make_unique<std::vector<KeyValueType>>(kvs.begin(), kvs.begin() + mid));
+        resume(right, boundary, right.hi, std::make_unique<std::vector<KeyValueType>>(kvs.begin() + mid, kvs.end()));
+        // both indexes are rebuilt in parallel
+        sync(left);
+        sync(right);
+        return true;
+    }
+
+    // append the key-value pairs in the range of a paused shard to kvs, in order
+    void collect(Shard &shard, std::vector<KeyValueType> &kvs) {
+        size_t n = shard.num_keys.load(std::memory_order_relaxed) + 1; // the index may hold a dummy min key
+        std::vector<std::pair<KeyType, ValueType>> buf(n);
+        n = shard.index->scan(std::max(shard.lo, shard.first_key), n, buf.data());
+        for (size_t j = 0; j < n; j++) {
+            if (shard.in_range(buf[j].first)) kvs.push_back(KeyValueType(buf[j].first, buf[j].second));
+        }
+    }
+
+    // the owner thread of a shard
+    void run(Shard &shard, int cpu) {
+        if (cpu >= 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        }
+        // the index is allocated by its owner, i.e., on the memory node of its core
+        shard.index.reset(new IndexType(fill_ratio_, error_bound_));
+
+        Request *req;
+        while (true) {
+            if (!shard.queue.try_pop(req)) {
+                shard.requests.await([&shard]() { return !shard.queue.was_empty(); });
+                continue;
+            }
+
+            int status = FAILURE;
+            switch (req->op) {
+            case OpType::STOP:
+                req->status.store(SUCCESS, std::memory_order_release);
+                shard.replies.notify_all();
+                return;
+            case OpType::SYNC:
+                status = SUCCESS;
+                break;
+            case OpType::PAUSE:
+                req->status.store(SUCCESS, std::memory_order_release);
+                shard.replies.notify_all();
+                shard.requests.await([&shard]() { return !shard.paused.load(std::memory_order_acquire); });
+                if (shard.reload) apply_reload(shard);
+                continue;
+            case OpType::LOOKUP:
+                if (!shard.in_range(req->key)) status = RETRY;
+                else if (req->key >= shard.first_key && shard.index->lookup(req->key, req->value)) status = SUCCESS;
+                break;
+            case OpType::INSERT:
+                if (!shard.in_range(req->key)) status = RETRY;
+                else if (req->key >= shard.first_key) {
+                    KeyValueType kv(req->key, req->value);
+                    if (shard.index->insert(kv)) {
+                        shard.num_keys.store(shard.num_keys.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                        status = SUCCESS;
+                    }
+                }
+                break;
+            case OpType::SCAN:
+                if (!shard.in_range(req->key)) status = RETRY;
+                else {
+                    req->num = shard.index->scan(std::max(req->key, shard.first_key), req->num, req->out);
+                    req->next_key = shard.hi;
+                    req->is_last = shard.is_last;
+                    status = SUCCESS;
+                }
+                break;
+            }
+            // NOTE: the client may return as soon as it sees the status, so req must not be touched afterwards
+            req->status.store(status, std::memory_order_release);
+            shard.replies.notify_all();
+        }
+    }
+
+    // rebuild the index of the shard, in its owner thread
+    void apply_reload(Shard &shard) {
+        std::vector<KeyValueType> &kvs = *shard.reload;
+        KeyType min_key = std::numeric_limits<KeyType>::min();
+        // a key below the smallest loaded key can not be inserted, so the range of a shard must not start below it;
+        // as in BuckIndex::insert() into an empty index, a dummy min key covers the gap (it is out of range)
+        if (!shard.is_first && !kvs.empty() && kvs[0].key_ > shard.lo) {
+            kvs.insert(kvs.begin(), KeyValueType(min_key, 0));
+        }
+        shard.index.reset(new IndexType(fill_ratio_, error_bound_));
+        if (!kvs.empty()) shard.index->bulk_load(kvs);
+        shard.first_key = kvs.empty() ? min_key : kvs[0].key_;
+        shard.num_keys.store(kvs.size(), std::memory_order_relaxed);
+        shard.reload.reset();
+    }
+
+    double fill_ratio_;
+    int error_bound_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<KeyType> boundaries_; // the first key of each range; boundaries_[0] is the min key
+    VersionLock<uint64_t> boundaries_version_; // bumped when boundaries_ change; see route()
+    std::mutex control_mutex_; // serializes bulk_load() and rebalance()
+};
+
+} // end namespace buckindex
@@ -5,14 +5,27 @@
 #include "segment.h"
 #include "segmentation.h"
 #include "util.h"
+#include "node_arena.h"
+#include "epoch.h"
+#include "version_lock.h"
+#include "task_pool.h"
+#include "frozen_format.h"
+#include "tier_file.h"
+#include "compressed_bucket.h"
 
 #include <atomic>
 #include <thread>
-#include <future>
 #include <mutex>
-#include <condition_variable>
-#include <queue>
 #include <vector>
+#include <deque>
+#include <numeric>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <cstdio>
+#include <cstring>
 
 /**
  * Index configurations
@@ -21,112 +34,66 @@
 
 namespace buckindex {
 
-template<typename KeyType, typename ValueType, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE>
+/**
+ * Which of the pairs with equal keys bulk_load_unsorted() keeps
+ */
+enum class DuplicatePolicy {
+    KEEP_FIRST, // the first one in the input
+    KEEP_LAST, // the last one in the input
+    MERGE // one pair whose value folds the values in input order with a merge function
+};
+
+/**
+ * Policies (see policy.h):
+ * HintPolicy: starting/predicted position of a key in a D-Bucket
+ * ModelPolicy: model fitting of the segments
+ * StatsPolicy: whether runtime statistics are collected
+ * SearchKernel: scalar or SIMD probing of D-Buckets
+ * DataListPolicy: layout of the key-value lists of D-Buckets
+ */
+template<typename KeyType, typename ValueType, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE,
+         typename HintPolicy = DefaultHintPolicy, typename ModelPolicy = DefaultModelPolicy,
+         typename StatsPolicy = DefaultStatsPolicy, typename SearchKernel = DefaultSearchKernel,
+         typename DataListPolicy = DefaultDataListPolicy>
 class BuckIndex {
 public:
     //List of template aliasing
-    // TBD: use KeyListValueList or KeyValueList
-    // using DataBucketType = Bucket<KeyListValueList<KeyType, ValueType, DATA_BUCKET_SIZE>,
-    //                              KeyType, ValueType, DATA_BUCKET_SIZE>;
-    using DataBucketType = Bucket<KeyValueList<KeyType, ValueType, DATA_BUCKET_SIZE>,
-                                  KeyType, ValueType, DATA_BUCKET_SIZE>;
-    using SegBucketType = Bucket<KeyValueList<KeyType, ValueType, SEGMENT_BUCKET_SIZE>,
-                                  KeyType, ValueType, SEGMENT_BUCKET_SIZE>;
-    using SegmentType = Segment<KeyType, SEGMENT_BUCKET_SIZE>;
+    using DataListType = typename DataListPolicy::template List<KeyType, ValueType, DATA_BUCKET_SIZE>;
+    using DataBucketType = Bucket<DataListType, KeyType, ValueType, DATA_BUCKET_SIZE, HintPolicy, SearchKernel>;
+    using SegmentType = Segment<KeyType, SEGMENT_BUCKET_SIZE, ModelPolicy, StatsPolicy>;
+    using SegBucketType = typename SegmentType::BucketType;
     using KeyValueType = KeyValue<KeyType, ValueType>;
     using KeyValuePtrType = KeyValue<KeyType, uintptr_t>;
+    using CompressedBucketType = CompressedBucket<KeyType, ValueType>;
     int n_scan_ = 0;
 
+    // a scan of scan_batch()
+    struct ScanRequest {
+        KeyType start_key; // scan from the first key that is >= start_key
+        size_t num_to_scan; // the number of key-value pairs to be scanned
+        std::pair<KeyType, ValueType> *kvs; // the scanned key-value pairs
+        size_t num_scanned; // set by scan_batch(): the number of key-value pairs scanned(<= num_to_scan)
+    };
+
     BuckIndex(double initial_filled_ratio=0.7, int error_bound=8) {
         init(initial_filled_ratio, error_bound);
 
-        // Initialize worker threads
-        shutdown_ = false;
-        for (int i = 0; i < NUM_WORKER_THREADS; i++) {
-            worker_threads_.emplace_back([this]() {
-                while (!shutdown_) {  
-                    SortTask task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex_);
-                        queue_cv_.wait(lock, [this]() { 
-                            return !task_queue_.empty() || shutdown_; 
-                        });
-                        
-                        // Check shutdown condition first
-                        if (shutdown_) {
-                            return;
-                        }
-                        
-                        if (task_queue_.empty()) {
-                            continue;  
-                        }
-                        
-                        task = std::move(task_queue_.front());
-                        task_queue_.pop();
-                    }
-                    
-                    // Prepare and sort the bucket
-                    task.result_vector->reserve(task.reserved_size);
-                    task.bucket->get_valid_kvs(*task.result_vector);
-                    std::sort(task.result_vector->begin(), task.result_vector->end());
-                    task.promise.set_value();
-                }
-            });
-        }
-#ifdef BUCKINDEX_DEBUG
-        std::cout << "BLI: Debug mode" << std::endl;
-#else
-        std::cout << "BLI: Release mode" << std::endl;
-#endif
-
-// hint system configuration
-#ifdef HINT_MOD_HASH
-        std::cout << "BLI: Using mod hash" << std::endl;
-#endif
-#ifdef HINT_CL_HASH
-        std::cout << "BLI: Using cl hash" << std::endl; 
-#endif
-#ifdef HINT_MURMUR_HASH
-        std::cout << "BLI: Using murmur hash" << std::endl; 
-#endif
-#ifdef HINT_MODEL_PREDICT
-        std::cout << "BLI: Using model prediction" << std::endl;
-#endif
-#ifdef NO_HINT
-        std::cout << "BLI: Using no hash" << std::endl;
-#endif
-
-
-#ifdef BUCKINDEX_USE_LINEAR_REGRESSION
-        std::cout << "BLI: Using linear regression" << std::endl;
-#else
-        std::cout << "BLI: Using endpoint linear model" << std::endl;
-#endif
-#ifdef BUCKINDEX_USE_SIMD
-        std::cout << "BLI: Using SIMD" << std::endl;
-#else
-        std::cout << "BLI: Not using SIMD" << std::endl;
-#endif
+        std::cout << "BLI: " << StatsPolicy::name << std::endl;
+        std::cout << "BLI: Using " << HintPolicy::name << std::endl;
+        std::cout << "BLI: Using " << ModelPolicy::name << std::endl;
+        std::cout << "BLI: " << SearchKernel::name << std::endl;
+        std::cout << "BLI: D-Buckets of " << DataListPolicy::name << std::endl;
     }
 
     ~BuckIndex() {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            shutdown_ = true;
-        }
-        queue_cv_.notify_all();  // Wake up all worker threads
-        
-        // Wait for all worker threads to finish
-        for (auto& thread : worker_threads_) {
-            if (thread.joinable()) {
-                thread.join();
-            }
-        }
+        // the D-Buckets and Segments are released in bulk by arena_, without traversing the tree
     }
 
     void init(double initial_filled_ratio, int error_bound){
         root_ = NULL;
+        task_pool_ = &TaskPool::shared();
         num_levels_ = 0;
+        num_keys_ = 0;
 
         error_bound_ = error_bound;
         std::cout << "Segmeantation error bound = " << error_bound_ << std::endl;
@@ -134,92 +101,117 @@ public:
         initial_filled_ratio_ = initial_filled_ratio;
         std::cout << "Initial fill ratio = " << initial_filled_ratio_ << std::endl;
 
-#ifdef BUCKINDEX_DEBUG
-        tn.init();
-#endif
+        if constexpr (StatsPolicy::enabled) tn.init();
+    }
+
+    /**
+     * Pin the current epoch, for a reader running concurrently with insert()
+     * The nodes the reader can reach are not reclaimed until the returned guard is released
+     * Single-threaded users do not need it
+     * @return the guard of the pinned epoch
+     */
+    EpochGuard enter_epoch() {
+        return epoch_.enter();
+    }
+
+    /**
+     * Set the pool that runs the parallel work of the index (e.g., scan_parallel()); TaskPool::shared() by default
+     * @param task_pool: the pool; must outlive the index
+     */
+    void set_task_pool(TaskPool *task_pool) {
+        task_pool_ = task_pool;
     }
 
     /**
      * Lookup function
+     * Safe against a concurrent insert() if the caller holds an epoch guard (see enter_epoch()):
+     * the root, each segment and the D-Bucket are read optimistically, and re-read if they were modified meanwhile.
+     * Without tiered storage, a lookup writes no node and takes no lock. With tiered storage (see enable_tiering()),
+     * a lookup is not read-only: it faults in the spilled D-Bucket it reaches, which locks the leaf segment to swap
+     * the child, and if the index is over budget it runs the eviction sweep, which locks and spills D-Buckets
+     * (see evict()). So it may wait for a writer, or another reader, holding one of these locks. Once tiering or
+     * compress_cold() is used, it also counts its access in the D-Bucket (see Bucket::touch())
      * @param key: lookup key
      * @param value: corresponding value to be returned
      * @return true if the key is found, else false
      */
     bool lookup(KeyType key, ValueType &value) {
-        if (!root_) return false;
+        // read the root and the number of levels as a pair
+        void *root;
+        uint64_t num_levels;
+        uint64_t root_version;
+        do {
+            root_version = root_version_.read_begin();
+            root = root_;
+            num_levels = num_levels_;
+        } while (!root_version_.read_validate(root_version));
+        if (!root) return false;
 
         //auto start = std::chrono::high_resolution_clock::now();
 
-#ifdef BUCKINDEX_DEBUG
-        auto start_time = tn.rdtsc();
-#endif
-        
+        int64_t start_time = 0, end_traverse_time = 0;
+        if constexpr (StatsPolicy::enabled) start_time = tn.rdtsc();
 
-        uint64_t layer_idx = num_levels_ - 1;
-        uintptr_t seg_ptr = (uintptr_t)root_;
+        uint64_t layer_idx = num_levels - 1;
+        uintptr_t seg_ptr = (uintptr_t)root;
         bool result = false;
         value = 0;
         KeyValuePtrType kv_ptr;
         KeyValuePtrType kv_ptr_next;
+        SegmentType* segment = nullptr;
         while (layer_idx > 0) {
-            SegmentType* segment = (SegmentType*)seg_ptr;
-            result = segment->lb_lookup(key, kv_ptr, kv_ptr_next);
+            segment = (SegmentType*)seg_ptr;
+            uint32_t seg_version;
+            do {
+                seg_version = segment->read_begin();
+                result = segment->lb_lookup(key, kv_ptr, kv_ptr_next);
+            } while (!segment->read_validate(seg_version));
             seg_ptr = kv_ptr.value_;
-#ifdef BUCKINDEX_DEBUG
-            if (!seg_ptr) {
-                std::cerr << " failed to perform segment lookup for key: " << key << std::endl;
-                return false;
+            if constexpr (StatsPolicy::enabled) {
+                if (!seg_ptr) {
+                    std::cerr << " failed to perform segment lookup for key: " << key << std::endl;
+                    return false;
+                }
             }
-#endif
             layer_idx--;
         }
 
-#ifdef BUCKINDEX_DEBUG
-        auto end_traverse_time = tn.rdtsc();
-        lookup_stats_.time_traverse_to_leaf += (tn.tsc2ns(end_traverse_time) - tn.tsc2ns(start_time))/(double) 1000000000;
-#endif
-
-        // decide the hint
-        size_t hint = 0;
-#ifdef HINT_MOD_HASH
-        hint = (key) % DATA_BUCKET_SIZE;
-#endif
-#ifdef HINT_CL_HASH
-        hint = clhash64(key) % DATA_BUCKET_SIZE; 
-#endif
-#ifdef HINT_MURMUR_HASH
-        hint = murmur64(key) % DATA_BUCKET_SIZE; 
-#endif
-#ifdef HINT_MODEL_PREDICT
-        //given kv_ptr and kv_ptr_next, check their key to make a linear model
-        KeyType start_key = kv_ptr.key_;
-        KeyType end_key = kv_ptr_next.key_;
-        double slope = (long double)DATA_BUCKET_SIZE / (long double)(end_key - start_key);
-        double offset = -slope * start_key;
-        hint = (size_t)(slope * key + offset);
-#endif
-#ifdef NO_HINT
-        hint=0;
-#endif
-
-        hint = std::min(hint, DATA_BUCKET_SIZE - 1);
-
-        DataBucketType* d_bucket = (DataBucketType *)seg_ptr;
-        result = d_bucket->lookup(key, value, hint);
-
-#ifdef BUCKINDEX_DEBUG
-        auto end_time = tn.rdtsc();
-        auto diff = tn.tsc2ns(end_time) - tn.tsc2ns(start_time);
-        lookup_stats_.time_lookup_in_leaf += (tn.tsc2ns(end_time) - tn.tsc2ns(end_traverse_time))/(double) 1000000000;
-        lookup_stats_.time_lookup += (diff/(double) 1000000000);
-        lookup_stats_.num_of_lookup++;
-#endif
+        if constexpr (StatsPolicy::enabled) {
+            end_traverse_time = tn.rdtsc();
+            lookup_stats_.time_traverse_to_leaf += (tn.tsc2ns(end_traverse_time) - tn.tsc2ns(start_time))/(double) 1000000000;
+        }
+
+        if (is_compressed(kv_ptr.value_)) { // searched in place; immutable
+            result = to_compressed(kv_ptr.value_)->lookup(key, value);
+        } else {
+            DataBucketType* d_bucket = resolve_d_bucket(segment, kv_ptr, Access::READ);
+
+            uint16_t bucket_version;
+            do {
+                bucket_version = d_bucket->read_begin();
+                // decide the hint; kv_ptr and kv_ptr_next give the key range of the d-bucket
+                size_t hint = HintPolicy::template hint<DATA_BUCKET_SIZE>(*d_bucket, key, kv_ptr.key_, kv_ptr_next.key_);
+                hint = std::min(hint, DATA_BUCKET_SIZE - 1);
 
+                result = d_bucket->lookup(key, value, hint);
+            } while (!d_bucket->read_validate(bucket_version));
+        }
+
+        if constexpr (StatsPolicy::enabled) {
+            auto end_time = tn.rdtsc();
+            auto diff = tn.tsc2ns(end_time) - tn.tsc2ns(start_time);
+            lookup_stats_.time_lookup_in_leaf += (tn.tsc2ns(end_time) - tn.tsc2ns(end_traverse_time))/(double) 1000000000;
+            lookup_stats_.time_lookup += (diff/(double) 1000000000);
+            lookup_stats_.num_of_lookup++;
+        }
+
+        maybe_evict();
         return result;
     }
 
     /**
      * Scan function
+     * With tiered storage, it faults in and spills D-Buckets like lookup()
      * @param start_key: scan from the first key that is >= start_key
      * @param scan_num: the number of key-value pairs to be scanned
      * @param kvs: the scanned key-value pairs
@@ -227,14 +219,15 @@ public:
     */
     size_t scan(KeyType start_key, size_t num_to_scan, std::pair<KeyType, ValueType> *kvs) {
         if (!root_) return 0;
+        EpochGuard guard = epoch_.enter(); // for the copies of the compressed D-Buckets (see resolve_d_bucket())
 
         n_scan_++;
         int num_scanned = 0;
 
         // traverse to leaf and record the path
         std::vector<KeyValuePtrType> path(num_levels_);//root-to-leaf path, including the data bucket
-        LinearModel<KeyType> dummy_model;
-        bool success = lookup_path(start_key, path, dummy_model);
+        KeyType next_pivot;
+        bool success = lookup_path(start_key, path, next_pivot);
 
         // get the d-bucket
         DataBucketType* d_bucket = (DataBucketType *)(path[num_levels_-1]).value_;
@@ -249,287 +242,687 @@ public:
 
             // get the next d-bucket
             if (num_scanned < num_to_scan) {
+                bool found;
                 do {
-                    if (!find_next_d_bucket(path)) return num_scanned;
+                    found = find_next_d_bucket(path);
                     d_bucket = (DataBucketType *)(path[num_levels_-1]).value_;
-                } while (d_bucket->num_keys() == 0); // empty d-bucket, visit the next one
+                } while (found && d_bucket->num_keys() == 0); // empty d-bucket, visit the next one
+                if (!found) break;
             }
         }
         
+        maybe_evict();
         return num_scanned;
     }
 
 
-    size_t scan_parallel(KeyType start_key, size_t num_to_scan, std::pair<KeyType, ValueType> *result) {
+    /**
+     * Scan function for many short scans; same results as scan() for each request
+     * The requests are run in the order of their start keys, in one pass over the D-Buckets they touch:
+     * the D-Buckets are sorted once into a window shared by the overlapping and adjacent requests, and a request
+     * only descends from the root if it starts beyond the window and the D-Bucket after it
+     * With tiered storage, it faults in and spills D-Buckets like lookup()
+     * @param requests: the scans; num_scanned is set for each of them
+     * @return the total number of key-value pairs scanned
+     */
+    size_t scan_batch(std::vector<ScanRequest> &requests) {
+        for (auto &req : requests) req.num_scanned = 0;
         if (!root_) return 0;
+        EpochGuard guard = epoch_.enter(); // for the copies of the compressed D-Buckets (see resolve_d_bucket())
+        n_scan_ += requests.size();
+
+        std::vector<size_t> order(requests.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&requests](size_t a, size_t b) { return requests[a].start_key < requests[b].start_key; });
+
+        std::vector<KeyValuePtrType> path(num_levels_); // the path to the last D-Bucket of the window
+        std::deque<std::vector<KeyValueType>> window; // the sorted kvs of consecutive D-Buckets
+        bool exhausted = false; // the last D-Bucket of the window is the last of the index
+        auto advance = [&]() { // extend the window with the next D-Bucket
+            if (exhausted || !find_next_d_bucket(path)) {
+                exhausted = true;
+                return false;
+            }
+            window.emplace_back();
+            ((DataBucketType *)path[num_levels_-1].value_)->get_valid_kvs(window.back());
+            std::sort(window.back().begin(), window.back().end());
+            return true;
+        };
 
-        // Find the starting bucket
-        std::vector<KeyValuePtrType> path(num_levels_);
-        LinearModel<KeyType> dummy_model;
-        bool success = lookup_path(start_key, path, dummy_model);
-        
-        // Collect kvs from each bucket into separate vectors
-        DataBucketType* curr_bucket = (DataBucketType *)(path[num_levels_-1]).value_;
-        auto dbuck_iter = curr_bucket->lower_bound(start_key);
-
-        size_t total_kvs = 0;
-        std::vector<DataBucketType*> target_buckets;
-        std::vector<size_t> bucket_sizes;
+        size_t total_scanned = 0;
+        for (size_t id : order) {
+            ScanRequest &req = requests[id];
+            if (req.num_to_scan == 0) continue;
 
-        while (curr_bucket && total_kvs < num_to_scan) {
-            size_t bucket_size = curr_bucket->num_keys();
-            if (bucket_size > 0) {
-                target_buckets.push_back(curr_bucket);
-                bucket_sizes.push_back(bucket_size);
-                total_kvs += bucket_size;
+            // drop the D-Buckets whose keys are all < start_key; the earlier requests are done with them
+            bool had_window = !window.empty();
+            while (!window.empty() && (window.front().empty() || window.front().back().key_ < req.start_key)) {
+                window.pop_front();
             }
-            
-            if (!find_next_d_bucket(path)) break;
-            curr_bucket = (DataBucketType*)(path[num_levels_-1]).value_;
-        }
-        
-        // Pre-allocate vectors for all buckets
-        std::vector<std::vector<KeyValueType>> bucket_kvs_list(target_buckets.size());
-        std::vector<std::future<void>> futures;
-
-        // Distribute sorting tasks to worker threads
-        for (size_t i = 0; i < target_buckets.size(); i++) {
-            std::promise<void> promise;
-            futures.push_back(promise.get_future());
-            
-            {
-                std::lock_guard<std::mutex> lock(queue_mutex_);
-                task_queue_.push({
-                    target_buckets[i],
-                    bucket_sizes[i],
-                    &bucket_kvs_list[i],
-                    std::move(promise)
-                });
+            // the request may start in the D-Bucket right after the window
+            if (window.empty() && had_window && advance() &&
+                (window.back().empty() || window.back().back().key_ < req.start_key)) {
+                window.clear();
+            }
+            if (window.empty()) { // descend to the D-Bucket of start_key
+                KeyType next_pivot;
+                lookup_path(req.start_key, path, next_pivot);
+                exhausted = false;
+                window.emplace_back();
+                ((DataBucketType *)path[num_levels_-1].value_)->get_valid_kvs(window.back());
+                std::sort(window.back().begin(), window.back().end());
+            }
+
+            size_t n = 0;
+            for (size_t w = 0; n < req.num_to_scan; w++) {
+                if (w == window.size() && !advance()) break;
+                const std::vector<KeyValueType> &leaf = window[w];
+                auto it = n == 0 ? std::lower_bound(leaf.begin(), leaf.end(), KeyValueType(req.start_key, 0)) : leaf.begin();
+                for (; it != leaf.end() && n < req.num_to_scan; ++it) req.kvs[n++] = std::make_pair(it->key_, it->value_);
             }
-            queue_cv_.notify_one();
+            req.num_scanned = n;
+            total_scanned += n;
         }
+        maybe_evict();
+        return total_scanned;
+    }
+
+    /**
+     * Scan function for large ranges (e.g., exports of millions of keys); same results as scan()
+     * The first D-Bucket is trimmed to the keys >= start_key, then the key counts of the next D-Buckets are
+     * prefix-summed into the offsets of their slices in kvs, so the tasks of the pool (see set_task_pool())
+     * sort their D-Buckets and write them to disjoint slices directly; the last D-Bucket is trimmed to num_to_scan
+     * With tiered storage, it faults in and spills D-Buckets like lookup()
+     * @param start_key: scan from the first key that is >= start_key
+     * @param num_to_scan: the number of key-value pairs to be scanned
+     * @param kvs: the scanned key-value pairs
+     * @return the number of key-value pairs scanned(<= num_to_scan)
+     */
+    size_t scan_parallel(KeyType start_key, size_t num_to_scan, std::pair<KeyType, ValueType> *kvs) {
+        if (!root_ || num_to_scan == 0) return 0;
+        EpochGuard guard = epoch_.enter(); // for the copies of the compressed D-Buckets (see resolve_d_bucket())
+
+        // Find the starting bucket
+        std::vector<KeyValuePtrType> path(num_levels_);
+        KeyType next_pivot;
+        lookup_path(start_key, path, next_pivot);
 
-        // Wait for all sorting tasks to complete
-        for (auto& future : futures) {
-            future.wait();
+        // the first D-Bucket, trimmed to the keys >= start_key
+        DataBucketType* d_bucket = (DataBucketType *)(path[num_levels_-1]).value_;
+        std::vector<KeyValueType> first_kvs;
+        d_bucket->get_valid_kvs(first_kvs);
+        std::sort(first_kvs.begin(), first_kvs.end());
+        size_t num_scanned = 0;
+        auto it = std::lower_bound(first_kvs.begin(), first_kvs.end(), KeyValueType(start_key, 0));
+        for (; it != first_kvs.end() && num_scanned < num_to_scan; ++it) {
+            kvs[num_scanned++] = std::make_pair(it->key_, it->value_);
         }
 
-        int i = 0;
-        int j = lower_bound(bucket_kvs_list[i].begin(), bucket_kvs_list[i].end(), KeyValueType(start_key, 0)) - bucket_kvs_list[i].begin();
-        size_t num_copied = 0;
-        while (i < bucket_kvs_list.size() && j < bucket_kvs_list[i].size() && num_copied < num_to_scan) {
-            result[num_copied] = std::make_pair(bucket_kvs_list[i][j].key_, bucket_kvs_list[i][j].value_);
-            num_copied++;
-            j++;
+        // the next D-Buckets, and the offsets of their slices
+        std::vector<DataBucketType*> target_buckets;
+        std::vector<size_t> offsets(1, num_scanned);
+        while (offsets.back() < num_to_scan && find_next_d_bucket(path)) {
+            d_bucket = (DataBucketType *)(path[num_levels_-1]).value_;
+            size_t bucket_size = d_bucket->num_keys();
+            if (bucket_size == 0) continue; // empty d-bucket, visit the next one
+            target_buckets.push_back(d_bucket);
+            offsets.push_back(std::min(offsets.back() + bucket_size, num_to_scan));
         }
 
-        // Use two for loops to copy the sorted kvs to the result array
-        for (size_t i = 1; i < bucket_kvs_list.size() && num_copied < num_to_scan; i++) {
-            for (size_t j = 0; j < bucket_kvs_list[i].size() && num_copied < num_to_scan; j++) {
-                // convert KeyValuePtrType to pair<KeyType, ValueType>
-                result[num_copied] = std::make_pair(bucket_kvs_list[i][j].key_, bucket_kvs_list[i][j].value_);
-                num_copied++;
+        // sort each D-Bucket into its slice, a few D-Buckets per task
+        task_pool_->parallel_for(0, target_buckets.size(), 0, [&](size_t begin, size_t end) {
+            std::vector<KeyValueType> bucket_kvs;
+            bucket_kvs.reserve(DATA_BUCKET_SIZE);
+            for (size_t i = begin; i < end; i++) {
+                target_buckets[i]->get_valid_kvs(bucket_kvs);
+                size_t n = std::min(bucket_kvs.size(), offsets[i+1] - offsets[i]);
+                if (n < bucket_kvs.size()) {
+                    std::partial_sort(bucket_kvs.begin(), bucket_kvs.begin() + n, bucket_kvs.end());
+                } else {
+                    std::sort(bucket_kvs.begin(), bucket_kvs.end());
+                }
+                std::pair<KeyType, ValueType> *slice = kvs + offsets[i];
+                for (size_t j = 0; j < n; j++) slice[j] = std::make_pair(bucket_kvs[j].key_, bucket_kvs[j].value_);
             }
-        }
-        return num_copied;
+        });
+        maybe_evict();
+        return offsets.back();
     }
 
     /**
     * Insert function
+    * Concurrent insert() and lookup() calls are safe if every caller holds an epoch guard (see enter_epoch()).
+    * A writer locks only the D-Bucket it inserts into; a split also locks the segments it modifies, bottom-up,
+    * by upgrading the optimistic reads made on the way down (see split_and_propagate()).
+    * If a node changed since it was read, the insert restarts from the root
+    * NOTE: the statistics of StatsPolicy are not synchronized between writers
     * @param kv: the Key-Value pair to be inserted
     * @return true if kv in inserted, false else
     */
     bool insert(KeyValueType& kv) { // TODO: change to model-based insertion for d-buckets
 
-#ifdef BUCKINDEX_DEBUG
-        auto start_time = tn.rdtsc();
-#endif
+        uint64_t start_time = 0, insert_finish_time = 0;
+        if constexpr (StatsPolicy::enabled) start_time = tn.rdtsc();
+
+        bool success;
+        while (true) {
+            // read the root and the number of levels as a pair
+            uint64_t root_version = root_version_.read_begin();
+            void *root = root_;
+            uint64_t num_levels = num_levels_;
+            if (!root_version_.read_validate(root_version)) continue;
+
+            if (root == nullptr) {
+                if (!root_version_.try_lock(root_version)) continue;
+                std::vector<KeyValueType> kvs;
+                KeyValueType kv1(std::numeric_limits<KeyType>::min(), 0);
+                kvs.push_back(kv1);
+                kvs.push_back(kv);
+                {
+                    typename VersionLock<uint64_t>::WriteGuard root_guard(root_version_);
+                    bulk_load_locked(kvs);
+                }
+                root_version_.unlock();
+                return true;
+            }
 
-        if (root_ == nullptr) { 
-            std::vector<KeyValueType> kvs;
-            KeyValueType kv1(std::numeric_limits<KeyType>::min(), 0);
-            kvs.push_back(kv1);
-            kvs.push_back(kv);
-            bulk_load(kvs);
-            return true;
+            // traverse to the leaf D-Bucket, and record the path and the versions of its segments
+            std::vector<KeyValuePtrType> path(num_levels);//root-to-leaf path, including the  data bucket
+            std::vector<uint32_t> seg_versions(num_levels - 1);
+            KeyType next_pivot;
+            success = lookup_path(kv.key_, root, path, next_pivot, seg_versions.data());
+            assert(success);
+            DataBucketType* d_bucket = (DataBucketType *)(path[num_levels-1].value_);
+            if (!d_bucket->lock()) continue; // the D-Bucket was split meanwhile
+
+            size_t hint = HintPolicy::template hint<DATA_BUCKET_SIZE>(*d_bucket, kv.key_,
+                                                                      path[num_levels-1].key_, next_pivot);
+            hint = std::min(hint, DATA_BUCKET_SIZE - 1);
+            if(kv.key_ == 0) {
+                success = d_bucket->update(kv);
+                //std::cout << "update key==0" << std::endl;
+                d_bucket->unlock();
+                maybe_evict();
+                return success;
+            }
+            else {
+                success = d_bucket->insert(kv, true, hint);
+            }
+
+            if constexpr (StatsPolicy::enabled) insert_finish_time = tn.rdtsc();
+            if (success) {
+                d_bucket->unlock();
+                break;
+            }
+
+            // if fail to insert, split the bucket, and add new kvptr on parent segment
+            if (split_and_propagate(kv, d_bucket, path, seg_versions, root_version)) {
+                success = true;
+                break;
+            }
+
+            // a node on the path was modified by another writer; nothing was changed, retry from the root
+            d_bucket->unlock();
+            std::this_thread::yield();
         }
 
-        // traverse to the leaf D-Bucket, and record the path
-        std::vector<KeyValuePtrType> path(num_levels_);//root-to-leaf path, including the  data bucket
-        LinearModel<KeyType> model;
-        bool success = lookup_path(kv.key_, path, model);
-        assert(success);
-        size_t hint = 0;
-#ifdef HINT_MOD_HASH
-        hint = (kv.key_) % DATA_BUCKET_SIZE;
-#endif
-#ifdef HINT_CL_HASH
-        hint = clhash64(kv.key_) % DATA_BUCKET_SIZE; 
-#endif
-#ifdef HINT_MURMUR_HASH
-        hint = murmur64(kv.key_) % DATA_BUCKET_SIZE; 
-#endif
-#ifdef HINT_MODEL_PREDICT
-        hint = model.predict(kv.key_);
-#endif
-#ifdef NO_HINT
-        hint=0;
-#endif
-
-        hint = std::min(hint, DATA_BUCKET_SIZE - 1);
-        DataBucketType* d_bucket = (DataBucketType *)(path[num_levels_-1].value_);
-        if(kv.key_ == 0) {
-            success = d_bucket->update(kv);
-            //std::cout << "update key==0" << std::endl;
-            return success;
-        }
-        else {
-            success = d_bucket->insert(kv, true, hint);
+        if constexpr (StatsPolicy::enabled) {
+            auto end_time = tn.rdtsc();
+            insert_stats_.time_insert_in_leaf += (tn.tsc2ns(insert_finish_time) - tn.tsc2ns(start_time))/(double) 1000000000;
+            insert_stats_.time_SMO += (tn.tsc2ns(end_time) - tn.tsc2ns(insert_finish_time))/(double) 1000000000;
+            insert_stats_.num_of_insert++;
+            num_keys_++;
         }
-        
-#ifdef BUCKINDEX_DEBUG
-        auto insert_finish_time = tn.rdtsc();
-#endif
-        // TODO: need to implement the GC
-        std::vector<uintptr_t> GC_segs;
+        maybe_evict();
+        return success;
+    }
 
-        // if fail to insert, split the bucket, and add new kvptr on parent segment
-        if (!success) {
-            std::vector<KeyValuePtrType> pivot_list[2]; // ping-pong list
-            int ping = 0, pong = 1;
-
-            // split d_bucket
-            auto new_d_buckets = d_bucket->split_and_insert(kv);
-            pivot_list[ping].push_back(new_d_buckets.first);
-            pivot_list[ping].push_back(new_d_buckets.second);
-            KeyValuePtrType old_pivot = path[num_levels_-1];
-
-            // propagate the insertion to the parent segments
-            assert(num_levels_ >= 2); // insert into leaf segment
-            int cur_level = num_levels_ - 2; // leaf_segment level
-            while(cur_level >= 0) {
-                SegmentType* cur_segment = (SegmentType*)(path[cur_level].value_);
-                
-                bool is_segment = true;
-                if (cur_level == num_levels_ - 2) is_segment = false;
-                if (cur_segment->batch_update(old_pivot, pivot_list[ping], is_segment)) {
-                    pivot_list[ping].clear();
-                    success = true;
-                    break;
+    /**
+     * Insert a batch of key-value pairs sorted by key
+     * The pairs that fall into the same D-Bucket are inserted with one traversal and one lock of the D-Bucket;
+     * a pair that does not fit is inserted by insert(), which splits the D-Bucket
+     * Same concurrency guarantees as insert()
+     * @param kvs: the key-value pairs, sorted by key
+     * @param results: set to the return value of insert() for each pair
+     * @return the number of inserted pairs
+     */
+    size_t insert_batch(std::vector<KeyValueType> &kvs, std::vector<bool> &results) {
+        results.assign(kvs.size(), false);
+        size_t num_inserted = 0;
+        size_t i = 0;
+        while (i < kvs.size()) {
+            // read the root and the number of levels as a pair
+            uint64_t root_version = root_version_.read_begin();
+            void *root = root_;
+            uint64_t num_levels = num_levels_;
+            if (!root_version_.read_validate(root_version)) continue;
+            if (root == nullptr) { // the first insert builds the index
+                results[i] = insert(kvs[i]);
+                num_inserted += results[i];
+                i++;
+                continue;
+            }
+
+            // one traversal for all the pairs in the key range of the D-Bucket
+            std::vector<KeyValuePtrType> path(num_levels);
+            KeyType next_pivot;
+            lookup_path(kvs[i].key_, root, path, next_pivot, nullptr);
+            DataBucketType* d_bucket = (DataBucketType *)(path[num_levels-1].value_);
+            if (!d_bucket->lock()) continue; // the D-Bucket was split meanwhile
+
+            size_t j = i;
+            bool full = false;
+            do {
+                bool success;
+                if (kvs[j].key_ == 0) {
+                    success = d_bucket->update(kvs[j]);
+                } else {
+                    size_t hint = HintPolicy::template hint<DATA_BUCKET_SIZE>(*d_bucket, kvs[j].key_,
+                                                                              path[num_levels-1].key_, next_pivot);
+                    hint = std::min(hint, DATA_BUCKET_SIZE - 1);
+                    success = d_bucket->insert(kvs[j], true, hint);
+                    full = !success;
                 }
+                if (full) break;
+                results[j] = success;
+                num_inserted += success;
+                if constexpr (StatsPolicy::enabled) {
+                    if (kvs[j].key_ != 0) {
+                        insert_stats_.num_of_insert++;
+                        num_keys_++;
+                    }
+                }
+                j++;
+            } while (j < kvs.size() && kvs[j].key_ < next_pivot);
+            d_bucket->unlock();
+
+            // the D-Bucket is full: split it with the next pair
+            if (full) {
+                results[j] = insert(kvs[j]);
+                num_inserted += results[j];
+                j++;
+            }
+            i = j;
+        }
+        maybe_evict();
+        return num_inserted;
+    }
+
+    /**
+     * Bulk load the user key value onto the learned index
+     * Each stage runs in parallel in the pool (see set_task_pool()): filling the D-Buckets, the segmentation of
+     * each model layer, and the construction of its segments; the resulting structure does not depend on the pool
+     * @param kvs: list of user key value to be loaded onto the learned index; sorted by key, with unique keys
+     * @throw std::invalid_argument if kvs is empty, or not sorted, or has duplicate keys; the index is not modified
+     */
+    void bulk_load(vector<KeyValueType> &kvs) { // TODO: change to model-based insertion for d-buckets
+        check_sorted_unique(kvs, "bulk_load");
+        bulk_load_sorted(kvs);
+    }
 
-                pivot_list[pong].clear();
-                success = cur_segment->segment_and_batch_update(initial_filled_ratio_, pivot_list[ping], pivot_list[pong]);
-#ifdef BUCKINDEX_DEBUG
-                level_stats_[num_levels_ - 1 - cur_level] += (pivot_list[pong].size()-1);
-#endif
-                old_pivot = path[cur_level];
-                assert(success);
+    /**
+     * Bulk load key value pairs in any order, possibly with duplicate keys
+     * kvs is sorted (in parallel, stable) and deduplicated in place, then loaded like bulk_load(), so no full-size
+     * copy of the input is made
+     * @param kvs: list of user key value to be loaded onto the learned index; sorted and deduplicated on return
+     * @param policy: which of the pairs with equal keys is kept
+     * @param merge: for DuplicatePolicy::MERGE, merge(accumulated value, next value) in input order
+     * @throw std::invalid_argument if kvs is empty, or a key is NaN, or MERGE is given no merge function
+     */
+    void bulk_load_unsorted(vector<KeyValueType> &kvs, DuplicatePolicy policy = DuplicatePolicy::KEEP_LAST,
+                            std::function<ValueType(const ValueType&, const ValueType&)> merge = nullptr) {
+        if (kvs.empty()) throw std::invalid_argument("bulk_load_unsorted: empty input");
+        if (policy == DuplicatePolicy::MERGE && !merge) {
+            throw std::invalid_argument("bulk_load_unsorted: DuplicatePolicy::MERGE needs a merge function");
+        }
+        if constexpr (std::is_floating_point<KeyType>::value) {
+            // NaN keys have no order
+            for (size_t i = 0; i < kvs.size(); i++) {
+                if (kvs[i].key_ != kvs[i].key_) {
+                    throw std::invalid_argument("bulk_load_unsorted: NaN key at position " + std::to_string(i));
+                }
+            }
+        }
 
-                GC_segs.push_back((uintptr_t)cur_segment);
-                cur_level--;
-                ping = 1 - ping;
-                pong = 1 - pong;
+        // stable, so the pairs with equal keys stay in input order
+        task_pool_->parallel_stable_sort(kvs.begin(), kvs.end(),
+                                         [](const KeyValueType &a, const KeyValueType &b) { return a.key_ < b.key_; });
+
+        size_t num_unique = 0;
+        for (size_t i = 0; i < kvs.size(); ) {
+            size_t j = i + 1;
+            while (j < kvs.size() && kvs[j].key_ == kvs[i].key_) j++;
+            // the pairs [i, j) have the same key
+            switch (policy) {
+            case DuplicatePolicy::KEEP_FIRST:
+                kvs[num_unique] = kvs[i];
+                break;
+            case DuplicatePolicy::KEEP_LAST:
+                kvs[num_unique] = kvs[j-1];
+                break;
+            case DuplicatePolicy::MERGE: {
+                ValueType value = kvs[i].value_;
+                for (size_t k = i + 1; k < j; k++) value = merge(value, kvs[k].value_);
+                kvs[num_unique] = KeyValueType(kvs[i].key_, value);
+                break;
+            }
+            }
+            num_unique++;
+            i = j;
+        }
+        kvs.resize(num_unique);
+        bulk_load_sorted(kvs);
+    }
+
+    /**
+     * Streaming bulk load, e.g., from a file: the pairs are consumed in order, one chunk of D-Buckets at a time,
+     * and only the anchors of the D-Buckets are kept to build the upper layers, so the input does not have to fit
+     * in memory next to the index. Same resulting structure as bulk_load()
+     * @param first, last: input iterators over the key value pairs, sorted by key, with unique keys
+     * @throw std::invalid_argument if the input is empty, or not sorted, or has duplicate keys; the index is not modified
+     */
+    template<typename InputIt>
+    void bulk_load(InputIt first, InputIt last) {
+        bulk_load_stream([&first, &last](KeyValueType &kv) {
+            if (first == last) return false;
+            kv = *first;
+            ++first;
+            return true;
+        });
+    }
+
+    /**
+     * Streaming bulk load from separate key and value columns (see the iterator version)
+     * @param keys, values: the columns, num_kvs entries each; sorted by key, with unique keys
+     */
+    void bulk_load(const KeyType *keys, const ValueType *values, size_t num_kvs) {
+        size_t i = 0;
+        bulk_load_stream([keys, values, num_kvs, &i](KeyValueType &kv) {
+            if (i == num_kvs) return false;
+            kv = KeyValueType(keys[i], values[i]);
+            i++;
+            return true;
+        });
+    }
+
+    /**
+     * Save the index to a snapshot file, for a fast restart with load()
+     * Binary format, in native byte order, versioned by SNAPSHOT_VERSION: a header with the configuration of the
+     * index, then the levels bottom-up: the D-Buckets (with their bitmaps and hints), then the segments of each
+     * model layer (LinearModel, number of S-Buckets, S-Buckets). The child pointers in the S-Buckets are saved as
+     * indexes into the level below, which lists the children of its parents in key order
+     * NOTE: no insert may run concurrently
+     * @param path: the snapshot file; overwritten
+     * @throw std::runtime_error if the file cannot be written
+     */
+    void save(const std::string &path) {
+        SnapshotFile file(path, "wb");
+        std::vector<std::vector<void*>> levels = collect_levels();
+
+        SnapshotHeader header = make_snapshot_header();
+        header.num_levels = levels.size();
+        for (size_t l = 0; l < levels.size(); l++) header.level_sizes[l] = levels[levels.size() - 1 - l].size();
+        file.write(&header, sizeof(header));
+
+        if (!levels.empty()) {
+            DataBucketType image;
+            for (void *node : levels.back()) file.write(peek_d_bucket(node, image), sizeof(DataBucketType));
+        }
+        for (size_t l = levels.size(); l-- > 1; ) { // the model layers, bottom-up
+            uintptr_t child = 0;
+            for (void *node : levels[l - 1]) {
+                SegmentType *segment = (SegmentType *)node;
+                SegmentRecord record(segment->get_model(), segment->num_bucket_);
+                file.write(&record, sizeof(record));
+                for (int b = 0; b < segment->num_bucket_; b++) {
+                    SegBucketType s_bucket(*segment->get_bucket(b));
+                    int slots[SEGMENT_BUCKET_SIZE];
+                    int num_slots = sorted_slots(s_bucket, slots);
+                    for (int k = 0; k < num_slots; k++) s_bucket.set_value(slots[k], child++);
+                    file.write(&s_bucket, sizeof(s_bucket));
+                }
             }
+        }
+        file.close();
+    }
 
-            // add one more level
-            assert(pivot_list[ping].size() == 0 || cur_level == -1);
+    /**
+     * Load a snapshot written by save(), replacing the content of the index
+     * The file is read sequentially in large chunks, and the nodes are rebuilt bottom-up in one pass, relocating
+     * the child pointers of each segment as it is read: no segmentation and no sorting
+     * NOTE: no lookup or insert may run concurrently
+     * @param path: the snapshot file
+     * @throw std::runtime_error if the file cannot be read, is corrupt, or was saved by an index with other
+     *        template parameters; the index is not modified (the nodes already rebuilt stay in the arena)
+     */
+    void load(const std::string &path) {
+        SnapshotFile file(path, "rb");
+        SnapshotHeader header;
+        file.read(&header, sizeof(header));
+        check_snapshot_header(header, path, file.remaining());
+
+        // the D-Buckets, one chunk at a time; allocated in order, then copied in parallel
+        std::vector<void*> nodes(header.num_levels ? header.level_sizes[0] : 0);
+        std::vector<DataBucketType> chunk;
+        for (size_t first = 0; first < nodes.size(); first += SNAPSHOT_CHUNK_BUCKETS) {
+            size_t n = std::min(SNAPSHOT_CHUNK_BUCKETS, nodes.size() - first);
+            chunk.resize(n);
+            file.read(chunk.data(), n * sizeof(DataBucketType));
+            for (size_t i = 0; i < n; i++) nodes[first + i] = arena_.allocate(sizeof(DataBucketType));
+            task_pool_->parallel_for(0, n, BULK_LOAD_GRAIN, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) new (nodes[first + i]) DataBucketType(chunk[i]); // resets the lock
+            });
+        }
 
-            // what if there is only one node
-            if (pivot_list[ping].size() > 1) {
-                LinearModel<KeyType> model;
-#ifdef BUCKINDEX_USE_LINEAR_REGRESSION
-                std::vector<KeyType> keys;
-                for (auto kv_ptr : pivot_list[ping]) {
-                    keys.push_back(kv_ptr.key_);
+        // the model layers, bottom-up; nodes holds the level below
+        std::vector<void*> parents;
+        std::vector<SegBucketType> s_buckets;
+        for (uint64_t l = 1; l < header.num_levels; l++) {
+            parents.resize(header.level_sizes[l]);
+            size_t num_children = 0;
+            for (void *&parent : parents) {
+                SegmentRecord record;
+                file.read(&record, sizeof(record));
+                if (record.num_bucket == 0 || record.num_bucket > file.remaining() / sizeof(SegBucketType)) {
+                    throw std::runtime_error("load: corrupt segment in snapshot " + path);
                 }
-                model = LinearModel<KeyType>::get_regression_model(keys);
-#else
-                // TODO: instead of endpoints, use linear regression
-                double start_key = pivot_list[ping].front().key_;
-                double end_key = pivot_list[ping].back().key_;
-                double slope = 0.0, offset = 0.0;
-                if (pivot_list[ping].size() > 1) {
-                    slope = (long double)pivot_list[ping].size() / (long double)(end_key - start_key);
-                    offset = -slope * start_key;
+                s_buckets.resize(record.num_bucket);
+                file.read(s_buckets.data(), record.num_bucket * sizeof(SegBucketType));
+                SegmentType *segment = new (SegmentType::allocate_image(arena_, record.num_bucket))
+                                           SegmentType(record.model, record.num_bucket, s_buckets.data());
+                for (int b = 0; b < segment->num_bucket_; b++) {
+                    SegBucketType *s_bucket = segment->get_bucket(b);
+                    for (int pos = 0; pos < SEGMENT_BUCKET_SIZE; pos++) {
+                        if (!s_bucket->valid(pos)) continue;
+                        uintptr_t child = s_bucket->at(pos).value_;
+                        if (child >= nodes.size()) throw std::runtime_error("load: corrupt child in snapshot " + path);
+                        s_bucket->set_value(pos, (uintptr_t)nodes[child]);
+                        num_children++;
+                    }
                 }
-                model = LinearModel<KeyType>(slope, offset);
-#endif
-                root_ = new SegmentType(pivot_list[ping].size(), initial_filled_ratio_, model, 
-                                    pivot_list[ping].begin(), pivot_list[ping].end());
-#ifdef BUCKINDEX_DEBUG
-                level_stats_[num_levels_] = 1;
-#endif
-
-                num_levels_++;
-            } else if (pivot_list[ping].size() == 1){
-                // GC_segs.push_back((uintptr_t)root_);
-                // TODO: original root is not deleted
-                root_ = (void*)(SegmentType*)pivot_list[ping][0].value_;
-            }
-#ifdef BUCKINDEX_DEBUG
-            num_data_buckets_++;
-            level_stats_[0]++;
-#endif
-
-            // GC
-            delete d_bucket;
-            for (auto seg_ptr : GC_segs) { // TODO: support MRSW
-                SegmentType* seg = (SegmentType*)seg_ptr;
-                delete seg;
+                parent = segment;
             }
-#ifdef BUCKINDEX_DEBUG
-            insert_stats_.num_of_SMO++;
-#endif
-
+            if (num_children != nodes.size()) throw std::runtime_error("load: corrupt level in snapshot " + path);
+            nodes.swap(parents);
         }
+        if (file.remaining() != 0) throw std::runtime_error("load: trailing bytes in snapshot " + path);
 
-#ifdef BUCKINDEX_DEBUG
-        auto end_time = tn.rdtsc();
-        insert_stats_.time_insert_in_leaf += (tn.tsc2ns(insert_finish_time) - tn.tsc2ns(start_time))/(double) 1000000000;
-        insert_stats_.time_SMO += (tn.tsc2ns(end_time) - tn.tsc2ns(insert_finish_time))/(double) 1000000000;
-        insert_stats_.num_of_insert++;
-        num_keys_++;
-#endif
-        return success;
+        // concurrent lookups wait until the new tree is in place
+        root_version_.lock();
+        {
+            typename VersionLock<uint64_t>::WriteGuard root_guard(root_version_);
+            root_ = nodes.empty() ? nullptr : nodes[0];
+            num_levels_ = header.num_levels;
+            num_keys_ = header.num_keys;
+            initial_filled_ratio_ = header.initial_filled_ratio;
+            error_bound_ = header.error_bound;
+            if constexpr (StatsPolicy::enabled) {
+                num_data_buckets_ = num_levels_ ? header.level_sizes[0] : 0;
+                for (uint64_t l = 0; l < num_levels_; l++) level_stats_[l] = header.level_sizes[l];
+            }
+        }
+        root_version_.unlock();
+        num_compressed_buckets_ = 0;
+        if (tier_file_) reset_clock(nodes.empty() ? std::vector<void*>() : collect_levels().back());
     }
 
     /**
-     * Bulk load the user key value onto the learned index
-     * @param kvs: list of user key value to be loaded onto the learned index
+     * Write the index in the frozen format (see frozen_format.h), to be memory-mapped by MappedBuckIndex
+     * e.g., for read-only replicas that serve lookups at once, sharing the page cache
+     * NOTE: no insert may run concurrently
+     * @param path: the frozen index file; overwritten
+     * @throw std::runtime_error if the file cannot be written
      */
-    void bulk_load(vector<KeyValueType> &kvs) { // TODO: change to model-based insertion for d-buckets
-        vector<KeyValuePtrType> kvptr_array[2];
-        uint64_t ping = 0, pong = 1;
-        num_levels_ = 0;
-        run_data_layer_segmentation(kvs,
-                                    kvptr_array[ping]);
-        #ifdef BUCKINDEX_DEBUG
-            num_keys_ = kvs.size();
-            num_data_buckets_ = kvptr_array[ping].size();
-            level_stats_[num_levels_] = num_data_buckets_;
-        #endif
-        num_levels_++;
+    void freeze(const std::string &path) {
+        SnapshotFile file(path, "wb");
+        std::vector<std::vector<void*>> levels = collect_levels();
+
+        FrozenHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, FROZEN_MAGIC, sizeof(header.magic));
+        header.version = FROZEN_VERSION;
+        header.byte_order = FROZEN_BYTE_ORDER;
+        header.key_size = sizeof(KeyType);
+        header.value_size = sizeof(ValueType);
+        header.segment_bucket_size = SEGMENT_BUCKET_SIZE;
+        header.data_bucket_size = DATA_BUCKET_SIZE;
+        header.segment_bucket_bytes = sizeof(SegBucketType);
+        header.data_bucket_bytes = sizeof(DataBucketType);
+        header.num_keys = num_keys_;
+        header.num_levels = levels.size();
+        header.num_data_buckets = levels.empty() ? 0 : levels.back().size();
+        header.data_offset = frozen_align(sizeof(FrozenHeader));
+
+        // the offsets of the nodes of each level, bottom-up
+        std::vector<std::vector<uint64_t>> offsets(levels.size());
+        uint64_t end = header.data_offset;
+        for (size_t l = levels.size(); l-- > 0; ) {
+            for (void *node : levels[l]) {
+                offsets[l].push_back(end);
+                if (l + 1 == levels.size()) {
+                    end += sizeof(DataBucketType); // the D-Buckets are packed
+                } else {
+                    end = frozen_align(end + sizeof(FrozenSegment<KeyType>) +
+                                       ((SegmentType *)node)->num_bucket_ * (sizeof(SegBucketType) + sizeof(KeyType)));
+                }
+            }
+            end = frozen_align(end);
+        }
+        header.root_offset = levels.empty() ? 0 : offsets[0][0];
+        header.file_size = end;
+
+        uint64_t written = 0;
+        auto write = [&file, &written](const void *data, size_t bytes) {
+            file.write(data, bytes);
+            written += bytes;
+        };
+        auto pad = [&write, &written](uint64_t offset) {
+            static const char zeros[FROZEN_ALIGNMENT] = {0};
+            assert(offset >= written && offset - written <= FROZEN_ALIGNMENT);
+            write(zeros, offset - written);
+        };
+        write(&header, sizeof(header));
+        for (size_t l = levels.size(); l-- > 0; ) {
+            size_t child = 0;
+            for (size_t i = 0; i < levels[l].size(); i++) {
+                pad(offsets[l][i]);
+                if (l + 1 == levels.size()) {
+                    DataBucketType image;
+                    DataBucketType d_bucket(*peek_d_bucket(levels[l][i], image)); // a copy has its lock reset
+                    write(&d_bucket, sizeof(d_bucket));
+                    continue;
+                }
+                SegmentType *segment = (SegmentType *)levels[l][i];
+                FrozenSegment<KeyType> record;
+                record.model = segment->get_model();
+                record.num_bucket = segment->num_bucket_;
+                record.max_error = segment->get_max_error();
+                write(&record, sizeof(record));
+                for (int b = 0; b < segment->num_bucket_; b++) {
+                    SegBucketType s_bucket(*segment->get_bucket(b));
+                    int slots[SEGMENT_BUCKET_SIZE];
+                    int num_slots = sorted_slots(s_bucket, slots);
+                    for (int k = 0; k < num_slots; k++) s_bucket.set_value(slots[k], offsets[l + 1][child++]);
+                    write(&s_bucket, sizeof(s_bucket));
+                }
+                write(segment->get_pivots(), segment->num_bucket_ * sizeof(KeyType));
+            }
+        }
+        pad(header.file_size);
+        file.close();
+    }
 
-        assert(kvptr_array[ping].size() > 0);
+    /**
+     * Tiered storage: keep at most max_resident_buckets D-Buckets in memory, and spill the cold ones to a local
+     * file; the segments stay resident. A spilled D-Bucket is replaced in its leaf segment by its slot in the file,
+     * tagged in the lowest bit of the child (the nodes are aligned), and faulted back in by the first operation
+     * that reaches it, with one read. Each D-Bucket counts its accesses; the operations that find the index over
+     * budget run a CLOCK sweep over the resident D-Buckets, which spills those not accessed since the hand last
+     * passed them (see evict())
+     * The readers share this work with the writers, so lookup() and the scans lock and modify the tree too
+     * NOTE: call before the concurrent operations start. A later bulk load or load() keeps the budget, but the
+     *       slots of the D-Buckets it replaces stay in the file
+     * @param path: the file of the spilled D-Buckets; overwritten, and removed with the index
+     * @param max_resident_buckets: the budget of resident D-Buckets
+     * @throw std::invalid_argument if max_resident_buckets is 0
+     * @throw std::runtime_error if tiering is already enabled, or the file cannot be created
+     */
+    void enable_tiering(const std::string &path, size_t max_resident_buckets) {
+        if (max_resident_buckets == 0) throw std::invalid_argument("enable_tiering: the budget must be positive");
+        if (tier_file_) throw std::runtime_error("enable_tiering: already enabled");
+        tier_file_.reset(new TierFile(path, sizeof(DataBucketType)));
+        max_resident_buckets_ = max_resident_buckets;
+        track_access_ = true;
+        std::vector<std::vector<void*>> levels = collect_levels();
+        reset_clock(levels.empty() ? std::vector<void*>() : levels.back());
+        maybe_evict();
+    }
 
-        do { // at least one model layer
-            run_model_layer_segmentation(kvptr_array[ping],
-                                            kvptr_array[pong]);
-            ping = (ping +1) % 2;
-            pong = (pong +1) % 2;
-            kvptr_array[pong].clear();
-            #ifdef BUCKINDEX_DEBUG
-                level_stats_[num_levels_] = kvptr_array[ping].size();
-            #endif
-            num_levels_++;
-        } while (kvptr_array[ping].size() > 1);
-        
-        // Build the root
-        KeyValuePtrType& kv_ptr = kvptr_array[ping][0];
-        root_ = (void *)kv_ptr.value_;
-        dump();
+    /**
+     * Compress the cold D-Buckets into a read-only form (see CompressedBucket), e.g., the large static ranges
+     * Each call halves the access counts of the D-Buckets (see Bucket::age()), and compresses those whose count
+     * is already 0: the first call compresses every D-Bucket, then the accesses are counted, so a D-Bucket is
+     * compressed again once it is not accessed between two calls.
+     * A lookup searches a compressed D-Bucket in place, a scan reads a decompressed copy, and the first write
+     * decompresses it back to the slotted layout, in place. A D-Bucket that would not get smaller is left as is
+     * Safe against concurrent operations (see enter_epoch()), one call at a time
+     * NOTE: needs integer keys and values
+     * @return the number of D-Buckets compressed
+     */
+    size_t compress_cold() {
+        track_access_ = true;
+        EpochGuard guard = epoch_.enter();
+        size_t num_compressed = 0;
+        // the D-Buckets in key order, from the smallest pivot
+        bool first = true;
+        KeyType pivot = std::numeric_limits<KeyType>::min();
+        while (true) {
+            // read the root and the number of levels as a pair
+            uint64_t root_version = root_version_.read_begin();
+            void *root = root_;
+            uint64_t num_levels = num_levels_;
+            if (!root_version_.read_validate(root_version)) continue;
+            if (!root) break;
+            if (first) {
+                SegmentType *root_segment = (SegmentType *)root;
+                uint32_t version;
+                do {
+                    version = root_segment->read_begin();
+                    pivot = (*root_segment->cbegin()).key_;
+                } while (!root_segment->read_validate(version));
+                first = false;
+            }
 
+            std::vector<KeyValuePtrType> path(num_levels);
+            KeyType next_pivot;
+            lookup_path(pivot, root, path, next_pivot, nullptr, Access::NONE);
+            uintptr_t child = path.back().value_;
+            if (!(child & CHILD_TAGS) && ((DataBucketType *)child)->age() == 0) num_compressed += compress(path);
+            if (next_pivot == std::numeric_limits<KeyType>::max()) break;
+            pivot = next_pivot;
+        }
+        return num_compressed;
     }
     
     /**
@@ -538,13 +931,15 @@ public:
     void dump() {
         std::cout << "Index Structure" << std::endl;
         std::cout << "  Number of Layers: " << num_levels_ << std::endl;
-#ifdef BUCKINDEX_DEBUG
-        for (auto i = 0; i < num_levels_; i++) {
-            std::cout << "    Layer " << i << " size: " << level_stats_[i] << std::endl;
+        std::cout << "  Arena reserved bytes: " << arena_.reserved_bytes() << std::endl;
+        if constexpr (StatsPolicy::enabled) {
+            for (auto i = 0; i < num_levels_; i++) {
+                std::cout << "    Layer " << i << " size: " << level_stats_[i] << std::endl;
+            }
         }
-#endif
 
         dump_fanout();
+        if constexpr (HintPolicy::adaptive) dump_hint_stats();
 
         // print all element from DataBucketType::hint_dist_count using iterator
         // std::cout << "  Hint Distribution Count (distance = actual - predict): " << std::endl;
@@ -602,9 +997,61 @@ public:
         }
     }
 
+    /**
+     * Helper function to count the D-Buckets of each hint type
+     * @param num_model: the number of D-Buckets using model-based hints
+     * @param num_hash: the number of D-Buckets using hash-based hints
+     * @param avg_probe: the average probe distance of all keys in the D-Buckets
+     */
+    void get_hint_stats(size_t &num_model, size_t &num_hash, double &avg_probe) const {
+        num_model = 0;
+        num_hash = 0;
+        double probe_sum = 0;
+        size_t num_keys = 0;
+        if (!root_) {
+            avg_probe = 0;
+            return;
+        }
+
+        // Traverse the tree to visit each d-bucket
+        std::queue<std::pair<void *, int>> q; // <segment, level> pairs
+        q.push(std::make_pair(root_, 0));
+        while (!q.empty()) {
+            auto cur = q.front();
+            q.pop();
+
+            if (cur.second < num_levels_ - 1) {
+                SegmentType *segment = (SegmentType *)cur.first;
+                for (auto it = segment->cbegin(); it != segment->cend(); it++) {
+                    q.push(std::make_pair((void *)it->value_, cur.second + 1));
+                }
+            } else { //cur is a d-bucket
+                DataBucketType image;
+                const DataBucketType *d_bucket = peek_d_bucket(cur.first, image);
+                if (d_bucket->get_hint_type() == HINT_TYPE_HASH) num_hash++;
+                else num_model++;
+                probe_sum += d_bucket->avg_probe_distance() * d_bucket->num_keys();
+                num_keys += d_bucket->num_keys();
+            }
+        }
+        avg_probe = num_keys ? probe_sum / num_keys : 0;
+    }
+
+    /**
+     * Helper function to dump the mix of D-Bucket hint types
+     */
+    void dump_hint_stats() const {
+        size_t num_model, num_hash;
+        double avg_probe;
+        get_hint_stats(num_model, num_hash, avg_probe);
+        std::cout << "Hint Statistics:" << std::endl;
+        std::cout << "  model-based d-buckets: " << num_model << ", hash-based d-buckets: " << num_hash << std::endl;
+        std::cout << "  average probe distance: " << avg_probe << std::endl;
+    }
 
     /**
      * Helper function to get the memory size of the index
+     * The D-Buckets spilled by tiered storage are not counted
      *
      * @return the memory size of the index
      */
@@ -627,17 +1074,21 @@ public:
                     q.push(std::make_pair((void *)it->value_, cur.second + 1));
                 }
             }
-            else{ //cur is a d-bucket
+            else if (is_compressed((uintptr_t)cur.first)) {
+                const CompressedBucketType *compressed = to_compressed((uintptr_t)cur.first);
+                mem_size += compressed->mem_size();
+                d_bucket_size += compressed->mem_size();
+            }
+            else if (!is_spilled((uintptr_t)cur.first)) { //cur is a resident d-bucket
                 DataBucketType *d_bucket = (DataBucketType *)cur.first;
                 mem_size += d_bucket->mem_size();
                 d_bucket_size += d_bucket->mem_size();
             }
         }
 
-        typedef BuckIndex<KeyType, ValueType, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE> self_type;
-        std::cout << "Total memory size: " << mem_size + sizeof(self_type) << std::endl;
+        std::cout << "Total memory size: " << mem_size + sizeof(*this) << std::endl;
         std::cout << "Total data bucket size: " << d_bucket_size << std::endl;
-        return mem_size + sizeof(self_type);
+        return mem_size + sizeof(*this);
     }
 
 
@@ -656,11 +1107,8 @@ public:
      * @return the number of data buckets in the index
      */
     uint64_t get_num_data_buckets() {
-#ifdef BUCKINDEX_DEBUG
-        return num_data_buckets_;
-#else
+        if constexpr (StatsPolicy::enabled) return num_data_buckets_;
         return 0;
-#endif
     }
 
     /**
@@ -671,6 +1119,33 @@ public:
     uint64_t get_num_keys() {
         return num_keys_;
     }
+
+    /**
+     * Helper function to get the number of D-Buckets in memory, with tiered storage (see enable_tiering())
+     *
+     * @return the number of resident D-Buckets; 0 without tiered storage
+     */
+    uint64_t get_num_resident_buckets() const {
+        return num_resident_buckets_;
+    }
+
+    /**
+     * Helper function to get the number of D-Buckets in the tier file, with tiered storage (see enable_tiering())
+     *
+     * @return the number of spilled D-Buckets
+     */
+    uint64_t get_num_spilled_buckets() const {
+        return num_spilled_buckets_;
+    }
+
+    /**
+     * Helper function to get the number of D-Buckets in the compressed form (see compress_cold())
+     *
+     * @return the number of compressed D-Buckets
+     */
+    uint64_t get_num_compressed_buckets() const {
+        return num_compressed_buckets_;
+    }
     
     /**
      * Helper function to get the stat of level in the index
@@ -678,76 +1153,617 @@ public:
      * @return the number of keys in the index
      */
     uint64_t get_level_stat(int level) {
-#ifdef BUCKINDEX_DEBUG
-        if(level >= num_levels_ || level < 0){
-            return 0;
+        if constexpr (StatsPolicy::enabled) {
+            if(level >= num_levels_ || level < 0){
+                return 0;
+            }
+            return level_stats_[level];
         }
-        return level_stats_[level];
-#else
         return 0;
-#endif
     }
 
     /**
      * Helper function to dump the look up statistics
      */
     void print_lookup_stat(){
-#ifdef BUCKINDEX_DEBUG
-        cout<<"-----lookup stat-----"<<endl;
-        cout<<"num lookups: "<<lookup_stats_.num_of_lookup<<endl;
-        cout<<"avg time lookup: "<<lookup_stats_.time_lookup/lookup_stats_.num_of_lookup<<endl;
-        cout<<"avg time traverse to leaf: "<<lookup_stats_.time_traverse_to_leaf/lookup_stats_.num_of_lookup<<endl;
-        cout<<"avg time lookup in leaf: "<<lookup_stats_.time_lookup_in_leaf/lookup_stats_.num_of_lookup<<endl;
-
-        cout<<"-----insert stat-----"<<endl;
-        cout<<"num inserts: "<<insert_stats_.num_of_insert<<endl;
-        cout<<"avg time insert: "<<insert_stats_.time_insert_in_leaf/insert_stats_.num_of_insert<<endl;
-        cout<<"avg time SMO: "<<insert_stats_.time_SMO/insert_stats_.num_of_SMO<<endl;
-        cout<<"num SMO: "<<insert_stats_.num_of_SMO<<endl;
-
-        cout<<"-----segment stat-----"<<endl;
-        std::cout<<"Num of fail_predict: "<< SegmentType::fail_predict<<std::endl;
-        std::cout<<"avg fail distance: "<< (double)SegmentType::fail_distance/SegmentType::fail_predict<<std::endl;
-        std::cout<<"Num of success_predict: "<< SegmentType::success_predict<<std::endl;
-        std::cout<<"Num of locate: "<< SegmentType::num_locate<<std::endl;
-
-        // std::cout<<"Num of fail_predict: "<< SegmentType::fail_predict_bulk<<std::endl;
-        // std::cout<<"avg fail distance: "<< (double)SegmentType::fail_distance/SegmentType::fail_predict_bulk<<std::endl;
-        // std::cout<<"Num of success_predict: "<< SegmentType::success_predict_bulk<<std::endl;
-\
-
-#endif
+        if constexpr (StatsPolicy::enabled) {
+            cout<<"-----lookup stat-----"<<endl;
+            cout<<"num lookups: "<<lookup_stats_.num_of_lookup<<endl;
+            cout<<"avg time lookup: "<<lookup_stats_.time_lookup/lookup_stats_.num_of_lookup<<endl;
+            cout<<"avg time traverse to leaf: "<<lookup_stats_.time_traverse_to_leaf/lookup_stats_.num_of_lookup<<endl;
+            cout<<"avg time lookup in leaf: "<<lookup_stats_.time_lookup_in_leaf/lookup_stats_.num_of_lookup<<endl;
+
+            cout<<"-----insert stat-----"<<endl;
+            cout<<"num inserts: "<<insert_stats_.num_of_insert<<endl;
+            cout<<"avg time insert: "<<insert_stats_.time_insert_in_leaf/insert_stats_.num_of_insert<<endl;
+            cout<<"avg time SMO: "<<insert_stats_.time_SMO/insert_stats_.num_of_SMO<<endl;
+            cout<<"num SMO: "<<insert_stats_.num_of_SMO<<endl;
+
+            cout<<"-----segment stat-----"<<endl;
+            std::cout<<"Num of fail_predict: "<< SegmentType::fail_predict<<std::endl;
+            std::cout<<"avg fail distance: "<< (double)SegmentType::fail_distance/SegmentType::fail_predict<<std::endl;
+            std::cout<<"Num of success_predict: "<< SegmentType::success_predict<<std::endl;
+            std::cout<<"Num of locate: "<< SegmentType::num_locate<<std::endl;
+
+            // std::cout<<"Num of fail_predict: "<< SegmentType::fail_predict_bulk<<std::endl;
+            // std::cout<<"avg fail distance: "<< (double)SegmentType::fail_distance/SegmentType::fail_predict_bulk<<std::endl;
+            // std::cout<<"Num of success_predict: "<< SegmentType::success_predict_bulk<<std::endl;
+        }
     }
 private:
 
+    // how an operation uses the D-Bucket it reaches, if it is spilled or compressed (see resolve_d_bucket())
+    enum class Access {
+        NONE, // as is
+        READ, // faulted in if spilled; a decompressed copy if compressed
+        WRITE // faulted in if spilled; decompressed in place if compressed
+    };
+
     /**
      * Lookup function, traverse the index to the leaf D-Bucket, and record the path
      * @param key: lookup key
      * @param path: the path from root to the leaf D-Bucket
-     * @param model: the endpoint model used to predict the position of the key in the leaf D-Bucket
+     * @param next_pivot: the pivot of the D-Bucket after the leaf D-Bucket, i.e., the end of its key range
+    */
+    bool lookup_path(KeyType key, std::vector<KeyValuePtrType> &path, KeyType &next_pivot) {
+        return lookup_path(key, root_, path, next_pivot, nullptr, Access::READ);
+    }
+
+    /**
+     * Lookup function, traverse the index from root to the leaf D-Bucket, and record the path
+     * Each segment is read optimistically, i.e., re-read if a concurrent writer modified it meanwhile
+     * @param key: lookup key
+     * @param root: the root segment
+     * @param path: the path from root to the leaf D-Bucket; its size is the number of levels
+     * @param next_pivot: the pivot of the D-Bucket after the leaf D-Bucket, i.e., the end of its key range
+     * @param seg_versions: if not nullptr, the versions of the segments on the path (path.size()-1 entries)
+     * @param access: how the caller uses the leaf D-Bucket, if it is spilled or compressed (see
+     *        resolve_d_bucket()); with Access::NONE, path ends with the child as read
     */
-    bool lookup_path(KeyType key, std::vector<KeyValuePtrType> &path, LinearModel<KeyType> &model) {
+    bool lookup_path(KeyType key, void *root, std::vector<KeyValuePtrType> &path, KeyType &next_pivot,
+                     uint32_t *seg_versions, Access access = Access::WRITE) {
         // traverse the index to the leaf D-Bucket, and record the path
         bool success = true;
-        path[0] = KeyValuePtrType(std::numeric_limits<KeyType>::min(), (uintptr_t)root_);
-        KeyValuePtrType kvptr_next; // TODO: change to the next key
-        for (int i = 1; i < num_levels_; i++) {
+        path[0] = KeyValuePtrType(std::numeric_limits<KeyType>::min(), (uintptr_t)root);
+        KeyValuePtrType kvptr_next(std::numeric_limits<KeyType>::max(), 0);
+        for (int i = 1; i < path.size(); i++) {
             SegmentType* segment = (SegmentType*)path[i-1].value_;
-            success &= segment->lb_lookup(key, path[i], kvptr_next);
+            KeyValuePtrType kvptr_next_seg;
+            bool found;
+            uint32_t version;
+            do {
+                version = segment->read_begin();
+                kvptr_next_seg = kvptr_next;
+                found = segment->lb_lookup(key, path[i], kvptr_next_seg);
+                // the range of path[i] ends at its successor in the S-Bucket, or else at the next S-Bucket
+                if (kvptr_next_seg.key_ == std::numeric_limits<KeyType>::max()) {
+                    kvptr_next_seg.key_ = segment->next_pivot(key);
+                }
+            } while (!segment->read_validate(version));
+            success &= found;
+            // and never beyond the end of the range of the segment itself
+            if (kvptr_next_seg.key_ < kvptr_next.key_) kvptr_next = kvptr_next_seg;
+            if (seg_versions) seg_versions[i-1] = version;
             assert((void *)path[i].value_ != nullptr);
         }
-#ifdef HINT_MODEL_PREDICT
-        KeyType start_key = path[num_levels_-1].key_;
-        KeyType end_key = kvptr_next.key_;
-        assert(end_key > start_key);
-        double slope = (long double)DATA_BUCKET_SIZE / (long double)(end_key - start_key);
-        double offset = -slope * start_key;
-        model = LinearModel<KeyType>(slope, offset);
-#endif
+        next_pivot = kvptr_next.key_;
         assert(success);
+        if (access != Access::NONE) resolve_d_bucket((SegmentType*)path[path.size()-2].value_, path.back(), access);
         return success;
     }
 
+    /**
+     * Helper function for insert() to split a full D-Bucket, and propagate the new pivots to the parent segments
+     * Optimistic lock coupling: a segment is locked before it is updated, and its parent (or the root) before it
+     * is rebuilt, so the locks are taken bottom-up and only as far as the update propagates.
+     * Each lock upgrades the optimistic read of the node recorded on the way down, and fails if the node
+     * changed since; the writer then undoes its work and restarts, so writers never wait for each other here.
+     * The replaced nodes are marked obsolete and retired.
+     * @param kv: the key-value pair to be inserted
+     * @param d_bucket: the full D-Bucket, locked by the caller; unlocked if the split succeeds
+     * @param path: the path from root to d_bucket
+     * @param seg_versions: the versions of the segments on the path, as read on the way down
+     * @param root_version: the version of the root, as read before the traversal
+     * @return true if kv is inserted; false if a node on the path changed, in which case nothing is modified
+     */
+    bool split_and_propagate(const KeyValueType &kv, DataBucketType *d_bucket, std::vector<KeyValuePtrType> &path,
+                             std::vector<uint32_t> &seg_versions, uint64_t root_version) {
+        const int num_levels = path.size();
+        assert(num_levels >= 2); // insert into leaf segment
+        int cur_level = num_levels - 2; // leaf_segment level
+
+        SegmentType *leaf_segment = (SegmentType*)(path[cur_level].value_);
+        if (!leaf_segment->try_lock(seg_versions[cur_level])) return false;
+        std::vector<SegmentType*> locked_segs; // bottom-up
+        locked_segs.push_back(leaf_segment);
+        std::vector<SegmentType*> new_segs; // not reachable from the index until the updates below succeed
+        std::vector<uintptr_t> GC_segs;
+
+        std::vector<KeyValuePtrType> pivot_list[2]; // ping-pong list
+        int ping = 0, pong = 1;
+
+        // split d_bucket
+        auto new_d_buckets = d_bucket->split_and_insert(kv, &arena_);
+        pivot_list[ping].push_back(new_d_buckets.first);
+        pivot_list[ping].push_back(new_d_buckets.second);
+        KeyValuePtrType old_pivot = path[num_levels-1];
+
+        // the new nodes were never visible, so they are freed right away
+        auto abort = [&]() {
+            arena_.destroy((DataBucketType*)new_d_buckets.first.value_);
+            arena_.destroy((DataBucketType*)new_d_buckets.second.value_);
+            for (auto seg : new_segs) SegmentType::destroy(arena_, seg);
+            for (auto seg : locked_segs) seg->unlock();
+            return false;
+        };
+
+        // propagate the insertion to the parent segments
+        bool root_locked = false;
+        while(cur_level >= 0) {
+            SegmentType* cur_segment = (SegmentType*)(path[cur_level].value_);
+
+            bool is_segment = true;
+            if (cur_level == num_levels - 2) is_segment = false;
+            if (cur_segment->batch_update(old_pivot, pivot_list[ping], is_segment)) {
+                pivot_list[ping].clear();
+                break;
+            }
+
+            // cur_segment is rebuilt, and replaced in its parent
+            if (cur_level > 0) {
+                SegmentType *parent = (SegmentType*)(path[cur_level-1].value_);
+                if (!parent->try_lock(seg_versions[cur_level-1])) return abort();
+                locked_segs.push_back(parent);
+            } else {
+                if (!root_version_.try_lock(root_version)) return abort();
+                root_locked = true;
+            }
+
+            pivot_list[pong].clear();
+            bool success = cur_segment->segment_and_batch_update(initial_filled_ratio_, pivot_list[ping], pivot_list[pong], &arena_);
+            assert(success);
+            for (auto &kv_ptr : pivot_list[pong]) new_segs.push_back((SegmentType*)kv_ptr.value_);
+            if constexpr (StatsPolicy::enabled) {
+                level_stats_[num_levels - 1 - cur_level] += (pivot_list[pong].size()-1);
+            }
+            old_pivot = path[cur_level];
+
+            GC_segs.push_back((uintptr_t)cur_segment);
+            cur_level--;
+            ping = 1 - ping;
+            pong = 1 - pong;
+        }
+
+        // add one more level
+        assert(pivot_list[ping].size() == 0 || cur_level == -1);
+
+        // what if there is only one node
+        if (pivot_list[ping].size() > 1) {
+            std::vector<KeyType> keys;
+            for (auto kv_ptr : pivot_list[ping]) {
+                keys.push_back(kv_ptr.key_);
+            }
+            LinearModel<KeyType> model = ModelPolicy::build(keys);
+            SegmentType *new_root = SegmentType::create(arena_, pivot_list[ping].size(), initial_filled_ratio_, model,
+                                                        pivot_list[ping].begin(), pivot_list[ping].end());
+            if constexpr (StatsPolicy::enabled) level_stats_[num_levels] = 1;
+
+            typename VersionLock<uint64_t>::WriteGuard root_guard(root_version_);
+            root_ = new_root;
+            num_levels_++;
+        } else if (pivot_list[ping].size() == 1){
+            // the old root was rebuilt into one segment, and is already in GC_segs
+            typename VersionLock<uint64_t>::WriteGuard root_guard(root_version_);
+            root_ = (void*)(SegmentType*)pivot_list[ping][0].value_;
+        }
+        if (root_locked) root_version_.unlock();
+        if constexpr (StatsPolicy::enabled) {
+            num_data_buckets_++;
+            level_stats_[0]++;
+        }
+        if (tier_file_) {
+            num_resident_buckets_++;
+            push_clock(new_d_buckets.second.key_);
+        }
+
+        // the replaced nodes can not be locked anymore; writers waiting for them restart from the root
+        d_bucket->mark_obsolete();
+        d_bucket->unlock();
+        for (auto seg_ptr : GC_segs) ((SegmentType*)seg_ptr)->mark_obsolete();
+        for (auto seg : locked_segs) seg->unlock();
+
+        // GC: the replaced nodes (including the old root, if it was rebuilt) go back to the arena
+        // once no reader can see them
+        epoch_.retire(d_bucket, [this](void *p) { arena_.destroy((DataBucketType*)p); });
+        for (auto seg_ptr : GC_segs) {
+            epoch_.retire((void*)seg_ptr, [this](void *p) { SegmentType::destroy(arena_, (SegmentType*)p); });
+        }
+        if constexpr (StatsPolicy::enabled) insert_stats_.num_of_SMO++;
+        return true;
+    }
+
+    // a child of a leaf segment spilled to the tier file: its slot, tagged in the lowest bit
+    static bool is_spilled(uintptr_t child) { return child & SPILLED_TAG; }
+    static uint64_t spilled_slot(uintptr_t child) { return child >> 1; }
+    static uintptr_t spilled_child(uint64_t slot) { return (uintptr_t(slot) << 1) | SPILLED_TAG; }
+
+    // a child of a leaf segment in the compressed form (see compress_cold()): the pointer, tagged in the second bit
+    static bool is_compressed(uintptr_t child) { return (child & CHILD_TAGS) == COMPRESSED_TAG; }
+    static CompressedBucketType* to_compressed(uintptr_t child) { return (CompressedBucketType *)(child & ~CHILD_TAGS); }
+    static uintptr_t compressed_child(CompressedBucketType *compressed) { return (uintptr_t)compressed | COMPRESSED_TAG; }
+
+    /**
+     * Helper function to get the D-Bucket of an entry of a leaf segment, and update entry
+     * A spilled D-Bucket is faulted in. A compressed one is decompressed: in place for a write, else into a private
+     * copy (see swap_in()), so that reading does not undo the compression. The D-Bucket counts the access
+     * @param leaf: the leaf segment
+     * @param entry: the entry read from leaf
+     * @param access: Access::READ or Access::WRITE
+     * @return the D-Bucket
+     */
+    DataBucketType* resolve_d_bucket(SegmentType *leaf, KeyValuePtrType &entry, Access access) {
+        if (is_spilled(entry.value_)) {
+            DataBucketType image;
+            tier_file_->read(spilled_slot(entry.value_), &image);
+            entry.value_ = (uintptr_t)swap_in(leaf, entry, arena_.create<DataBucketType>(image), true); // resets the lock
+        } else if (is_compressed(entry.value_)) {
+            DataBucketType *d_bucket = arena_.create<DataBucketType>();
+            to_compressed(entry.value_)->decompress(*d_bucket);
+            entry.value_ = (uintptr_t)swap_in(leaf, entry, d_bucket, access == Access::WRITE);
+        }
+        DataBucketType *d_bucket = (DataBucketType *)entry.value_;
+        if (track_access_.load(std::memory_order_relaxed)) d_bucket->touch();
+        return d_bucket;
+    }
+
+    /**
+     * Helper function for resolve_d_bucket() to swap a D-Bucket read from a spilled or compressed child into its
+     * leaf segment; the child is freed once no reader can still read it.
+     * If the entry changed meanwhile (e.g., another thread faulted it in, or the leaf was rebuilt), or install is
+     * false, the D-Bucket is a private copy as of the time the entry was read: it is obsolete, so a writer retries
+     * from the root, and it is retired, so it lives as long as the epoch of the reader
+     * @param leaf: the leaf segment
+     * @param entry: the spilled or compressed entry read from leaf
+     * @param d_bucket: the D-Bucket read from the child of entry
+     * @param install: whether to swap it in
+     * @return d_bucket
+     */
+    DataBucketType* swap_in(SegmentType *leaf, const KeyValuePtrType &entry, DataBucketType *d_bucket, bool install) {
+        bool installed = false;
+        if (install && leaf->lock()) {
+            installed = leaf->replace_child(entry.key_, entry.value_, (uintptr_t)d_bucket) == entry.value_;
+            leaf->unlock();
+        }
+        if (!installed) {
+            d_bucket->mark_obsolete();
+            epoch_.retire(d_bucket, [this](void *p) { arena_.destroy((DataBucketType*)p); });
+            return d_bucket;
+        }
+        if (tier_file_) {
+            num_resident_buckets_++;
+            push_clock(entry.key_);
+        }
+        // a reader that read the entry before the swap may still read the child
+        if (is_spilled(entry.value_)) {
+            num_spilled_buckets_--;
+            epoch_.retire((void *)entry.value_, [this](void *p) { tier_file_->free(spilled_slot((uintptr_t)p)); });
+        } else {
+            num_compressed_buckets_--;
+            epoch_.retire(to_compressed(entry.value_), [this](void *p) {
+                CompressedBucketType::destroy(arena_, (CompressedBucketType*)p);
+            });
+        }
+        return d_bucket;
+    }
+
+    /**
+     * Helper function to read a D-Bucket of the tree without faulting it in or decompressing it in place
+     * @param node: a D-Bucket of collect_levels()
+     * @param image: where a spilled or compressed D-Bucket is read
+     * @return the D-Bucket, or image
+     */
+    const DataBucketType* peek_d_bucket(void *node, DataBucketType &image) const {
+        if (is_spilled((uintptr_t)node)) {
+            tier_file_->read(spilled_slot((uintptr_t)node), &image);
+            return &image;
+        }
+        if (is_compressed((uintptr_t)node)) {
+            image = DataBucketType();
+            to_compressed((uintptr_t)node)->decompress(image);
+            return &image;
+        }
+        return (const DataBucketType *)node;
+    }
+
+    /**
+     * Helper function for compress_cold() to replace a D-Bucket by its compressed form in its leaf segment
+     * The D-Bucket is locked meanwhile, so no insert is lost; then it is obsolete, and retired
+     * @param path: the path from root to the D-Bucket
+     * @return true if the D-Bucket is compressed; false if it, or its leaf segment, changed meanwhile, or it
+     *         does not get smaller
+     */
+    bool compress(const std::vector<KeyValuePtrType> &path) {
+        SegmentType *leaf = (SegmentType *)path[path.size()-2].value_;
+        DataBucketType *d_bucket = (DataBucketType *)path.back().value_;
+        if (!d_bucket->lock()) return false; // split meanwhile
+
+        std::vector<KeyValueType> kvs;
+        d_bucket->get_valid_kvs(kvs);
+        std::sort(kvs.begin(), kvs.end());
+        CompressedBucketType *compressed = CompressedBucketType::create(arena_, kvs, d_bucket->get_pivot(),
+                                                                        d_bucket->get_hint_end());
+        bool replaced = false;
+        if (compressed->mem_size() < d_bucket->mem_size() && leaf->lock()) {
+            replaced = leaf->replace_child(path.back().key_, (uintptr_t)d_bucket, compressed_child(compressed)) ==
+                       (uintptr_t)d_bucket;
+            leaf->unlock();
+        }
+        if (!replaced) {
+            CompressedBucketType::destroy(arena_, compressed); // never visible
+            d_bucket->unlock();
+            return false;
+        }
+        num_compressed_buckets_++;
+        if (tier_file_) num_resident_buckets_--;
+        // writers waiting for the D-Bucket restart from the root, and decompress it
+        d_bucket->mark_obsolete();
+        d_bucket->unlock();
+        epoch_.retire(d_bucket, [this](void *p) { arena_.destroy((DataBucketType*)p); });
+        return true;
+    }
+
+    /**
+     * Helper function for the operations to spill D-Buckets if the index is over the budget of tiered storage
+     */
+    void maybe_evict() {
+        if (tier_file_ && num_resident_buckets_ > max_resident_buckets_) evict();
+    }
+
+    /**
+     * Helper function for tiered storage to spill D-Buckets until at most max_resident_buckets_ are resident
+     * CLOCK: the resident D-Buckets are in a ring, by pivot (see push_clock()); the hand takes the next one and
+     * halves its access count (see Bucket::age()). A D-Bucket whose count is already 0 is spilled and leaves the
+     * ring, the others go back. The sweep gives up after the steps that age every D-Bucket to 0, if the D-Buckets
+     * keep being accessed meanwhile
+     * One thread evicts at a time; the others do not wait for it
+     */
+    void evict() {
+        std::unique_lock<std::mutex> evict_lock(evict_mutex_, std::try_to_lock);
+        if (!evict_lock.owns_lock()) return;
+        EpochGuard guard = epoch_.enter();
+
+        size_t max_steps;
+        {
+            std::lock_guard<std::mutex> lock(clock_mutex_);
+            max_steps = (CHAR_BIT + 1) * clock_.size();
+        }
+        for (size_t step = 0; step < max_steps && num_resident_buckets_ > max_resident_buckets_; step++) {
+            // read the root and the number of levels as a pair
+            uint64_t root_version = root_version_.read_begin();
+            void *root = root_;
+            uint64_t num_levels = num_levels_;
+            if (!root_version_.read_validate(root_version)) continue;
+            if (!root) return;
+
+            KeyType pivot;
+            {
+                std::lock_guard<std::mutex> lock(clock_mutex_);
+                if (clock_.empty()) return;
+                pivot = clock_.front();
+                clock_.pop_front();
+            }
+            std::vector<KeyValuePtrType> path(num_levels);
+            KeyType next_pivot;
+            lookup_path(pivot, root, path, next_pivot, nullptr, Access::NONE);
+            if (path.back().key_ != pivot || (path.back().value_ & CHILD_TAGS)) continue; // not resident anymore
+            // accessed since the hand last passed, or modified meanwhile
+            if (((DataBucketType *)path.back().value_)->age() > 0 || !spill(path)) push_clock(pivot);
+        }
+    }
+
+    /**
+     * Helper function for tiered storage to add a resident D-Bucket to the ring of evict()
+     * @param pivot: the pivot of the D-Bucket
+     */
+    void push_clock(KeyType pivot) {
+        std::lock_guard<std::mutex> lock(clock_mutex_);
+        clock_.push_back(pivot);
+    }
+
+    /**
+     * Helper function for tiered storage to restart the accounting when the tree is replaced, e.g., by a bulk load
+     * @param d_buckets: the D-Buckets of the new tree, resident or compressed
+     */
+    void reset_clock(const std::vector<void*> &d_buckets) {
+        std::lock_guard<std::mutex> lock(clock_mutex_);
+        clock_.clear();
+        for (void *node : d_buckets) {
+            if (!((uintptr_t)node & CHILD_TAGS)) clock_.push_back(((DataBucketType *)node)->get_pivot());
+        }
+        num_resident_buckets_ = clock_.size();
+        num_spilled_buckets_ = 0;
+    }
+
+    /**
+     * Helper function for evict() to write a D-Bucket to the tier file, and swap its slot into its leaf segment
+     * The D-Bucket is locked meanwhile, so no insert is lost; then it is obsolete, and retired
+     * @param path: the path from root to the D-Bucket
+     * @return true if the D-Bucket is spilled; false if it, or its leaf segment, changed meanwhile
+     */
+    bool spill(const std::vector<KeyValuePtrType> &path) {
+        SegmentType *leaf = (SegmentType *)path[path.size()-2].value_;
+        DataBucketType *d_bucket = (DataBucketType *)path.back().value_;
+        if (!d_bucket->lock()) return false; // split meanwhile
+
+        uint64_t slot;
+        try {
+            slot = tier_file_->write(d_bucket);
+        } catch (...) {
+            d_bucket->unlock();
+            throw;
+        }
+        bool replaced = false;
+        if (leaf->lock()) {
+            replaced = leaf->replace_child(path.back().key_, (uintptr_t)d_bucket, spilled_child(slot)) ==
+                       (uintptr_t)d_bucket;
+            leaf->unlock();
+        }
+        if (!replaced) {
+            tier_file_->free(slot); // never visible
+            d_bucket->unlock();
+            return false;
+        }
+        num_resident_buckets_--;
+        num_spilled_buckets_++;
+        // writers waiting for the D-Bucket restart from the root, and fault it back in
+        d_bucket->mark_obsolete();
+        d_bucket->unlock();
+        epoch_.retire(d_bucket, [this](void *p) { arena_.destroy((DataBucketType*)p); });
+        return true;
+    }
+
+    /**
+     * Helper function for bulk_load() to reject the inputs it can not load
+     * @param caller: the name in the error message
+     */
+    void check_sorted_unique(const vector<KeyValueType> &kvs, const char *caller) {
+        if (kvs.empty()) throw std::invalid_argument(std::string(caller) + ": empty input");
+        std::atomic<size_t> first_bad(kvs.size()); // the first position whose key is not above the previous one
+        task_pool_->parallel_for(1, kvs.size(), 0, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end && i < first_bad.load(std::memory_order_relaxed); i++) {
+                if (!(kvs[i-1].key_ < kvs[i].key_)) {
+                    size_t bad = first_bad.load(std::memory_order_relaxed);
+                    while (i < bad && !first_bad.compare_exchange_weak(bad, i)) {}
+                    break;
+                }
+            }
+        });
+        size_t i = first_bad.load();
+        if (i < kvs.size()) {
+            throw std::invalid_argument(std::string(caller) + ": the keys must be sorted and unique, but the key at " +
+                                        "position " + std::to_string(i) + (kvs[i-1].key_ == kvs[i].key_ ?
+                                        " duplicates the previous one" : " is smaller than the previous one") +
+                                        " (see bulk_load_unsorted())");
+        }
+    }
+
+    /**
+     * Helper function for bulk_load() and bulk_load_unsorted(), once kvs is checked
+     */
+    void bulk_load_sorted(vector<KeyValueType> &kvs) {
+        // concurrent lookups wait until the new tree is in place
+        root_version_.lock();
+        {
+            typename VersionLock<uint64_t>::WriteGuard root_guard(root_version_);
+            bulk_load_locked(kvs);
+        }
+        root_version_.unlock();
+    }
+
+    /**
+     * Helper function for bulk_load() and the first insert()
+     * NOTE: the caller holds the lock of root_version_, inside a write
+     * @param kvs: list of user key value to be loaded onto the learned index
+     */
+    void bulk_load_locked(vector<KeyValueType> &kvs) {
+        vector<KeyValuePtrType> anchors;
+        run_data_layer_segmentation(kvs, anchors);
+        if constexpr (StatsPolicy::enabled) num_keys_ = kvs.size();
+        build_model_layers_locked(anchors);
+    }
+
+    /**
+     * Helper function for the bulk loads to build the model layers on top of the data layer, and install the root
+     * NOTE: the caller holds the lock of root_version_, inside a write
+     * @param anchors: the anchors of the D-Buckets; consumed
+     */
+    void build_model_layers_locked(vector<KeyValuePtrType> &anchors) {
+        vector<KeyValuePtrType> kvptr_array[2];
+        uint64_t ping = 0, pong = 1;
+        kvptr_array[ping].swap(anchors);
+        num_levels_ = 0;
+        if constexpr (StatsPolicy::enabled) {
+            num_data_buckets_ = kvptr_array[ping].size();
+            level_stats_[num_levels_] = num_data_buckets_;
+        }
+        num_compressed_buckets_ = 0;
+        if (tier_file_) {
+            std::vector<void*> d_buckets;
+            for (auto &kv_ptr : kvptr_array[ping]) d_buckets.push_back((void *)kv_ptr.value_);
+            reset_clock(d_buckets);
+        }
+        num_levels_++;
+
+        assert(kvptr_array[ping].size() > 0);
+
+        do { // at least one model layer
+            run_model_layer_segmentation(kvptr_array[ping],
+                                            kvptr_array[pong]);
+            ping = (ping +1) % 2;
+            pong = (pong +1) % 2;
+            kvptr_array[pong].clear();
+            if constexpr (StatsPolicy::enabled) {
+                level_stats_[num_levels_] = kvptr_array[ping].size();
+            }
+            num_levels_++;
+        } while (kvptr_array[ping].size() > 1);
+        
+        // Build the root
+        KeyValuePtrType& kv_ptr = kvptr_array[ping][0];
+        root_ = (void *)kv_ptr.value_;
+        dump();
+    }
+
+    /**
+     * Helper function for the streaming bulk loads
+     * The D-Buckets are filled one chunk at a time, outside the lock: they are not reachable until the root is
+     * installed. One pair is read ahead, as the first key of the next D-Bucket ends the range of the last one
+     * @param next: next(kv) reads the next pair into kv; false at the end of the input
+     */
+    template<typename Next>
+    void bulk_load_stream(Next next) {
+        const size_t occupancy = get_bucket_occupancy();
+        vector<KeyValueType> chunk;
+        chunk.reserve(occupancy * STREAM_CHUNK_BUCKETS + 1);
+        vector<KeyValuePtrType> anchors;
+        uint64_t num_kvs = 0; // consumed before chunk
+
+        KeyValueType kv;
+        bool more = next(kv);
+        if (!more) throw std::invalid_argument("bulk_load: empty input");
+        chunk.push_back(kv);
+        while (true) {
+            while (chunk.size() < occupancy * STREAM_CHUNK_BUCKETS + 1 && (more = next(kv))) {
+                if (!(chunk.back().key_ < kv.key_)) {
+                    for (auto &anchor : anchors) arena_.destroy((DataBucketType *)anchor.value_);
+                    throw std::invalid_argument("bulk_load: the keys must be sorted and unique, but the key at position " +
+                                                std::to_string(num_kvs + chunk.size()) +
+                                                (chunk.back().key_ == kv.key_ ? " duplicates the previous one" :
+                                                                               " is smaller than the previous one"));
+                }
+                chunk.push_back(kv);
+            }
+            if (!more) {
+                fill_data_buckets(chunk.begin(), chunk.size(), std::numeric_limits<KeyType>::max(), anchors);
+                num_kvs += chunk.size();
+                break;
+            }
+            // the last pair is the first one of the next chunk
+            fill_data_buckets(chunk.begin(), chunk.size() - 1, chunk.back().key_, anchors);
+            num_kvs += chunk.size() - 1;
+            chunk.front() = chunk.back();
+            chunk.resize(1);
+        }
+
+        root_version_.lock();
+        {
+            typename VersionLock<uint64_t>::WriteGuard root_guard(root_version_);
+            if constexpr (StatsPolicy::enabled) num_keys_ = num_kvs;
+            build_model_layers_locked(anchors);
+        }
+        root_version_.unlock();
+    }
+
     /**
      * Helper function for scan() to find the next D-Bucket
      * @param path: the path from root to the leaf D-Bucket
@@ -779,6 +1795,7 @@ private:
                     tranverse_down_level++;
                 }
 
+                resolve_d_bucket((SegmentType*)path[num_levels_-2].value_, path[num_levels_-1], Access::READ);
                 return true;
             } else { // not found, go to the upper level
                 cur_level--;
@@ -796,55 +1813,67 @@ private:
      */
     void run_data_layer_segmentation(vector<KeyValueType>& in_kv_array,
                                      vector<KeyValuePtrType>& out_kv_array) {
-        vector<Cut<KeyType>> out_cuts;
-        uint64_t initial_bucket_occupacy = DATA_BUCKET_SIZE * initial_filled_ratio_;
+        fill_data_buckets(in_kv_array.begin(), in_kv_array.size(), std::numeric_limits<KeyType>::max(), out_kv_array);
+    }
 
-        Segmentation<vector<KeyValueType>, KeyType>::compute_fixed_segmentation(in_kv_array,
-                                                                                out_cuts,
-                                                                                initial_bucket_occupacy);
-        for(auto i = 0; i<out_cuts.size(); i++) {
-            uint64_t start_idx = out_cuts[i].start_;
-            uint64_t length = out_cuts[i].size_;
-            DataBucketType* d_bucket = new DataBucketType();
+    /**
+     * @return the number of pairs loaded into each D-Bucket by the bulk loads
+     */
+    size_t get_bucket_occupancy() const {
+        return std::max<size_t>(1, DATA_BUCKET_SIZE * initial_filled_ratio_);
+    }
+
+    /**
+     * Helper function to fill D-Buckets with consecutive runs of get_bucket_occupancy() pairs (fixed segmentation)
+     * With narrowed keys, a run holds the pairs of a 32-bit key range, up to get_bucket_occupancy() of them, or
+     * else the occupancy of a D-Bucket of full-width keys, whichever is more (see Bucket::capacity())
+     * @param first: the first of the pairs
+     * @param num_kvs: the number of pairs
+     * @param end_key: the key after the last pair, i.e., the end of the range of the last D-Bucket
+     * @param out_kv_array: the anchors of the D-Buckets are appended to it
+     */
+    template<typename Iter>
+    void fill_data_buckets(Iter first, size_t num_kvs, KeyType end_key, vector<KeyValuePtrType>& out_kv_array) {
+        const size_t occupancy = get_bucket_occupancy();
+        std::vector<size_t> starts; // the first pair of each D-Bucket; the runs are cut serially
+        if constexpr (DataBucketType::KEY_OFFSETS) {
+            const size_t wide_occupancy = std::max<size_t>(1, DATA_BUCKET_SIZE / 2 * initial_filled_ratio_);
+            for (size_t start_idx = 0; start_idx < num_kvs;) {
+                starts.push_back(start_idx);
+                size_t end_idx = start_idx + 1;
+                size_t max_idx = std::min(num_kvs, start_idx + occupancy);
+                while (end_idx < max_idx && DataListType::narrow_range(first[start_idx].key_, first[end_idx].key_)) {
+                    end_idx++;
+                }
+                start_idx = std::max(end_idx, std::min(num_kvs, start_idx + wide_occupancy));
+            }
+        } else {
+            for (size_t start_idx = 0; start_idx < num_kvs; start_idx += occupancy) starts.push_back(start_idx);
+        }
+        const size_t num_buckets = starts.size();
+        const size_t first_bucket = out_kv_array.size();
 
+        // the D-Buckets are allocated in order, then filled in parallel chunks
+        out_kv_array.resize(first_bucket + num_buckets);
+        for (size_t i = 0; i < num_buckets; i++) {
             //store the bucket anchor for the higher layer
-            out_kv_array.push_back(KeyValuePtrType(in_kv_array[start_idx].key_,
-                                                   (uintptr_t)d_bucket));
-
-#ifdef HINT_MODEL_PREDICT
-            KeyType start_key = in_kv_array[start_idx].key_;
-            KeyType end_key = std::numeric_limits<KeyType>::max();
-            if (start_idx+length < in_kv_array.size()) end_key = in_kv_array[start_idx+length-1].key_;
-            assert(end_key > start_key);
-            double slope = (long double)DATA_BUCKET_SIZE / (long double)(end_key - start_key);
-            double offset = -slope * start_key;
-#endif
-            
-            //load the keys to the data bucket
-            for(auto j = start_idx; j < (start_idx+length); j++) { // TODO: model-based insertion
-                size_t hint = 0;
-
-#ifdef HINT_MOD_HASH
-                hint = (in_kv_array[j].key_) % DATA_BUCKET_SIZE;
-#endif
-#ifdef HINT_CL_HASH
-                hint = clhash64(in_kv_array[j].key_) % DATA_BUCKET_SIZE; 
-#endif
-#ifdef HINT_MURMUR_HASH
-                hint = murmur64(in_kv_array[j].key_) % DATA_BUCKET_SIZE; 
-#endif
-#ifdef HINT_MODEL_PREDICT
-                hint = (size_t)(slope * in_kv_array[j].key_ + offset);
-#endif
-#ifdef NO_HINT
-                hint=0;
-#endif
-                hint = min(hint, DATA_BUCKET_SIZE-1);
-                d_bucket->insert(in_kv_array[j], true, hint);
-            }
-            //segment->dump();
-        }
-        //level_stats_[0] = out_cuts.size();
+            out_kv_array[first_bucket + i] = KeyValuePtrType(first[starts[i]].key_,
+                                                             (uintptr_t)arena_.create<DataBucketType>());
+        }
+        task_pool_->parallel_for(0, num_buckets, BULK_LOAD_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                size_t start_idx = starts[i];
+                size_t end_idx = i + 1 < num_buckets ? starts[i + 1] : num_kvs;
+                DataBucketType* d_bucket = (DataBucketType *)out_kv_array[first_bucket + i].value_;
+
+                // the bucket covers [its first key, the first key of the next bucket)
+                KeyType start_key = first[start_idx].key_;
+                KeyType bucket_end_key = end_idx < num_kvs ? first[end_idx].key_ : end_key;
+
+                //load the keys to the data bucket
+                d_bucket->rebuild(first + start_idx, first + end_idx, start_key, bucket_end_key);
+            }
+        });
     }
 
     /**
@@ -857,41 +1886,219 @@ private:
                                       vector<KeyValuePtrType>& out_kv_array) {
         vector<Cut<KeyType>> out_cuts;
         vector<LinearModel<KeyType>> out_models;
-        Segmentation<vector<KeyValuePtrType>, KeyType>::compute_dynamic_segmentation(in_kv_array,
-                                                                                     out_cuts, out_models,
-                                                                                     error_bound_);
-        for(auto i = 0; i < out_cuts.size(); i++) {
-            uint64_t start_idx = out_cuts[i].start_;
-            uint64_t length = out_cuts[i].size_;
-
-            SegmentType* segment = new SegmentType(length, initial_filled_ratio_, out_models[i],
-                                                   in_kv_array.begin() + start_idx, in_kv_array.begin() + start_idx + length);
-            out_kv_array.push_back(KeyValuePtrType(in_kv_array[start_idx].key_,
-                                                   (uintptr_t)segment));
+        Segmentation<vector<KeyValuePtrType>, KeyType>::compute_dynamic_segmentation_parallel(in_kv_array,
+                                                                                              out_cuts, out_models,
+                                                                                              error_bound_,
+                                                                                              *task_pool_);
+        // the segments are allocated in order, then constructed in parallel chunks
+        out_kv_array.resize(out_cuts.size());
+        for (size_t i = 0; i < out_cuts.size(); i++) {
+            out_kv_array[i] = KeyValuePtrType(in_kv_array[out_cuts[i].start_].key_,
+                                              (uintptr_t)SegmentType::allocate(arena_, out_cuts[i].size_,
+                                                                               initial_filled_ratio_));
         }
+        task_pool_->parallel_for(0, out_cuts.size(), BULK_LOAD_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                uint64_t start_idx = out_cuts[i].start_;
+                uint64_t length = out_cuts[i].size_;
+                SegmentType::create_in((void *)out_kv_array[i].value_, length, initial_filled_ratio_, out_models[i],
+                                       in_kv_array.begin() + start_idx,
+                                       in_kv_array.begin() + start_idx + length);
+            }
+        });
     }
 
     //The root segment of the learned index.
     void* root_;
+    VersionLock<uint64_t> root_version_; // bumped when root_ or num_levels_ change; see lookup()
+    // All D-Buckets and Segments are allocated from the arena; the whole tree is released with it
+    NodeArena arena_;
+    // The spilled D-Buckets of tiered storage; nullptr without it (see enable_tiering())
+    // NOTE: declared before epoch_, which frees the slots of the retired spilled children
+    std::unique_ptr<TierFile> tier_file_;
+    // Nodes replaced by SMOs are retired here until no reader can see them
+    // NOTE: declared after arena_, so the remaining retired nodes are returned before the arena is released
+    EpochManager epoch_;
     //Learned index constants
     static const uint8_t max_levels_ = 16;
     double initial_filled_ratio_;
 
     int error_bound_;
 
-    static const int NUM_WORKER_THREADS = 11;
-    struct SortTask {
-        DataBucketType* bucket;
-        size_t reserved_size;
-        std::vector<KeyValueType>* result_vector;
-        std::promise<void> promise;
+    TaskPool *task_pool_; // runs the parallel work, e.g., scan_parallel() and bulk_load()
+    static constexpr size_t BULK_LOAD_GRAIN = 1024; // D-Buckets or segments per bulk load task
+    static constexpr size_t STREAM_CHUNK_BUCKETS = 1 << 14; // D-Buckets filled per chunk of a streaming bulk load
+
+    // tiered storage (see enable_tiering())
+    static constexpr uintptr_t SPILLED_TAG = 1; // the nodes are at least 16-byte aligned (see NodeArena)
+    static constexpr uintptr_t COMPRESSED_TAG = 2; // see compress_cold()
+    static constexpr uintptr_t CHILD_TAGS = SPILLED_TAG | COMPRESSED_TAG;
+    size_t max_resident_buckets_ = 0;
+    std::atomic<uint64_t> num_resident_buckets_{0};
+    std::atomic<uint64_t> num_spilled_buckets_{0};
+    std::mutex evict_mutex_; // held by the evicting thread
+    std::mutex clock_mutex_; // protects clock_
+    std::deque<KeyType> clock_; // the pivots of the resident D-Buckets, in CLOCK order; see evict()
+    std::atomic<uint64_t> num_compressed_buckets_{0}; // see compress_cold()
+    std::atomic<bool> track_access_{false}; // the D-Buckets count their accesses, for tiering and compress_cold()
+
+    static constexpr char SNAPSHOT_MAGIC[8] = {'B', 'L', 'I', 'S', 'N', 'A', 'P', 0};
+    static constexpr uint32_t SNAPSHOT_VERSION = 2; // 2: S-Buckets with contiguous keys
+    static constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304; // a snapshot is not portable across byte orders
+    static constexpr size_t SNAPSHOT_CHUNK_BUCKETS = 1 << 14; // D-Buckets per read of load()
+    static constexpr size_t SNAPSHOT_IO_BUFFER = 4 << 20; // buffer of the snapshot files, for the small records
+
+    // the valid slots of an S-Bucket in key order, i.e., in the order of its children in the level below
+    // @return the number of valid slots
+    static int sorted_slots(const SegBucketType &s_bucket, int *slots) {
+        int num_slots = 0;
+        for (int pos = 0; pos < SEGMENT_BUCKET_SIZE; pos++) {
+            if (s_bucket.valid(pos)) slots[num_slots++] = pos;
+        }
+        std::sort(slots, slots + num_slots, [&s_bucket](int a, int b) { return s_bucket.at(a).key_ < s_bucket.at(b).key_; });
+        return num_slots;
+    }
+
+    // the nodes of each level, top-down: the root, ..., the D-Buckets; each level lists the children of the level
+    // above in key order. Empty for an empty index
+    std::vector<std::vector<void*>> collect_levels() const {
+        std::vector<std::vector<void*>> levels;
+        if (root_) levels.push_back(std::vector<void*>(1, root_));
+        for (size_t l = 0; l < levels.size() && l + 1 < num_levels_; l++) {
+            std::vector<void*> children;
+            for (void *node : levels[l]) {
+                SegmentType *segment = (SegmentType *)node;
+                for (int b = 0; b < segment->num_bucket_; b++) {
+                    SegBucketType *s_bucket = segment->get_bucket(b);
+                    int slots[SEGMENT_BUCKET_SIZE];
+                    int num_slots = sorted_slots(*s_bucket, slots);
+                    for (int k = 0; k < num_slots; k++) children.push_back((void *)s_bucket->at(slots[k]).value_);
+                }
+            }
+            levels.push_back(std::move(children));
+        }
+        return levels;
+    }
+
+    // the header of a snapshot (see save())
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t key_size; // sizeof(KeyType)
+        uint32_t value_size; // sizeof(ValueType)
+        uint32_t segment_bucket_size; // SEGMENT_BUCKET_SIZE
+        uint32_t data_bucket_size; // DATA_BUCKET_SIZE
+        uint32_t segment_bucket_bytes; // sizeof(SegBucketType)
+        uint32_t data_bucket_bytes; // sizeof(DataBucketType)
+        double initial_filled_ratio;
+        int64_t error_bound;
+        uint64_t num_keys;
+        uint64_t num_levels; // 0 for an empty index
+        uint64_t level_sizes[max_levels_]; // the number of nodes per level; level 0 is the data layer
+    };
+
+    // the record of a segment, followed by its S-Buckets
+    struct SegmentRecord {
+        SegmentRecord() : num_bucket(0) {}
+        SegmentRecord(const LinearModel<KeyType> &m, uint64_t n) : model(m), num_bucket(n) {}
+        LinearModel<KeyType> model;
+        uint64_t num_bucket;
+    };
+
+    // a snapshot file, read or written sequentially through a large buffer
+    class SnapshotFile {
+    public:
+        SnapshotFile(const std::string &path, const char *mode)
+            : path_(path), file_(std::fopen(path.c_str(), mode)), buffer_(SNAPSHOT_IO_BUFFER), remaining_(0) {
+            if (!file_) throw std::runtime_error("cannot open snapshot " + path_);
+            std::setvbuf(file_, buffer_.data(), _IOFBF, buffer_.size());
+            if (mode[0] == 'r' && std::fseek(file_, 0, SEEK_END) == 0) {
+                long size = std::ftell(file_);
+                remaining_ = size > 0 ? size : 0;
+                std::fseek(file_, 0, SEEK_SET);
+            }
+        }
+
+        ~SnapshotFile() {
+            if (file_) std::fclose(file_);
+        }
+
+        void read(void *data, size_t bytes) {
+            if (bytes > remaining_ || std::fread(data, 1, bytes, file_) != bytes) {
+                throw std::runtime_error("truncated snapshot " + path_);
+            }
+            remaining_ -= bytes;
+        }
+
+        void write(const void *data, size_t bytes) {
+            if (std::fwrite(data, 1, bytes, file_) != bytes) throw std::runtime_error("cannot write snapshot " + path_);
+        }
+
+        // flush and close; a write error may only show up here
+        void close() {
+            FILE *file = file_;
+            file_ = nullptr;
+            if (std::fclose(file) != 0) throw std::runtime_error("cannot write snapshot " + path_);
+        }
+
+        // the bytes not read yet
+        size_t remaining() const { return remaining_; }
+
+    private:
+        std::string path_;
+        FILE *file_;
+        std::vector<char> buffer_;
+        size_t remaining_;
     };
 
-    std::vector<std::thread> worker_threads_;
-    std::queue<SortTask> task_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
-    bool shutdown_;
+    SnapshotHeader make_snapshot_header() const {
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byte_order = SNAPSHOT_BYTE_ORDER;
+        header.key_size = sizeof(KeyType);
+        header.value_size = sizeof(ValueType);
+        header.segment_bucket_size = SEGMENT_BUCKET_SIZE;
+        header.data_bucket_size = DATA_BUCKET_SIZE;
+        header.segment_bucket_bytes = sizeof(SegBucketType);
+        header.data_bucket_bytes = sizeof(DataBucketType);
+        header.initial_filled_ratio = initial_filled_ratio_;
+        header.error_bound = error_bound_;
+        header.num_keys = num_keys_;
+        return header;
+    }
+
+    // throw std::runtime_error if the snapshot cannot be loaded by this index
+    // @param num_bytes: the size of the snapshot after the header
+    void check_snapshot_header(const SnapshotHeader &header, const std::string &path, size_t num_bytes) const {
+        SnapshotHeader expected = make_snapshot_header();
+        if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error("load: not a snapshot: " + path);
+        }
+        if (header.version != expected.version || header.byte_order != expected.byte_order) {
+            throw std::runtime_error("load: unsupported snapshot version or byte order: " + path);
+        }
+        if (header.key_size != expected.key_size || header.value_size != expected.value_size ||
+            header.segment_bucket_size != expected.segment_bucket_size ||
+            header.data_bucket_size != expected.data_bucket_size ||
+            header.segment_bucket_bytes != expected.segment_bucket_bytes ||
+            header.data_bucket_bytes != expected.data_bucket_bytes) {
+            throw std::runtime_error("load: snapshot of an index with other template parameters: " + path);
+        }
+        // a tree has at least one model layer, and a single root
+        if (header.num_levels > max_levels_ || header.num_levels == 1 ||
+            (header.num_levels > 0 && header.level_sizes[header.num_levels - 1] != 1)) {
+            throw std::runtime_error("load: corrupt snapshot header: " + path);
+        }
+        for (uint64_t l = 0; l < header.num_levels; l++) {
+            size_t record_size = l == 0 ? sizeof(DataBucketType) : sizeof(SegmentRecord) + sizeof(SegBucketType);
+            if (header.level_sizes[l] == 0 || header.level_sizes[l] > num_bytes / record_size) {
+                throw std::runtime_error("load: corrupt snapshot header: " + path);
+            }
+        }
+    }
     
     //Statistics
     
@@ -900,7 +2107,7 @@ private:
 
     uint64_t num_levels_; // the number of layers including model layers and the data layer
 
-    #ifdef BUCKINDEX_DEBUG
+    // NOTE: only maintained if StatsPolicy::enabled
     uint64_t num_data_buckets_; // the number of data buckets in the data layer
     uint64_t level_stats_[max_levels_]; // the number of buckets in each layer
     // NOTE: level_stats_[0] is the number of data buckets in the data layer
@@ -932,7 +2139,6 @@ private:
         int num_of_SMO = 0; // total number of SMO;
     };
     insertStats insert_stats_;
-#endif
 
 
 
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdint>
+#include "buck_index.h"
+#include "frozen_format.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace buckindex {
+
+/**
+ * Read-only BLI served straight from a memory-mapped file in the frozen format (see frozen_format.h), written
+ * by BuckIndex::freeze() with the same template parameters
+ * Nothing is deserialised: opening maps the file and checks its header, and the pages are faulted in by the
+ * lookups. The mapping is shared, so the processes serving the same file share its page cache.
+ * Lookups and scans run the kernels of BuckIndex on the mapped nodes (Segment::lb_lookup() and the D-Bucket
+ * lookup with the same hints); the D-Buckets are stored in key order, so a scan reads them sequentially.
+ * NOTE: the file is trusted beyond its header, e.g., the child offsets are not checked
+ * NOTE: thread-safe, as nothing is modified
+ */
+template<typename KeyType, typename ValueType, size_t SEGMENT_BUCKET_SIZE, size_t DATA_BUCKET_SIZE,
+         typename HintPolicy = DefaultHintPolicy, typename ModelPolicy = DefaultModelPolicy,
+         typename StatsPolicy = DefaultStatsPolicy, typename SearchKernel = DefaultSearchKernel,
+         typename DataListPolicy = DefaultDataListPolicy>
+class MappedBuckIndex {
+public:
+    using IndexType = BuckIndex<KeyType, ValueType, SEGMENT_BUCKET_SIZE, DATA_BUCKET_SIZE,
+                                HintPolicy, ModelPolicy, StatsPolicy, SearchKernel, DataListPolicy>;
+    using DataBucketType = typename IndexType::DataBucketType;
+    using SegmentType = typename IndexType::SegmentType;
+    using SegBucketType = typename IndexType::SegBucketType;
+    using KeyValueType = KeyValue<KeyType, ValueType>;
+    using KeyValuePtrType = KeyValue<KeyType, uintptr_t>;
+
+    /**
+     * Map a frozen index
+     * @param path: the file written by BuckIndex::freeze()
+     * @throw std::runtime_error if the file cannot be mapped, or is not a frozen index with the same template
+     *        parameters
+     */
+    explicit MappedBuckIndex(const std::string &path) : base_(nullptr), size_(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open frozen index " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrozenHeader)) {
+            close(fd);
+            throw std::runtime_error("not a frozen index: " + path);
+        }
+        size_ = st.st_size;
+        void *addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // the mapping keeps the file
+        if (addr == MAP_FAILED) throw std::runtime_error("cannot map frozen index " + path);
+        base_ = (const char *)addr;
+        try {
+            check_header(path);
+        } catch (...) {
+            munmap((void *)base_, size_);
+            throw;
+        }
+    }
+
+    ~MappedBuckIndex() {
+        munmap((void *)base_, size_);
+    }
+
+    MappedBuckIndex(const MappedBuckIndex&) = delete;
+    MappedBuckIndex& operator=(const MappedBuckIndex&) = delete;
+
+    /**
+     * Lookup function
+     * @param key: lookup key
+     * @param value: corresponding value to be returned
+     * @return true if the key is found, else false
+     */
+    bool lookup(KeyType key, ValueType &value) const {
+        KeyValuePtrType kv_ptr, kv_ptr_next;
+        const DataBucketType *d_bucket = find_d_bucket(key, kv_ptr, kv_ptr_next);
+        if (!d_bucket) return false;
+        // the same hint as BuckIndex::lookup(); kv_ptr and kv_ptr_next give the key range of the d-bucket
+        size_t hint = HintPolicy::template hint<DATA_BUCKET_SIZE>(*d_bucket, key, kv_ptr.key_, kv_ptr_next.key_);
+        hint = std::min(hint, DATA_BUCKET_SIZE - 1);
+        return d_bucket->lookup(key, value, hint);
+    }
+
+    /**
+     * Scan function
+     * @param start_key: scan from the first key that is >= start_key
+     * @param num_to_scan: the number of key-value pairs to be scanned
+     * @param kvs: the scanned key-value pairs
+     * @return the number of key-value pairs scanned(<= num_to_scan)
+     */
+    size_t scan(KeyType start_key, size_t num_to_scan, std::pair<KeyType, ValueType> *kvs) const {
+        const FrozenHeader &h = header();
+        if (h.num_levels == 0) return 0;
+        KeyValuePtrType kv_ptr, kv_ptr_next;
+        const DataBucketType *d_bucket = find_d_bucket(start_key, kv_ptr, kv_ptr_next);
+        // a key below the smallest one starts at the first D-Bucket
+        size_t pos = d_bucket ? ((const char *)d_bucket - base_ - h.data_offset) / sizeof(DataBucketType) : 0;
+
+        size_t num_scanned = 0;
+        std::vector<KeyValueType> scanned_kvs;
+        for (; pos < h.num_data_buckets && num_scanned < num_to_scan; pos++) {
+            data_bucket(pos)->scan_kvs(scanned_kvs, start_key, num_to_scan - num_scanned);
+            for (auto &kv : scanned_kvs) kvs[num_scanned++] = std::make_pair(kv.key_, kv.value_);
+        }
+        return num_scanned;
+    }
+
+    /**
+     * @return the number of levels in the index, including the data layer
+     */
+    uint64_t get_num_levels() const { return header().num_levels; }
+
+    /**
+     * @return the number of keys in the index
+     */
+    uint64_t get_num_keys() const { return header().num_keys; }
+
+    /**
+     * @return the number of data buckets in the index
+     */
+    uint64_t get_num_data_buckets() const { return header().num_data_buckets; }
+
+    /**
+     * @return the size of the mapping
+     */
+    size_t mapped_size() const { return size_; }
+
+private:
+    const FrozenHeader& header() const { return *reinterpret_cast<const FrozenHeader *>(base_); }
+
+    template<typename T>
+    const T* at(uint64_t offset) const { return reinterpret_cast<const T *>(base_ + offset); }
+
+    const DataBucketType* data_bucket(size_t pos) const {
+        return at<DataBucketType>(header().data_offset + pos * sizeof(DataBucketType));
+    }
+
+    // traverse the segments from the root to the D-Bucket that covers key
+    // @return the D-Bucket; nullptr if key is below the smallest key of the index, or the index is empty
+    const DataBucketType* find_d_bucket(KeyType key, KeyValuePtrType &kv_ptr, KeyValuePtrType &kv_ptr_next) const {
+        const FrozenHeader &h = header();
+        if (h.num_levels == 0) return nullptr;
+        uint64_t offset = h.root_offset;
+        for (uint64_t level = h.num_levels - 1; level > 0; level--) {
+            const FrozenSegment<KeyType> *segment = at<FrozenSegment<KeyType>>(offset);
+            const SegBucketType *s_buckets = at<SegBucketType>(offset + sizeof(FrozenSegment<KeyType>));
+            const KeyType *pivots = reinterpret_cast<const KeyType *>(s_buckets + segment->num_bucket);
+            if (!SegmentType::lb_lookup(segment->model, s_buckets, pivots, segment->num_bucket, segment->max_error,
+                                        key, kv_ptr, kv_ptr_next)) {
+                return nullptr;
+            }
+            offset = kv_ptr.value_;
+        }
+        return at<DataBucketType>(offset);
+    }
+
+    // throw std::runtime_error if the mapped file cannot be served by this index
+    void check_header(const std::string &path) const {
+        const FrozenHeader &h = header();
+        if (memcmp(h.magic, FROZEN_MAGIC, sizeof(h.magic)) != 0) throw std::runtime_error("not a frozen index: " + path);
+        if (h.version != FROZEN_VERSION || h.byte_order != FROZEN_BYTE_ORDER) {
+            throw std::runtime_error("unsupported frozen index version or byte order: " + path);
+        }
+        if (h.key_size != sizeof(KeyType) || h.value_size != sizeof(ValueType) ||
+            h.segment_bucket_size != SEGMENT_BUCKET_SIZE || h.data_bucket_size != DATA_BUCKET_SIZE ||
+            h.segment_bucket_bytes != sizeof(SegBucketType) || h.data_bucket_bytes != sizeof(DataBucketType)) {
+            throw std::runtime_error("frozen index with other template parameters: " + path);
+        }
+        bool valid = h.file_size == size_ && h.num_levels != 1;
+        if (valid && h.num_levels > 0) {
+            valid = h.data_offset % FROZEN_ALIGNMENT == 0 && h.root_offset % FROZEN_ALIGNMENT == 0 &&
+                    h.num_data_buckets > 0 && h.data_offset <= size_ &&
+                    h.num_data_buckets <= (size_ - h.data_offset) / sizeof(DataBucketType) &&
+                    h.root_offset + sizeof(FrozenSegment<KeyType>) <= size_;
+        }
+        if (!valid) throw std::runtime_error("corrupt frozen index: " + path);
+    }
+
+    const char *base_; // the start of the mapping
+    size_t size_;
+};
+
+} // end namespace buckindex
@@ -5,6 +5,7 @@
 #include "buck_index.h"
 #include "bli_concurrent.h"
 #include "bli_async.h"
+#include "bli_partitioned.h"
 
 typedef unsigned long long key_type;
 typedef unsigned long long value_type;
@@ -17,12 +17,26 @@
 #include "util.h"
 // #include "buck_index.h"
 #include "keyvalue.h"
+#include "policy.h"
+#include "node_arena.h"
+#include "version_lock.h"
 
 
 namespace buckindex {
 
 constexpr unsigned int BITS_UINT64_T = sizeof(uint64_t) * 8;;
 
+/**
+ * How a D-Bucket turns a key into its starting/predicted slot
+ * HINT_TYPE_MODEL: linear interpolation between the bucket pivot and the hint range end
+ * HINT_TYPE_HASH: murmur hash of the key
+ * Only used by the AdaptiveHint policy; the type is chosen per bucket on rebuild
+ */
+enum HintType : uint8_t {
+    HINT_TYPE_MODEL = 0,
+    HINT_TYPE_HASH = 1
+};
+
 //debug only
 // static std::map<int, int> hint_dist_count; // <distance, count>
 
@@ -31,13 +45,17 @@ constexpr unsigned int BITS_UINT64_T = sizeof(uint64_t) * 8;;
  * Bucket is a list of unsorted KeyValue
  * It can be either S-Bucket or D-Bucket, depending on the LISTTYPE
  * Note that the template parameter SIZE must matches the SIZE of the LISTTYPE
+ * HintPolicy decides the hints used when the D-Bucket is rebuilt; SearchKernel decides how lookup() probes
  */
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
+template<class LISTTYPE, typename T, typename V, size_t SIZE,
+         typename HintPolicy = DefaultHintPolicy, typename SearchKernel = DefaultSearchKernel>
 class Bucket { // can be an S-Bucket or a D-Bucket. S-Bucket and D-Bucket have different sizes
 public:
     using KeyValueType = KeyValue<T, V>;
     using KeyValuePtrType = KeyValue<T, uintptr_t>;
-    using BucketType = Bucket<LISTTYPE, T, V, SIZE>;
+    using BucketType = Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>;
+    // the keys are narrowed to offsets from a base key (see KeyOffsetListValueList)
+    static constexpr bool KEY_OFFSETS = is_key_offset_list<LISTTYPE>::value;
     
 
     Bucket() {
@@ -48,8 +66,12 @@ public:
         assert(sizeof(T) == 4 || sizeof(T) == 8);
 
         num_keys_ = 0;
+        probe_sum_ = 0;
+        hint_type_ = HINT_TYPE_MODEL;
+        access_count_ = 0;
 
         pivot_ = std::numeric_limits<T>::max(); // std::numeric_limits<T>::max() means invalid
+        hint_end_ = std::numeric_limits<T>::max();
         memset(bitmap_, 0, sizeof(bitmap_));
     }
 
@@ -98,7 +120,9 @@ public:
     bool update(const KeyValueType &kv) { //TODO: add SIMD_lookup
         for (int i = 0; i < SIZE; i++) {
             if (valid(i) && list_.at(i).key_ == kv.key_) {
+                version_.write_begin();
                 list_.put(i, kv.key_, kv.value_);
+                version_.write_end();
                 return true;
             }
         }
@@ -111,8 +135,7 @@ public:
     */
 
     size_t mem_size() const {
-        typedef Bucket<LISTTYPE, T, V, SIZE> self_type;
-        return sizeof(self_type);
+        return sizeof(BucketType);
 
         // return sizeof(self_type);
         // size_t size = 0;
@@ -128,79 +151,145 @@ public:
     /**
      * Split the D-bucket into two buckets by the median key, 
      * to make room for a new key-value pair, and then insert the new key-value pair
+     * With narrowed keys, the split point moves from the median as needed for both parts to fit (see split_fitting())
+     * The first new bucket covers [its pivot, pivot of the second bucket),
+     * and the second one inherits the hint range end of this bucket
      * @param kv: the new key-value pair to be inserted
+     * @param arena: the arena to allocate the new buckets from; nullptr means the heap
      * @return two KVptr of the new buckets
      */
-    std::pair<KeyValuePtrType, KeyValuePtrType> split_and_insert(const KeyValueType &kv) {
-        // find the median key
-        T median_key = find_kth_smallest((num_keys()+1) / 2).key_;
+    std::pair<KeyValuePtrType, KeyValuePtrType> split_and_insert(const KeyValueType &kv, NodeArena *arena = nullptr) {
+        std::vector<KeyValueType> lower_kvs, upper_kvs;
+        if constexpr (KEY_OFFSETS) {
+            split_fitting(kv, lower_kvs, upper_kvs);
+        } else {
+            // find the median key
+            T median_key = find_kth_smallest((num_keys()+1) / 2).key_;
+
+            // partition all keys (including the new one) by the median key
+            for (int i = 0; i < SIZE; i++) {
+                if (valid(i)) {
+                    if (list_.at(i).key_ <= median_key) lower_kvs.push_back(list_.at(i));
+                    else upper_kvs.push_back(list_.at(i));
+                }
+            }
+            if (kv.key_ <= median_key) lower_kvs.push_back(kv);
+            else upper_kvs.push_back(kv);
+        }
+        assert(!lower_kvs.empty() && !upper_kvs.empty());
 
-        // create a new bucket
-        BucketType *new_bucket1 = new BucketType();
-        BucketType *new_bucket2 = new BucketType();
+        T lower_pivot = std::min_element(lower_kvs.begin(), lower_kvs.end())->key_;
+        T upper_pivot = std::min_element(upper_kvs.begin(), upper_kvs.end())->key_;
 
-        bool success;
-        // copy all keys that are > median_key to the new bucket
-        size_t hint = 0; // TODO: change to model-based hint
-        for (int i = 0; i < SIZE; i++) {
-            if (valid(i)) {
+        // create the new buckets
+        BucketType *new_bucket1 = arena ? arena->create<BucketType>() : new BucketType();
+        BucketType *new_bucket2 = arena ? arena->create<BucketType>() : new BucketType();
+        new_bucket1->rebuild(lower_kvs.begin(), lower_kvs.end(), lower_pivot, upper_pivot);
+        new_bucket2->rebuild(upper_kvs.begin(), upper_kvs.end(), upper_pivot, hint_end_);
 
-#ifdef HINT_MOD_HASH
-                hint = list_.at(i).key_ % SIZE;
-#endif
-#ifdef HINT_CL_HASH
-                hint = clhash64(list_.at(i).key_) % SIZE; 
-#endif
-#ifdef HINT_MURMUR_HASH
-                hint = murmur64(list_.at(i).key_) % SIZE; 
-#endif
-#ifdef HINT_MODEL_PREDICT
-                hint = 0; // TODO: don't know the next bucket's pivot
-#endif
-#ifdef NO_HINT
-                hint = 0;
-#endif
-                if (list_.at(i).key_ <= median_key)  {
-                    success = new_bucket1->insert(list_.at(i), true, hint);
-                    assert(success);
-                }
-                else {
-                    success = new_bucket2->insert(list_.at(i), true, hint);
-                    assert(success);
-                }
+        std::pair<KeyValuePtrType, KeyValuePtrType> ret;
+        ret.first = KeyValuePtrType(new_bucket1->get_pivot(), reinterpret_cast<uintptr_t>(new_bucket1));
+        ret.second = KeyValuePtrType(new_bucket2->get_pivot(), reinterpret_cast<uintptr_t>(new_bucket2));
+        return ret;
+    }
+
+    /**
+     * Fill an empty D-bucket that covers the key range [pivot, hint_end)
+     * With an adaptive HintPolicy, the hint type of the bucket is chosen from the keys before inserting them.
+     * With narrowed keys, the keys are stored as offsets from the smallest one if their range allows it
+     * @param begin: the start iterator of the key-value pairs to be inserted; must fit into the bucket
+     *               (see capacity())
+     * @param end: the end iterator of the key-value pairs to be inserted
+     * @param pivot: the pivot of the bucket
+     * @param hint_end: the exclusive upper end of the key range covered by the bucket
+     */
+    template<typename IterType>
+    void rebuild(IterType begin, IterType end, T pivot, T hint_end) {
+        assert(num_keys_ == 0);
+        assert(std::distance(begin, end) <= SIZE);
+        pivot_ = pivot;
+        hint_end_ = hint_end;
+        if constexpr (KEY_OFFSETS) {
+            T lo = begin == end ? pivot : begin->key_, hi = lo;
+            for (auto it = begin; it != end; it++) {
+                lo = std::min(lo, it->key_);
+                hi = std::max(hi, it->key_);
             }
+            if (LISTTYPE::narrow_range(lo, hi)) list_.reset_narrow(lo);
+            else list_.reset_wide();
+            assert(std::distance(begin, end) <= list_.capacity());
+        }
+        if constexpr (HintPolicy::adaptive) {
+            hint_type_ = choose_hint_type(begin, end, pivot, hint_end);
         }
 
-        // insert the new key-value pair
-#ifdef HINT_MOD_HASH
-        hint = kv.key_ % SIZE;
-#endif
-#ifdef HINT_CL_HASH
-        hint = clhash64(kv.key_) % SIZE; 
-#endif
-#ifdef HINT_MURMUR_HASH
-        hint = murmur64(kv.key_) % SIZE;
-#endif
-#ifdef HINT_MODEL_PREDICT
-        hint = 0; // TODO: don't know the next bucket's pivot
-#endif
-#ifdef NO_HINT
-        hint = 0;
-#endif
-
-        if (kv.key_ <= median_key) {
-            success = new_bucket1->insert(kv, true, hint);
+        for (auto it = begin; it != end; it++) {
+            size_t hint = HintPolicy::template hint<SIZE>(*this, it->key_, pivot, hint_end);
+            bool success = insert(*it, true, std::min(hint, SIZE - 1));
             assert(success);
         }
-        else {
-            success = new_bucket2->insert(kv, true, hint);
-            assert(success);
+    }
+
+    /**
+     * D-Bucket hint according to the hint type of the bucket
+     * @param key: the key to be looked up or inserted
+     * @return the starting/predicted position in the bucket
+     */
+    inline size_t get_hint(const T &key) const {
+        if (hint_type_ == HINT_TYPE_HASH) return murmur64(key) % SIZE;
+        return model_hint(key, pivot_, hint_end_);
+    }
+
+    /**
+     * Linear interpolation of key in [start_key, end_key) to [0, SIZE)
+     */
+    static inline size_t model_hint(const T &key, T start_key, T end_key) {
+        if (key <= start_key || end_key <= start_key) return 0;
+        size_t hint = (size_t)((long double)(key - start_key) * SIZE / (long double)(end_key - start_key));
+        return std::min(hint, SIZE - 1);
+    }
+
+    /**
+     * Choose the hint type with the smaller total probe distance for the given keys
+     * Simulates the placement of the keys into an empty bucket under both hint types
+     * @param begin: the start iterator of the key-value pairs to be placed
+     * @param end: the end iterator of the key-value pairs to be placed
+     * @param start_key: the pivot of the bucket
+     * @param end_key: the exclusive upper end of the key range covered by the bucket
+     * @return the hint type with the smaller probe distance; HINT_TYPE_MODEL on ties
+     */
+    template<typename IterType>
+    static HintType choose_hint_type(IterType begin, IterType end, T start_key, T end_key) {
+        size_t model_dist = 0, hash_dist = 0;
+        bool model_used[SIZE] = {false};
+        bool hash_used[SIZE] = {false};
+        for (auto it = begin; it != end; it++) {
+            model_dist += simulate_probe(model_used, model_hint(it->key_, start_key, end_key));
+            hash_dist += simulate_probe(hash_used, murmur64(it->key_) % SIZE);
         }
+        return hash_dist < model_dist ? HINT_TYPE_HASH : HINT_TYPE_MODEL;
+    }
 
-        std::pair<KeyValuePtrType, KeyValuePtrType> ret;
-        ret.first = KeyValuePtrType(new_bucket1->get_pivot(), reinterpret_cast<uintptr_t>(new_bucket1));
-        ret.second = KeyValuePtrType(new_bucket2->get_pivot(), reinterpret_cast<uintptr_t>(new_bucket2));
-        return ret;
+    inline HintType get_hint_type() const { return (HintType)hint_type_; }
+    inline void set_hint_type(HintType type) { hint_type_ = type; }
+    inline T get_hint_end() const { return hint_end_; }
+    inline void set_hint_end(T hint_end) { hint_end_ = hint_end; }
+
+    /**
+     * Average distance between the hint and the slot actually taken, over all insertions
+     * This is also the expected probe distance of a successful lookup
+     */
+    inline double avg_probe_distance() const {
+        return num_keys_ ? (double)probe_sum_ / num_keys_ : 0;
+    }
+
+    /**
+     * @return the number of key-value pairs the bucket can hold: SIZE, or SIZE / 2 if the keys of a list of narrowed
+     *         keys fall back to full width (see KeyOffsetListValueList)
+     */
+    inline size_t capacity() const {
+        if constexpr (KEY_OFFSETS) return list_.capacity();
+        else return SIZE;
     }
 
     /**
@@ -241,19 +330,17 @@ public:
      * @param v: the vector to store the key-value pairs
     */
     void get_valid_kvs(std::vector<KeyValueType> &v) const {
-        // read bitmap
-        // get all valid kvs
-        // check the bitmap again, read everything again until bitmap matches
-        uint64_t bitmap2[BITMAP_SIZE];
+        // read all valid kvs, and read again if the bucket was modified in the meantime
+        uint16_t version;
         do {
-            memcpy(bitmap2, bitmap_, sizeof(bitmap_));
+            version = version_.read_begin();
             v.clear();
             for (int i = 0; i < SIZE; i++) {
                 if (valid(i)) {
                     v.push_back(list_.at(i));
                 }
             }
-        } while (memcmp(bitmap_, bitmap2, sizeof(bitmap_)) != 0);
+        } while (!version_.read_validate(version));
     } 
 
     /**
@@ -262,7 +349,7 @@ public:
      * @param start_key: the start key of the scan
      * @param scan_num: the number of kvs to be scanned
     */
-    void scan_kvs(std::vector<KeyValueType> &v, const T &start_key, int scan_num) {
+    void scan_kvs(std::vector<KeyValueType> &v, const T &start_key, int scan_num) const {
         std::priority_queue<KeyValueType> pq;
         
         for (int i = 0; i < SIZE; i++) {
@@ -284,6 +371,38 @@ public:
     }
 
 
+    /**
+     * Optimistic read of the bucket, against a concurrent writer calling insert()/update()
+     * read_begin() returns the version to pass to read_validate() after reading;
+     * if the validation fails, what was read may be torn and must be read again
+    */
+    inline uint16_t read_begin() const { return version_.read_begin(); }
+    inline bool read_validate(uint16_t version) const { return version_.read_validate(version); }
+    inline uint16_t get_version() const { return version_.get_version(); }
+
+    /**
+     * Writer lock of the D-Bucket, for concurrent writers (see VersionLock)
+     * lock() returns false if the bucket is obsolete, i.e., it was split and replaced in the index
+    */
+    inline bool lock() { return version_.lock(); }
+    inline void unlock() { version_.unlock(); }
+    inline void mark_obsolete() { version_.mark_obsolete(); }
+
+    /**
+     * Access counter of the D-Bucket, for the eviction of tiered storage (see BuckIndex::enable_tiering())
+     * touch() counts an access, saturating; age() halves the count, and returns it as it was before.
+     * Concurrent readers may lose increments: the count is only a hint
+    */
+    inline void touch() {
+        uint8_t count = __atomic_load_n(&access_count_, __ATOMIC_RELAXED);
+        if (count < UINT8_MAX) __atomic_store_n(&access_count_, uint8_t(count + 1), __ATOMIC_RELAXED);
+    }
+    inline uint8_t age() {
+        uint8_t count = __atomic_load_n(&access_count_, __ATOMIC_RELAXED);
+        __atomic_store_n(&access_count_, uint8_t(count / 2), __ATOMIC_RELAXED);
+        return count;
+    }
+
     inline T get_pivot() const { return pivot_; }
     inline void set_pivot(T pivot) { pivot_ = pivot; }
 
@@ -296,6 +415,16 @@ public:
 
     inline KeyValueType at(int pos) const { return list_.at(pos); }
 
+    /**
+     * Replace the value of a valid entry, keeping its key and slot
+     * e.g., the child pointers of an S-Bucket are relocated when a snapshot is loaded
+     * NOTE: not synchronized with concurrent readers
+    */
+    inline void set_value(int pos, V value) {
+        assert(valid(pos));
+        list_.put(pos, list_.at(pos).key_, value);
+    }
+
     /**
      * Find the kth smallest element with 1-based index
      * @param k: the 1-based index of the element to be found
@@ -309,7 +438,7 @@ public:
      * @return the position of the empty slot
     */
     inline int find_empty_slot(size_t hint) const {
-        assert(hint < SIZE);
+        assert(hint < capacity());
         const size_t start = hint / BITS_UINT64_T;
         const uint64_t mask = (1ull << (hint - start * BITS_UINT64_T)) - 1ull; // [start, hint) are 1, [hint, end) are 0, from LSB
 
@@ -318,7 +447,7 @@ public:
             if (masked == UINT64_MAX) continue; // all bits are 1 (occupied)
             int pos = __builtin_ctzll(~masked);
             pos = l * BITS_UINT64_T + pos;
-            if (pos < SIZE) return pos;
+            if (pos < capacity()) return pos;
         }
 
         // Not found yet, need to check [start, hint) again, without mask this time
@@ -327,7 +456,7 @@ public:
         if (masked == UINT64_MAX) return -1; // all bits are 1 (occupied)
         int pos = __builtin_ctzll(~masked);
         pos = l * BITS_UINT64_T + pos;
-        if (pos < SIZE) return pos;
+        if (pos < capacity()) return pos;
 
         return -1; // no empty slot
     }
@@ -368,10 +497,16 @@ public:
 private:
     LISTTYPE list_;
     T pivot_;
-    int num_keys_;
+    uint16_t num_keys_;
+    uint16_t probe_sum_; // saturating sum of (slot - hint) over all insertions
+    uint8_t hint_type_; // HintType of the D-Bucket
+    uint8_t access_count_; // see touch(); fills the padding before version_
+    VersionLock<uint16_t> version_; // bumped by insert() and update(); see read_begin()
+    static_assert(SIZE <= UINT16_MAX, "num_keys_ is 16-bit");
     
     uint64_t bitmap_[SIZE/BITS_UINT64_T + (SIZE % BITS_UINT64_T ? 1 : 0)];  //indicate whether the entries in the list_ are valid.
-    size_t BITMAP_SIZE = SIZE/BITS_UINT64_T + (SIZE % BITS_UINT64_T ? 1 : 0);
+    static constexpr size_t BITMAP_SIZE = SIZE/BITS_UINT64_T + (SIZE % BITS_UINT64_T ? 1 : 0);
+    T hint_end_; // exclusive upper end of the key range used by model-based hints
    
     // alignas(64) T pivot_;
     // alignas(64) LISTTYPE list_;
@@ -392,17 +527,106 @@ private:
      * @param pos: the starting position of the keys to be loaded
     */
     inline __m256i SIMD_load_keys(const KeyValueList<T, V, SIZE>& list, int pos) const;
+
+    /**
+     * SIMD_lookup() of narrowed keys: 8 offsets per comparison, or 4 keys if they fall back to full width
+    */
+    bool SIMD_lookup_offsets(const T &key, V& value, size_t hint) const;
+
+    /**
+     * Make a list of narrowed keys able to store key, if it does not fit: move the base, if the range of the keys
+     * allows it, or fall back to full-width keys, if they fit in half of the slots
+     * The valid slots may move; the version is bumped
+     * @return false if the key does not fit even so; the bucket is unchanged
+    */
+    bool make_room(const T &key) {
+        T lo = key, hi = key;
+        for (int i = 0; i < SIZE; i++) {
+            if (valid(i)) {
+                lo = std::min(lo, list_.key_at(i));
+                hi = std::max(hi, list_.key_at(i));
+            }
+        }
+        if (!LISTTYPE::narrow_range(lo, hi) && num_keys_ >= SIZE / 2) return false;
+
+        version_.write_begin();
+        if (LISTTYPE::narrow_range(lo, hi)) {
+            list_.rebase(lo);
+        } else { // pack the pairs into the first slots
+            KeyValueType kvs[SIZE / 2];
+            int n = 0;
+            for (int i = 0; i < SIZE; i++) {
+                if (valid(i)) kvs[n++] = list_.at(i);
+            }
+            memset(bitmap_, 0, sizeof(bitmap_));
+            num_keys_ = 0;
+            list_.reset_wide();
+            for (int i = 0; i < n; i++) {
+                list_.put(i, kvs[i]);
+                validate(i);
+            }
+        }
+        version_.write_end();
+        return true;
+    }
+
+    /**
+     * Partition the pairs of a list of narrowed keys and kv for split_and_insert(), in key order, as close to the
+     * median as both parts fit into a bucket: a part whose range overflows 32 bits holds at most SIZE / 2 pairs.
+     * A partition with both parts in 32-bit ranges comes first, so outliers do not take dense keys to full width
+    */
+    void split_fitting(const KeyValueType &kv, std::vector<KeyValueType> &lower_kvs,
+                       std::vector<KeyValueType> &upper_kvs) const {
+        std::vector<KeyValueType> kvs;
+        get_valid_kvs(kvs);
+        kvs.push_back(kv);
+        std::sort(kvs.begin(), kvs.end());
+        size_t n = kvs.size();
+        auto fits = [&kvs](size_t begin, size_t end, bool narrow) {
+            if (end - begin > SIZE) return false;
+            if (LISTTYPE::narrow_range(kvs[begin].key_, kvs[end - 1].key_)) return true;
+            return !narrow && end - begin <= SIZE / 2;
+        };
+        // a key that does not fit alone in the bucket is the smallest or the largest: it can go on its own
+        for (bool narrow : {true, false}) {
+            for (size_t d = 0; d < n; d++) {
+                for (size_t p : {n / 2 - std::min(d, n / 2), n / 2 + d}) {
+                    if (p == 0 || p >= n || !fits(0, p, narrow) || !fits(p, n, narrow)) continue;
+                    lower_kvs.assign(kvs.begin(), kvs.begin() + p);
+                    upper_kvs.assign(kvs.begin() + p, kvs.end());
+                    return;
+                }
+            }
+        }
+        assert(false);
+    }
+
+    // place a key at the first free slot from hint in a simulated bitmap; return the probe distance
+    static inline size_t simulate_probe(bool *used, size_t hint) {
+        for (size_t i = 0; i < SIZE; i++) {
+            size_t pos = (hint + i) % SIZE;
+            if (!used[pos]) {
+                used[pos] = true;
+                return i;
+            }
+        }
+        return SIZE;
+    }
 };
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-bool Bucket<LISTTYPE, T, V, SIZE>::lookup(const T &key, V &value, size_t hint) const {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+bool Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::lookup(const T &key, V &value, size_t hint) const {
     // must be D-Bucket
     //assert((std::is_same<LISTTYPE, KeyListValueList<T, V, SIZE>>()));
     assert(hint < SIZE);
 
-#ifdef BUCKINDEX_USE_SIMD
-    return SIMD_lookup(key, value, hint);
-#else
+    if constexpr (SearchKernel::use_simd) {
+        return SIMD_lookup(key, value, hint);
+    }
+    if constexpr (KEY_OFFSETS) {
+        if (!list_.fits(key)) return false; // out of the range of the bucket
+    }
+
     for (int i = 0, l = hint; i < SIZE; i++, l = (l+1) % SIZE) {
         // if (list_.at(l).key_ == key) {
         if (valid(l) && list_.at(l).key_ == key) {
@@ -413,23 +637,25 @@ bool Bucket<LISTTYPE, T, V, SIZE>::lookup(const T &key, V &value, size_t hint) c
     }
 
     return false;
-#endif
 }
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-bool Bucket<LISTTYPE, T, V, SIZE>::lb_lookup(const T &key, KeyValueType &lb_kv, KeyValueType &next_kv) const {
-    T target_key = std::numeric_limits<T>::min();
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+bool Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::lb_lookup(const T &key, KeyValueType &lb_kv, KeyValueType &next_kv) const {
+    // only the keys are read in the scan, e.g., a single cache line of an S-Bucket with contiguous keys
+    T target_key = std::numeric_limits<T>::min(), next_key = std::numeric_limits<T>::max();
     int lb_pos = -1, next_pos = -1;
     for (int i = 0; i < SIZE; i++) {
-        if (valid(i) && list_.at(i).key_ <= key && list_.at(i).key_ >= target_key) {
-            target_key = list_.at(i).key_;
-            lb_pos = i;
-        }
-// #ifdef HINT_MODEL_PREDICT
-        if (valid(i) && list_.at(i).key_ > key && (next_pos == -1 || list_.at(i).key_ < list_.at(next_pos).key_)) {
+        if (!valid(i)) continue;
+        T k = list_.key_at(i);
+        if (k <= key) {
+            if (k >= target_key) {
+                target_key = k;
+                lb_pos = i;
+            }
+        } else if (next_pos == -1 || k < next_key) {
+            next_key = k;
             next_pos = i;
         }
-// #endif
     }
 
     if (lb_pos == -1) return false;
@@ -447,22 +673,31 @@ bool Bucket<LISTTYPE, T, V, SIZE>::lb_lookup(const T &key, KeyValueType &lb_kv,
 }
 
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-bool Bucket<LISTTYPE, T, V, SIZE>::insert(const KeyValueType &kv, bool update_pivot, size_t hint) {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+bool Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::insert(const KeyValueType &kv, bool update_pivot, size_t hint) {
+    if constexpr (KEY_OFFSETS) {
+        if (!list_.fits(kv.key_) && !make_room(kv.key_)) return false;
+        hint %= list_.capacity();
+    }
     int pos = find_empty_slot(hint);
     if (pos == -1 || pos >= SIZE) return false; // return false if the Bucket is already full
+    version_.write_begin();
     list_.put(pos, kv.key_, kv.value_);
     validate(pos);
 
+    size_t dist = (pos + SIZE - hint) % SIZE;
+    probe_sum_ = (uint16_t)std::min<size_t>(probe_sum_ + dist, UINT16_MAX);
+
     if (update_pivot && kv.key_ < pivot_) {
         pivot_ = kv.key_;
     }
+    version_.write_end();
 
     return true;
 }
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-KeyValue<T, V> Bucket<LISTTYPE, T, V, SIZE>::find_kth_smallest(int k) const {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+KeyValue<T, V> Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::find_kth_smallest(int k) const {
     int n = num_keys();
     k--;
     assert(k >= 0 && k < n);
@@ -475,13 +710,13 @@ KeyValue<T, V> Bucket<LISTTYPE, T, V, SIZE>::find_kth_smallest(int k) const {
     return valid_kvs[k];
 }
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-inline __m256i Bucket<LISTTYPE, T, V, SIZE>::SIMD_load_keys(const KeyListValueList<T, V, SIZE>& list, int pos) const {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+inline __m256i Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::SIMD_load_keys(const KeyListValueList<T, V, SIZE>& list, int pos) const {
     return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&list.keys_[pos]));
 }
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-inline __m256i Bucket<LISTTYPE, T, V, SIZE>::SIMD_load_keys(const KeyValueList<T, V, SIZE>& list, int pos) const {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+inline __m256i Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::SIMD_load_keys(const KeyValueList<T, V, SIZE>& list, int pos) const {
     assert(false); // KeyValueList does not support SIMD_lookup
     return __m256i();
 
@@ -521,55 +756,91 @@ inline void print_m256i_bits(const __m256i &key_vector) {
 }
 
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-bool Bucket<LISTTYPE, T, V, SIZE>::SIMD_lookup(const T &key, V &value, size_t hint) const {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+bool Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::SIMD_lookup(const T &key, V &value, size_t hint) const {
     // We only support D-bucket; S-Bucket always calls SIMD_lb_lookup instead of SIMD_lookup
     //assert((std::is_same<LISTTYPE, KeyListValueList<T, V, SIZE>>::value));
-
-    constexpr size_t SIMD_WIDTH = 256 / sizeof(T) / 8; // the number of keys in a 256-bit SIMD register
-    __m256i key_vector;
-    if constexpr (sizeof(T) == 4) key_vector = _mm256_set1_epi32(key); // 32-bit integer, repeat key 8 times
-    else if constexpr(sizeof(T) == 8) key_vector = _mm256_set1_epi64x(key); // 64-bit integer, repeat key 4 times
+    if constexpr (KEY_OFFSETS) return SIMD_lookup_offsets(key, value, hint);
+    else {
+        constexpr size_t SIMD_WIDTH = 256 / sizeof(T) / 8; // the number of keys in a 256-bit SIMD register
+        __m256i key_vector;
+        if constexpr (sizeof(T) == 4) key_vector = _mm256_set1_epi32(key); // 32-bit integer, repeat key 8 times
+        else if constexpr(sizeof(T) == 8) key_vector = _mm256_set1_epi64x(key); // 64-bit integer, repeat key 4 times
     
 
-    for (int i = 0, l = (hint / SIMD_WIDTH) * SIMD_WIDTH; i < SIZE; i += SIMD_WIDTH, l = (l + SIMD_WIDTH) % SIZE) {
-        __m256i keys = SIMD_load_keys(list_, l); // load 4 or 8 keys into a SIMD register
-        __m256i cmp;
-        if constexpr (sizeof(T) == 4) cmp = _mm256_cmpeq_epi32(keys, key_vector); // compare every 32 bits;
-                                                                                  // result bits start from LSB
-        else if constexpr (sizeof(T) == 8) cmp = _mm256_cmpeq_epi64(keys, key_vector); // compare every 64 bits;
-                                                                                       // result bits start from LSB
-
-        unsigned char mask; // there are either 4 or 8 bits in the mask, so unsigned char is enough
-        if constexpr(sizeof(T) == 4) mask = _mm256_movemask_ps((__m256)cmp); // 8 bits in the mask, for 32-bit integer
-        else if constexpr(sizeof(T) == 8) mask = _mm256_movemask_pd((__m256d)cmp); // 4 bits in the mask, for 64-bit integer
+        for (int i = 0, l = (hint / SIMD_WIDTH) * SIMD_WIDTH; i < SIZE; i += SIMD_WIDTH, l = (l + SIMD_WIDTH) % SIZE) {
+            __m256i keys = SIMD_load_keys(list_, l); // load 4 or 8 keys into a SIMD register
+            __m256i cmp;
+            if constexpr (sizeof(T) == 4) cmp = _mm256_cmpeq_epi32(keys, key_vector); // compare every 32 bits;
+                                                                                      // result bits start from LSB
+            else if constexpr (sizeof(T) == 8) cmp = _mm256_cmpeq_epi64(keys, key_vector); // compare every 64 bits;
+                                                                                           // result bits start from LSB
+
+            unsigned char mask; // there are either 4 or 8 bits in the mask, so unsigned char is enough
+            if constexpr(sizeof(T) == 4) mask = _mm256_movemask_ps((__m256)cmp); // 8 bits in the mask, for 32-bit integer
+            else if constexpr(sizeof(T) == 8) mask = _mm256_movemask_pd((__m256d)cmp); // 4 bits in the mask, for 64-bit integer
         
-        int bitmap_pos = l / BITS_UINT64_T; // use bitmap_[bitmap_pos]
-        int bit_pos = l % BITS_UINT64_T; // pos from MSB
-        // get 8 bits from (bitmap_[bitmap_pos], bit_pos)
-        unsigned char valid_bits = (unsigned char)((bitmap_[bitmap_pos] >> bit_pos) & 0xFF);
+            int bitmap_pos = l / BITS_UINT64_T; // use bitmap_[bitmap_pos]
+            int bit_pos = l % BITS_UINT64_T; // pos from MSB
+            // get 8 bits from (bitmap_[bitmap_pos], bit_pos)
+            unsigned char valid_bits = (unsigned char)((bitmap_[bitmap_pos] >> bit_pos) & 0xFF);
 
-        mask &= valid_bits; // only keep the valid bits
-        if (mask == 0) continue; // no match in this SIMD register
+            mask &= valid_bits; // only keep the valid bits
+            if (mask == 0) continue; // no match in this SIMD register
 
-        int idx = l + __builtin_ctz(mask);
-        value = list_.at(idx).value_;
+            int idx = l + __builtin_ctz(mask);
+            value = list_.at(idx).value_;
 
-        //int dis = idx - hint;
-        //hint_dist_count[dis] = hint_dist_count[dis] + 1;
-        // hint_dist_count[i/SIMD_WIDTH] = hint_dist_count[i/SIMD_WIDTH] + 1;
-        return true;
+            //int dis = idx - hint;
+            //hint_dist_count[dis] = hint_dist_count[dis] + 1;
+            // hint_dist_count[i/SIMD_WIDTH] = hint_dist_count[i/SIMD_WIDTH] + 1;
+            return true;
+        }
+
+        // assert(false); // should not reach here
+
+        return false;
     }
+}
 
-    // assert(false); // should not reach here
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+bool Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::SIMD_lookup_offsets(const T &key, V &value, size_t hint) const {
+    static_assert(SIZE % 8 == 0, "8 offsets or 4 keys are compared at a time");
+    if (!list_.fits(key)) return false; // out of the range of the bucket
+
+    if (list_.wide()) { // 4 keys in the first SIZE / 2 slots
+        constexpr size_t SIMD_WIDTH = 4;
+        __m256i key_vector = _mm256_set1_epi64x(key);
+        for (size_t i = 0, l = (hint % (SIZE / 2)) / SIMD_WIDTH * SIMD_WIDTH; i < SIZE / 2;
+             i += SIMD_WIDTH, l = (l + SIMD_WIDTH) % (SIZE / 2)) {
+            __m256i keys = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&list_.keys_[l]));
+            unsigned char mask = _mm256_movemask_pd((__m256d)_mm256_cmpeq_epi64(keys, key_vector));
+            mask &= (unsigned char)((bitmap_[l / BITS_UINT64_T] >> (l % BITS_UINT64_T)) & 0xF);
+            if (mask == 0) continue;
+            value = list_.values_[l + __builtin_ctz(mask)];
+            return true;
+        }
+        return false;
+    }
 
+    // 8 offsets from the base
+    constexpr size_t SIMD_WIDTH = 8;
+    __m256i key_vector = _mm256_set1_epi32((int)(uint64_t(key) - uint64_t(list_.base())));
+    for (size_t i = 0, l = (hint / SIMD_WIDTH) * SIMD_WIDTH; i < SIZE; i += SIMD_WIDTH, l = (l + SIMD_WIDTH) % SIZE) {
+        __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&list_.offsets_[l]));
+        unsigned char mask = _mm256_movemask_ps((__m256)_mm256_cmpeq_epi32(offsets, key_vector));
+        mask &= (unsigned char)((bitmap_[l / BITS_UINT64_T] >> (l % BITS_UINT64_T)) & 0xFF);
+        if (mask == 0) continue;
+        value = list_.values_[l + __builtin_ctz(mask)];
+        return true;
+    }
     return false;
 }
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-class Bucket<LISTTYPE, T, V, SIZE>::UnsortedIterator {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+class Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::UnsortedIterator {
 public:
-    using BucketType = Bucket<LISTTYPE, T, V, SIZE>;
+    using BucketType = Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>;
 
     explicit UnsortedIterator(BucketType *bucket) : bucket_(bucket) {
         assert(bucket_ != nullptr);
@@ -619,10 +890,10 @@ private:
     }
   };
 
-template<class LISTTYPE, typename T, typename V, size_t SIZE>
-class Bucket<LISTTYPE, T, V, SIZE>::SortedIterator {
+template<class LISTTYPE, typename T, typename V, size_t SIZE, typename HintPolicy, typename SearchKernel>
+class Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>::SortedIterator {
 public:
-    using BucketType = Bucket<LISTTYPE, T, V, SIZE>;
+    using BucketType = Bucket<LISTTYPE, T, V, SIZE, HintPolicy, SearchKernel>;
 
     explicit SortedIterator(BucketType *bucket) : bucket_(bucket) {
         assert(bucket_ != nullptr);
@@ -636,12 +907,6 @@ public:
         assert(pos >= 0 && pos <= valid_kvs_.size());
         cur_pos_ = pos;
         sort(valid_kvs_.begin(), valid_kvs_.end());
-#ifdef BUCKINDEX_DEBUG
-        std::cout << "In SortedIterator: valid_kvs_.size() = " << valid_kvs_.size() << " pos = " << pos << std::endl;
-        if (valid_kvs_.size() > 0) {
-            std::cout << "In SortedIterator: min = " << valid_kvs_.front().key_ << ", max = " << valid_kvs_.back().key_ << std::endl;
-        }
-#endif
     }
 
     SortedIterator(BucketType *bucket, int pos, std::vector<KeyValueType> &valid_kvs) : bucket_(bucket), valid_kvs_(valid_kvs) {
@@ -0,0 +1,199 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+#include<cassert>
+#include<algorithm>
+#include<new>
+#include<type_traits>
+#include<vector>
+
+#include "keyvalue.h"
+#include "node_arena.h"
+
+namespace buckindex {
+
+/**
+ * CompressedBucket: the read-only compressed form of a cold D-Bucket (see BuckIndex::compress_cold())
+ * The pairs are sorted by key. The keys are stored frame-of-reference: their offsets from the first key, bit-packed
+ * with the width of the largest offset. The values are bit-packed either frame-of-reference (offsets from the
+ * smallest value), or delta-encoded (the differences of consecutive values) if the values do not decrease with
+ * the keys and the differences are narrower, e.g., for row ids.
+ * A lookup binary-searches the packed keys in place; decompress() rebuilds the slotted D-Bucket.
+ * The packed words follow the header in the same block (see create()); the block is immutable
+ */
+template<typename T, typename V>
+class alignas(uint64_t) CompressedBucket { // the packed words are aligned
+public:
+    using KeyValueType = KeyValue<T, V>;
+    using BucketType = CompressedBucket<T, V>;
+
+    /**
+     * Allocate and fill a compressed bucket from the arena
+     * @param kvs: the pairs, sorted by key, with unique keys
+     * @param pivot: the pivot of the D-Bucket
+     * @param hint_end: the hint range end of the D-Bucket, restored by decompress()
+     * @return the compressed bucket; release it with destroy()
+     */
+    static BucketType* create(NodeArena &arena, const std::vector<KeyValueType> &kvs, T pivot, T hint_end) {
+        static_assert(std::is_integral<T>::value && std::is_integral<V>::value,
+                      "frame-of-reference needs integer keys and values");
+        size_t n = kvs.size();
+        uint64_t key_range = n ? uint64_t(kvs.back().key_) - uint64_t(kvs.front().key_) : 0;
+        V min_value = 0;
+        uint64_t max_delta = 0;
+        bool increasing = true;
+        for (size_t i = 0; i < n; i++) {
+            if (i == 0 || kvs[i].value_ < min_value) min_value = kvs[i].value_;
+            if (i > 0) {
+                if (kvs[i].value_ < kvs[i-1].value_) increasing = false;
+                else max_delta = std::max(max_delta, uint64_t(kvs[i].value_) - uint64_t(kvs[i-1].value_));
+            }
+        }
+        uint64_t value_range = 0;
+        for (size_t i = 0; i < n; i++) value_range = std::max(value_range, uint64_t(kvs[i].value_) - uint64_t(min_value));
+
+        uint8_t key_bits = bit_width(key_range);
+        bool value_delta = increasing && bit_width(max_delta) < bit_width(value_range);
+        uint8_t value_bits = bit_width(value_delta ? max_delta : value_range);
+        size_t key_words = num_words(n, key_bits);
+        size_t alloc_size = sizeof(BucketType) + (key_words + num_words(n, value_bits)) * sizeof(uint64_t);
+
+        BucketType *bucket = new (arena.allocate(alloc_size)) BucketType();
+        bucket->pivot_ = pivot;
+        bucket->hint_end_ = hint_end;
+        bucket->key_base_ = n ? kvs.front().key_ : pivot;
+        bucket->value_base_ = n && value_delta ? kvs.front().value_ : min_value;
+        bucket->num_keys_ = n;
+        bucket->key_bits_ = key_bits;
+        bucket->value_bits_ = value_bits;
+        bucket->value_delta_ = value_delta;
+        bucket->alloc_size_ = alloc_size;
+
+        uint64_t *words = bucket->words();
+        std::fill(words, words + (alloc_size - sizeof(BucketType)) / sizeof(uint64_t), 0);
+        uint64_t *value_words = words + key_words;
+        for (size_t i = 0; i < n; i++) {
+            put_bits(words, i, key_bits, uint64_t(kvs[i].key_) - uint64_t(bucket->key_base_));
+            uint64_t v = value_delta ? (i ? uint64_t(kvs[i].value_) - uint64_t(kvs[i-1].value_) : 0)
+                                     : uint64_t(kvs[i].value_) - uint64_t(min_value);
+            put_bits(value_words, i, value_bits, v);
+        }
+        return bucket;
+    }
+
+    /**
+     * Destroy a compressed bucket allocated by create(), and return its block to the arena
+     */
+    static void destroy(NodeArena &arena, BucketType *bucket) {
+        size_t alloc_size = bucket->alloc_size_;
+        bucket->~BucketType();
+        arena.deallocate(bucket, alloc_size);
+    }
+
+    /**
+     * Lookup
+     * @param key: the key to be looked up
+     * @param value: the value of the key
+     * @return true if the key is found; false otherwise
+     */
+    bool lookup(const T &key, V &value) const {
+        if (num_keys_ == 0 || key < key_base_) return false;
+        uint64_t offset = uint64_t(key) - uint64_t(key_base_);
+        // lower bound of offset in the packed keys
+        size_t lo = 0, hi = num_keys_;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (get_bits(words(), mid, key_bits_) < offset) lo = mid + 1;
+            else hi = mid;
+        }
+        if (lo == num_keys_ || get_bits(words(), lo, key_bits_) != offset) return false;
+        value = value_at(lo);
+        return true;
+    }
+
+    /**
+     * Get all key-value pairs, sorted by key
+     * @param kvs: the vector to store the key-value pairs
+     */
+    void get_kvs(std::vector<KeyValueType> &kvs) const {
+        kvs.resize(num_keys_);
+        const uint64_t *value_words = words() + num_words(num_keys_, key_bits_);
+        uint64_t value = uint64_t(value_base_);
+        for (size_t i = 0; i < num_keys_; i++) {
+            uint64_t v = get_bits(value_words, i, value_bits_);
+            value = value_delta_ ? value + v : uint64_t(value_base_) + v;
+            kvs[i] = KeyValueType(T(uint64_t(key_base_) + get_bits(words(), i, key_bits_)), V(value));
+        }
+    }
+
+    /**
+     * Fill an empty D-Bucket with the pairs, as it was before the compression
+     * @param bucket: the D-Bucket (see Bucket::rebuild())
+     */
+    template<typename DataBucketType>
+    void decompress(DataBucketType &bucket) const {
+        std::vector<KeyValueType> kvs;
+        get_kvs(kvs);
+        bucket.rebuild(kvs.begin(), kvs.end(), pivot_, hint_end_);
+    }
+
+    inline size_t num_keys() const { return num_keys_; }
+    inline T get_pivot() const { return pivot_; }
+
+    /**
+     * @return the size of the block, header included
+     */
+    inline size_t mem_size() const { return alloc_size_; }
+
+private:
+    CompressedBucket() {}
+
+    V value_at(size_t pos) const {
+        const uint64_t *value_words = words() + num_words(num_keys_, key_bits_);
+        if (!value_delta_) return V(uint64_t(value_base_) + get_bits(value_words, pos, value_bits_));
+        uint64_t value = uint64_t(value_base_);
+        for (size_t i = 1; i <= pos; i++) value += get_bits(value_words, i, value_bits_);
+        return V(value);
+    }
+
+    uint64_t* words() { return reinterpret_cast<uint64_t *>(this + 1); }
+    const uint64_t* words() const { return reinterpret_cast<const uint64_t *>(this + 1); }
+
+    // the number of bits of x; 0 for 0
+    static uint8_t bit_width(uint64_t x) { return x ? 64 - __builtin_clzll(x) : 0; }
+
+    static size_t num_words(size_t n, uint8_t bits) { return (n * bits + 63) / 64; }
+
+    // the index-th field of bits bits
+    static inline uint64_t get_bits(const uint64_t *words, size_t index, uint8_t bits) {
+        if (bits == 0) return 0;
+        size_t bit = index * bits;
+        size_t w = bit / 64;
+        unsigned shift = bit % 64;
+        uint64_t x = words[w] >> shift;
+        if (shift + bits > 64) x |= words[w + 1] << (64 - shift);
+        return bits == 64 ? x : x & ((1ull << bits) - 1);
+    }
+
+    static inline void put_bits(uint64_t *words, size_t index, uint8_t bits, uint64_t x) {
+        if (bits == 0) return;
+        size_t bit = index * bits;
+        size_t w = bit / 64;
+        unsigned shift = bit % 64;
+        words[w] |= x << shift;
+        if (shift + bits > 64) words[w + 1] |= x >> (64 - shift);
+    }
+
+    T pivot_;
+    T hint_end_;
+    T key_base_; // the first key
+    V value_base_; // the first value if value_delta_, else the smallest value
+    uint32_t alloc_size_;
+    uint16_t num_keys_;
+    uint8_t key_bits_;
+    uint8_t value_bits_;
+    bool value_delta_;
+};
+
+} // end namespace buckindex
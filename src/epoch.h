@@ -0,0 +1,191 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+#include<cassert>
+#include<algorithm>
+#include<atomic>
+#include<deque>
+#include<functional>
+#include<limits>
+#include<memory>
+#include<mutex>
+#include<thread>
+
+namespace buckindex {
+
+class EpochManager;
+
+/**
+ * EpochGuard: RAII pin of the current epoch by a reader
+ * While a guard is alive, the nodes reachable at the time it was created are not reclaimed
+ */
+class EpochGuard {
+public:
+    EpochGuard() : manager_(nullptr), slot_(0) {}
+    EpochGuard(EpochManager *manager, size_t slot) : manager_(manager), slot_(slot) {}
+    EpochGuard(EpochGuard &&other) : manager_(other.manager_), slot_(other.slot_) { other.manager_ = nullptr; }
+    EpochGuard& operator=(EpochGuard &&other);
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+    ~EpochGuard() { release(); }
+
+    /**
+     * Unpin the epoch before the guard goes out of scope
+     */
+    inline void release();
+
+private:
+    EpochManager *manager_;
+    size_t slot_;
+};
+
+/**
+ * EpochManager: epoch-based reclamation of the nodes removed from the index
+ * Readers pin the global epoch in a slot (one CAS) for the duration of an operation.
+ * The writer unlinks a node from the index, then retires it: the node is tagged with the global epoch,
+ * which is advanced, and the node is freed once every pinned epoch is newer than its tag, i.e., once
+ * no reader that could have seen it is still active.
+ * A reader pinning epoch e reads the global epoch after every node retired with a tag < e was unlinked,
+ * so it can not reach them.
+ */
+class EpochManager {
+public:
+    static constexpr size_t MAX_SLOTS = 128; // max concurrent readers; more readers wait for a free slot
+    static constexpr size_t RECLAIM_THRESHOLD = 64; // retired nodes that trigger a reclamation
+    static constexpr uint64_t INACTIVE = std::numeric_limits<uint64_t>::max();
+
+    using Deleter = std::function<void(void *)>;
+
+    EpochManager() : global_epoch_(1), slots_(new Slot[MAX_SLOTS]) {
+        for (size_t i = 0; i < MAX_SLOTS; i++) slots_[i].epoch.store(INACTIVE, std::memory_order_relaxed);
+    }
+
+    EpochManager(const EpochManager&) = delete;
+    EpochManager& operator=(const EpochManager&) = delete;
+
+    // the owner must make sure no reader is active
+    ~EpochManager() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto &node : retired_) node.deleter(node.ptr);
+        retired_.clear();
+    }
+
+    /**
+     * Pin the current epoch
+     * @return the guard that unpins it
+     */
+    EpochGuard enter() {
+        thread_local size_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+        while (true) {
+            for (size_t i = 0; i < MAX_SLOTS; i++) {
+                size_t slot = (hint + i) % MAX_SLOTS;
+                uint64_t expected = INACTIVE;
+                uint64_t epoch = global_epoch_.load();
+                // seq_cst: the pin is visible to the writer before this reader reads the index
+                if (slots_[slot].epoch.load(std::memory_order_relaxed) == INACTIVE &&
+                    slots_[slot].epoch.compare_exchange_strong(expected, epoch)) {
+                    hint = slot;
+                    return EpochGuard(this, slot);
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Unpin an epoch; called by EpochGuard
+     */
+    void exit(size_t slot) {
+        assert(slots_[slot].epoch.load(std::memory_order_relaxed) != INACTIVE);
+        slots_[slot].epoch.store(INACTIVE, std::memory_order_release);
+    }
+
+    /**
+     * Retire a node that has been unlinked from the index
+     * @param ptr: the node
+     * @param deleter: frees the node once no reader can see it
+     */
+    void retire(void *ptr, Deleter deleter) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // advancing the epoch makes the readers arriving from now on not block the reclamation of ptr
+        retired_.push_back(RetiredNode{global_epoch_.fetch_add(1), ptr, std::move(deleter)});
+        if (retired_.size() >= RECLAIM_THRESHOLD) reclaim_locked();
+    }
+
+    /**
+     * Free the retired nodes that no active reader can see
+     * @return the number of nodes freed
+     */
+    size_t reclaim() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return reclaim_locked();
+    }
+
+    /**
+     * @return the number of retired nodes not freed yet
+     */
+    size_t num_retired() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return retired_.size();
+    }
+
+    /**
+     * @return the current global epoch
+     */
+    uint64_t get_epoch() const { return global_epoch_.load(); }
+
+private:
+    struct RetiredNode {
+        uint64_t epoch; // the global epoch when the node was retired
+        void *ptr;
+        Deleter deleter;
+    };
+
+    struct alignas(64) Slot { // one cache line per reader slot
+        std::atomic<uint64_t> epoch; // the pinned epoch; INACTIVE if the slot is free
+    };
+
+    // NOTE: mutex_ must be held
+    size_t reclaim_locked() {
+        // pairs with the CAS in enter(): either the scan sees the pin, or the reader sees the unlinks
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t min_epoch = INACTIVE;
+        for (size_t i = 0; i < MAX_SLOTS; i++) {
+            min_epoch = std::min(min_epoch, slots_[i].epoch.load(std::memory_order_acquire));
+        }
+
+        // nodes are retired in epoch order
+        size_t num_freed = 0;
+        while (!retired_.empty() && retired_.front().epoch < min_epoch) {
+            retired_.front().deleter(retired_.front().ptr);
+            retired_.pop_front();
+            num_freed++;
+        }
+        return num_freed;
+    }
+
+    std::atomic<uint64_t> global_epoch_;
+    std::unique_ptr<Slot[]> slots_; // on the heap, to keep the owner small
+    std::mutex mutex_; // protects retired_
+    std::deque<RetiredNode> retired_;
+};
+
+inline void EpochGuard::release() {
+    if (manager_ != nullptr) {
+        manager_->exit(slot_);
+        manager_ = nullptr;
+    }
+}
+
+inline EpochGuard& EpochGuard::operator=(EpochGuard &&other) {
+    if (this != &other) {
+        release();
+        manager_ = other.manager_;
+        slot_ = other.slot_;
+        other.manager_ = nullptr;
+    }
+    return *this;
+}
+
+} // end namespace buckindex
@@ -0,0 +1,83 @@
+#pragma once
+
+#include<cstdint>
+#include<atomic>
+#include<climits>
+#include<thread>
+#include<unistd.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+
+#include "atomic_queue/defs.h"
+
+namespace buckindex {
+
+/**
+ * EventCount: lets a thread block until a condition on shared state holds, without a mutex
+ * The waiter spins for a while (the condition usually becomes true soon under load), then sleeps in the kernel
+ * (futex), so an idle thread uses no CPU. The notifier only makes a syscall if a thread is asleep.
+ * Protocol of the notifier: make the condition true, then notify_all().
+ * Protocol of the waiter: see await(); a notification between the check of the condition and the sleep
+ * changes the epoch, so the futex does not sleep and the wakeup is not lost.
+ * NOTE: notify_all() wakes all the sleepers, which re-check their conditions; use one EventCount per
+ * group of waiters that usually wait for the same event.
+ */
+class EventCount {
+public:
+    static constexpr int SPIN_COUNT = 256; // pause iterations before sleeping
+    static constexpr int YIELD_COUNT = 4; // yields before sleeping
+
+    EventCount() : epoch_(0), num_waiters_(0) {}
+    EventCount(const EventCount&) = delete;
+    EventCount& operator=(const EventCount&) = delete;
+
+    /**
+     * Wake the threads waiting for a condition that was just made true
+     */
+    inline void notify_all() {
+        // pairs with the fetch_add in await(): either the waiter sees the condition, or this sees the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (num_waiters_.load(std::memory_order_relaxed) == 0) return;
+        epoch_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    /**
+     * Wait until condition() returns true
+     * @param condition: the condition; called repeatedly, from the waiting thread
+     */
+    template<typename Condition>
+    inline void await(Condition condition) {
+        for (int i = 0; i < SPIN_COUNT; i++) {
+            if (condition()) return;
+            atomic_queue::spin_loop_pause();
+        }
+        for (int i = 0; i < YIELD_COUNT; i++) {
+            if (condition()) return;
+            std::this_thread::yield();
+        }
+        while (true) {
+            num_waiters_.fetch_add(1, std::memory_order_seq_cst);
+            uint32_t epoch = epoch_.load(std::memory_order_acquire);
+            if (condition()) {
+                num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&epoch_), FUTEX_WAIT_PRIVATE, epoch, nullptr, nullptr, 0);
+            num_waiters_.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @return the number of threads asleep or about to sleep
+     */
+    inline uint32_t num_waiters() const { return num_waiters_.load(std::memory_order_relaxed); }
+
+private:
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "the futex word must be a plain 32-bit word");
+
+    std::atomic<uint32_t> epoch_; // the futex word; changed by each notification to sleepers
+    std::atomic<uint32_t> num_waiters_;
+};
+
+} // end namespace buckindex
@@ -0,0 +1,56 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+
+#include "linear_model.h"
+
+namespace buckindex {
+
+/**
+ * The frozen format: a read-only index laid out to be memory-mapped and served as is
+ * (written by BuckIndex::freeze(), read by MappedBuckIndex)
+ * [FrozenHeader] [D-Buckets, in key order] [segments of each model layer, bottom-up; the root is the last one]
+ * The D-Buckets and each segment start on a FROZEN_ALIGNMENT boundary. A segment is a FrozenSegment followed by
+ * its S-Buckets, then their dense pivots (see Segment::get_pivots()), which the lookups search with the bounded
+ * binary search of the mutable index. The values of the S-Buckets are the offsets of the children from the start of the file, so the
+ * file is position independent. Native byte order
+ */
+constexpr char FROZEN_MAGIC[8] = {'B', 'L', 'I', 'F', 'R', 'O', 'Z', 0};
+constexpr uint32_t FROZEN_VERSION = 3; // 2: S-Buckets with contiguous keys; 3: dense pivots and the model error
+constexpr uint32_t FROZEN_BYTE_ORDER = 0x01020304; // a frozen index is not portable across byte orders
+constexpr size_t FROZEN_ALIGNMENT = 64; // cache line
+
+struct FrozenHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t key_size; // sizeof(KeyType)
+    uint32_t value_size; // sizeof(ValueType)
+    uint32_t segment_bucket_size; // SEGMENT_BUCKET_SIZE
+    uint32_t data_bucket_size; // DATA_BUCKET_SIZE
+    uint32_t segment_bucket_bytes; // sizeof of an S-Bucket
+    uint32_t data_bucket_bytes; // sizeof of a D-Bucket
+    uint64_t num_keys;
+    uint64_t num_levels; // 0 for an empty index
+    uint64_t num_data_buckets;
+    uint64_t data_offset; // the offset of the first D-Bucket
+    uint64_t root_offset; // the offset of the root segment
+    uint64_t file_size;
+};
+
+template<typename T>
+struct FrozenSegment {
+    LinearModel<T> model;
+    uint64_t num_bucket;
+    uint64_t max_error; // the error of the model (see Segment::get_max_error())
+};
+
+/**
+ * @return offset rounded up to FROZEN_ALIGNMENT
+ */
+inline uint64_t frozen_align(uint64_t offset) {
+    return (offset + FROZEN_ALIGNMENT - 1) / FROZEN_ALIGNMENT * FROZEN_ALIGNMENT;
+}
+
+} // end namespace buckindex
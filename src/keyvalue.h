@@ -2,6 +2,7 @@
 
 #include<cstdint>
 #include<cstddef>
+#include<type_traits>
 
 namespace buckindex {
 
@@ -36,27 +37,103 @@ struct KeyValue
 };
 
 template<typename T, typename V, size_t SIZE> 
-class KeyListValueList { // KV list for S-Bucket // TBD: may not be used
+class KeyListValueList { // KV list for S-Bucket, and D-Bucket with SIMD lookups: the keys are contiguous
 public:
     T keys_[SIZE];
     V values_[SIZE];
 
     KeyValue<T,V> at(int pos) const { return KeyValue<T,V>(keys_[pos], values_[pos]); }
+    T key_at(int pos) const { return keys_[pos]; }
     // std::pair<T*, V*> get_kvptr(int pos) { return std::make_pair(&keys_[pos], &values_[pos]); }
     void put(int pos, T key, V value) { keys_[pos] = key; values_[pos] = value; }
     void put(int pos, KeyValue<T,V> kv) { keys_[pos] = kv.key_; values_[pos] = kv.value_; }
 };
 
 template<typename T, typename V, size_t SIZE>
-class KeyValueList { // KV list for S-Bucket and D-Bucket
+class KeyValueList { // KV list for D-Bucket
 public:
 
     KeyValue<T, V> kvs_[SIZE];
 
     KeyValue<T, V> at(int pos) const { return kvs_[pos]; }
+    T key_at(int pos) const { return kvs_[pos].key_; }
     // std::pair<T*, V*> get_kvptr(int pos) { return std::make_pair(&kvs_[pos].key_, &kvs_[pos].value_); }
     void put(int pos, T key, V value) { kvs_[pos].key_ = key; kvs_[pos].value_ = value; }
     void put(int pos, KeyValue<T,V> kv) { kvs_[pos] = kv; }
 };
 
+/**
+ * KV list for D-Bucket with narrowed keys: the keys are stored as 32-bit offsets from a base key, which halves the
+ * key footprint and doubles the keys per SIMD comparison (see Bucket::SIMD_lookup()).
+ * If the key range of the bucket does not fit in 32 bits, the list falls back to full-width keys, in the first
+ * half of the slots (see capacity()); the bucket picks the mode and moves the keys (see Bucket::make_room())
+ * NOTE: a key must fit (see fits()) before it is put
+ */
+template<typename T, typename V, size_t SIZE>
+class KeyOffsetListValueList {
+public:
+    static_assert(sizeof(T) == 8, "narrowed keys are for 64-bit keys");
+    using OffsetType = uint32_t;
+
+    T base_ = 0;
+    bool wide_ = false; // full-width keys in keys_
+    union {
+        OffsetType offsets_[SIZE];
+        T keys_[SIZE / 2];
+    };
+    V values_[SIZE];
+
+    KeyOffsetListValueList() {}
+
+    KeyValue<T,V> at(int pos) const { return KeyValue<T,V>(key_at(pos), values_[pos]); }
+    void put(int pos, T key, V value) {
+        if (wide_) keys_[pos] = key;
+        else offsets_[pos] = OffsetType(uint64_t(key) - uint64_t(base_));
+        values_[pos] = value;
+    }
+    void put(int pos, KeyValue<T,V> kv) { put(pos, kv.key_, kv.value_); }
+
+    inline T key_at(int pos) const { return wide_ ? keys_[pos] : T(uint64_t(base_) + offsets_[pos]); }
+
+    /**
+     * @return true if the keys in [lo, hi] can be stored as offsets from lo
+     */
+    static inline bool narrow_range(T lo, T hi) { return uint64_t(hi) - uint64_t(lo) <= UINT32_MAX; }
+
+    inline bool fits(T key) const { return wide_ || (key >= base_ && narrow_range(base_, key)); }
+    inline bool wide() const { return wide_; }
+    inline T base() const { return base_; }
+
+    /**
+     * @return the number of usable slots: all of them with offsets, the first half with full-width keys
+     */
+    inline size_t capacity() const { return wide_ ? SIZE / 2 : SIZE; }
+
+    /**
+     * Switch to offsets from base, with no valid slot
+     */
+    void reset_narrow(T base) { base_ = base; wide_ = false; }
+
+    /**
+     * Switch to full-width keys, with no valid slot
+     */
+    void reset_wide() { base_ = 0; wide_ = true; }
+
+    /**
+     * Move the base, keeping the keys of the slots
+     * NOTE: the valid keys must fit from new_base; the offsets wrap around, so the base may move either way
+     */
+    void rebase(T new_base) {
+        OffsetType delta = OffsetType(uint64_t(base_) - uint64_t(new_base));
+        for (size_t i = 0; i < SIZE; i++) offsets_[i] += delta;
+        base_ = new_base;
+    }
+};
+
+template<typename LISTTYPE>
+struct is_key_offset_list : std::false_type {};
+
+template<typename T, typename V, size_t SIZE>
+struct is_key_offset_list<KeyOffsetListValueList<T, V, SIZE>> : std::true_type {};
+
 }
@@ -0,0 +1,283 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+#include<cstdlib>
+#include<cassert>
+#include<atomic>
+#include<mutex>
+#include<new>
+#include<utility>
+#include<vector>
+#include<unordered_map>
+
+namespace buckindex {
+
+/**
+ * NodeArena: a size-class slab allocator for the index nodes (D-Buckets, Segments and S-Bucket arrays)
+ * Blocks are carved from large slabs, and freed blocks are recycled through free lists:
+ * each thread keeps a small private free list per size class, and spills to / refills from
+ * the shared free list of the arena when it gets too long / runs empty.
+ * All slabs are released at once when the arena is destroyed, so nodes living in the arena
+ * must not own any memory outside of it; their destructors are not called on teardown.
+ * Blocks larger than MAX_BLOCK_SIZE are allocated individually, but are also released on teardown.
+ */
+class NodeArena {
+public:
+    static constexpr size_t SLAB_SIZE = 2 << 20; // 2 MiB
+    static constexpr size_t MAX_BLOCK_SIZE = 256 << 10; // 256 KiB; larger blocks are allocated individually
+    static constexpr size_t MAX_ALIGNMENT = 64; // cache line
+    static constexpr size_t NUM_SIZE_CLASSES = 52; // [16, 64] in steps of 16, then 4 classes per power of two
+    static constexpr size_t THREAD_CACHE_LIMIT = 64; // max blocks per size class in a thread-local free list
+    static constexpr size_t THREAD_CACHE_SLOTS = 4; // max arenas cached per thread
+
+    NodeArena() : id_(next_id()) {
+        for (size_t c = 0; c < NUM_SIZE_CLASSES; c++) free_lists_[c] = nullptr;
+    }
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    ~NodeArena() { release_all(); }
+
+    /**
+     * Allocate a block of at least bytes, aligned to at least 16 bytes
+     * @param bytes: the requested size
+     * @return the block
+     */
+    void* allocate(size_t bytes) {
+        if (bytes > MAX_BLOCK_SIZE) return allocate_large(bytes);
+        size_t c = size_class(bytes);
+
+        // 1. thread-local free list
+        ThreadCache &cache = thread_cache();
+        if (cache.head[c] != nullptr) {
+            FreeBlock *block = cache.head[c];
+            cache.head[c] = block->next;
+            cache.count[c]--;
+            return block;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        // 2. shared free list; move up to half a thread cache worth of blocks to this thread
+        if (free_lists_[c] != nullptr) {
+            FreeBlock *block = free_lists_[c];
+            free_lists_[c] = block->next;
+            while (free_lists_[c] != nullptr && cache.count[c] < THREAD_CACHE_LIMIT / 2) {
+                FreeBlock *b = free_lists_[c];
+                free_lists_[c] = b->next;
+                b->next = cache.head[c];
+                cache.head[c] = b;
+                cache.count[c]++;
+            }
+            return block;
+        }
+
+        // 3. carve from the current slab
+        return carve(class_size(c));
+    }
+
+    /**
+     * Return a block to the arena
+     * @param ptr: the block returned by allocate(); nullptr is ignored
+     * @param bytes: the size passed to allocate()
+     */
+    void deallocate(void *ptr, size_t bytes) {
+        if (ptr == nullptr) return;
+        if (bytes > MAX_BLOCK_SIZE) {
+            deallocate_large(ptr);
+            return;
+        }
+        size_t c = size_class(bytes);
+
+        ThreadCache &cache = thread_cache();
+        FreeBlock *block = static_cast<FreeBlock*>(ptr);
+        block->next = cache.head[c];
+        cache.head[c] = block;
+        cache.count[c]++;
+        if (cache.count[c] <= THREAD_CACHE_LIMIT) return;
+
+        // spill half of the thread-local free list to the shared one
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (cache.count[c] > THREAD_CACHE_LIMIT / 2) {
+            FreeBlock *b = cache.head[c];
+            cache.head[c] = b->next;
+            b->next = free_lists_[c];
+            free_lists_[c] = b;
+            cache.count[c]--;
+        }
+    }
+
+    /**
+     * Construct an object in the arena
+     */
+    template<typename T, typename... Args>
+    T* create(Args&&... args) {
+        static_assert(alignof(T) <= 16, "NodeArena only guarantees 16-byte alignment for small objects");
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * Destroy an object created by create() and recycle its block
+     */
+    template<typename T>
+    void destroy(T *obj) {
+        if (obj == nullptr) return;
+        obj->~T();
+        deallocate(obj, sizeof(T));
+    }
+
+    /**
+     * Construct an array of n default-constructed objects in the arena
+     */
+    template<typename T>
+    T* create_array(size_t n) {
+        static_assert(alignof(T) <= 16, "NodeArena only guarantees 16-byte alignment for small objects");
+        assert(n > 0);
+        T *arr = static_cast<T*>(allocate(n * sizeof(T)));
+        for (size_t i = 0; i < n; i++) new (arr + i) T();
+        return arr;
+    }
+
+    /**
+     * Destroy an array created by create_array() and recycle its block
+     */
+    template<typename T>
+    void destroy_array(T *arr, size_t n) {
+        if (arr == nullptr) return;
+        for (size_t i = 0; i < n; i++) arr[i].~T();
+        deallocate(arr, n * sizeof(T));
+    }
+
+    /**
+     * Release all the memory of the arena at once
+     * All blocks handed out before become invalid; no destructor is called
+     */
+    void release_all() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto slab : slabs_) std::free(slab);
+        for (auto &block : large_blocks_) std::free(block.first);
+        slabs_.clear();
+        large_blocks_.clear();
+        for (size_t c = 0; c < NUM_SIZE_CLASSES; c++) free_lists_[c] = nullptr;
+        cur_ = end_ = nullptr;
+        reserved_bytes_ = 0;
+        // the thread-local free lists of the other threads still hold blocks of the released slabs;
+        // a new id orphans them
+        id_ = next_id();
+    }
+
+    /**
+     * @return the bytes of memory reserved from the system (slabs and large blocks)
+     */
+    size_t reserved_bytes() const { return reserved_bytes_; }
+
+    /**
+     * @return the size class of a small block of bytes
+     * [16, 64] in steps of 16, then 4 classes in each (2^k, 2^(k+1)], so at most 25% is wasted
+     */
+    static constexpr size_t size_class(size_t bytes) {
+        if (bytes <= 64) return bytes == 0 ? 0 : (bytes - 1) / 16;
+        size_t k = 63 - __builtin_clzll(bytes - 1); // 2^k < bytes <= 2^(k+1)
+        size_t step = size_t(1) << (k - 2);
+        return 4 + (k - 6) * 4 + (bytes - 1 - (size_t(1) << k)) / step;
+    }
+
+    /**
+     * @return the block size of size class c
+     */
+    static constexpr size_t class_size(size_t c) {
+        if (c < 4) return (c + 1) * 16;
+        size_t k = 6 + (c - 4) / 4;
+        return (size_t(1) << k) + ((c - 4) % 4 + 1) * (size_t(1) << (k - 2));
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    // thread-local free lists of one arena
+    struct ThreadCache {
+        uint64_t arena_id = 0; // 0 means unused
+        FreeBlock *head[NUM_SIZE_CLASSES] = {};
+        uint32_t count[NUM_SIZE_CLASSES] = {};
+    };
+
+    // a thread keeps free lists for its THREAD_CACHE_SLOTS most recently used arenas
+    // blocks cached for an evicted or destroyed arena are dropped, i.e., not reused until the arena is released
+    ThreadCache& thread_cache() {
+        thread_local ThreadCache caches[THREAD_CACHE_SLOTS];
+        thread_local size_t next_victim = 0;
+        uint64_t id = id_;
+        if (caches[0].arena_id == id) return caches[0];
+        for (size_t i = 1; i < THREAD_CACHE_SLOTS; i++) {
+            if (caches[i].arena_id == id) {
+                std::swap(caches[0], caches[i]); // keep the hottest arena in the first slot
+                return caches[0];
+            }
+        }
+        ThreadCache &victim = caches[next_victim];
+        next_victim = (next_victim + 1) % THREAD_CACHE_SLOTS;
+        victim = ThreadCache();
+        victim.arena_id = id;
+        return victim;
+    }
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> id_counter(1);
+        return id_counter.fetch_add(1);
+    }
+
+    // NOTE: mutex_ must be held
+    void* carve(size_t block_size) {
+        // small blocks are packed; nodes of a few cache lines or more start on a cache line
+        size_t align = block_size < 4 * MAX_ALIGNMENT ? 16 : MAX_ALIGNMENT;
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(uintptr_t)(align - 1);
+        if (cur_ == nullptr || p + block_size > reinterpret_cast<uintptr_t>(end_)) {
+            // the tail of the current slab is abandoned; it is smaller than MAX_BLOCK_SIZE
+            char *slab = static_cast<char*>(std::aligned_alloc(MAX_ALIGNMENT, SLAB_SIZE));
+            if (slab == nullptr) throw std::bad_alloc();
+            slabs_.push_back(slab);
+            reserved_bytes_ += SLAB_SIZE;
+            cur_ = slab;
+            end_ = slab + SLAB_SIZE;
+            p = reinterpret_cast<uintptr_t>(cur_);
+        }
+        cur_ = reinterpret_cast<char*>(p + block_size);
+        return reinterpret_cast<void*>(p);
+    }
+
+    void* allocate_large(size_t bytes) {
+        size_t size = (bytes + MAX_ALIGNMENT - 1) / MAX_ALIGNMENT * MAX_ALIGNMENT;
+        void *block = std::aligned_alloc(MAX_ALIGNMENT, size);
+        if (block == nullptr) throw std::bad_alloc();
+        std::lock_guard<std::mutex> lock(mutex_);
+        large_blocks_[block] = size;
+        reserved_bytes_ += size;
+        return block;
+    }
+
+    void deallocate_large(void *block) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = large_blocks_.find(block);
+        assert(it != large_blocks_.end());
+        reserved_bytes_ -= it->second;
+        large_blocks_.erase(it);
+        std::free(block);
+    }
+
+    std::atomic<uint64_t> id_; // identifies the thread-local free lists of this arena
+    std::mutex mutex_; // protects everything below
+    FreeBlock *free_lists_[NUM_SIZE_CLASSES]; // shared free lists
+    std::vector<char*> slabs_;
+    std::unordered_map<void*, size_t> large_blocks_; // block -> size
+    char *cur_ = nullptr; // bump pointer in the current slab
+    char *end_ = nullptr;
+    size_t reserved_bytes_ = 0;
+};
+
+static_assert(NodeArena::class_size(NodeArena::NUM_SIZE_CLASSES - 1) == NodeArena::MAX_BLOCK_SIZE,
+              "size classes must cover MAX_BLOCK_SIZE");
+
+} // end namespace buckindex
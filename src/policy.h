@@ -0,0 +1,193 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+#include<cassert>
+#include<limits>
+#include<vector>
+
+#include "util.h"
+#include "linear_model.h"
+#include "keyvalue.h"
+
+namespace buckindex {
+
+/**
+ * Compile-time policies of the index
+ * A configuration of BuckIndex/Bucket/Segment is a set of stateless policy structs passed as template
+ * parameters, so differently configured indexes can live in the same binary without runtime cost.
+ * The Default* aliases at the end map the legacy build flags (HINT_*, BUCKINDEX_USE_LINEAR_REGRESSION,
+ * BUCKINDEX_USE_SIMD and BUCKINDEX_DEBUG) to policies, so existing builds keep their behavior.
+ */
+
+/**
+ * HintPolicy: the starting/predicted position of a key in a D-Bucket
+ * hint<SIZE>(bucket, key, start_key, end_key) is given the D-Bucket and the key range [start_key, end_key)
+ * that the D-Bucket covers; adaptive means the hint type is chosen per D-Bucket on rebuild
+ */
+struct NoHint {
+    static constexpr const char *name = "no hash";
+    static constexpr bool adaptive = false;
+
+    template<size_t SIZE, typename BucketType, typename T>
+    static inline size_t hint(const BucketType &/*bucket*/, T /*key*/, T /*start_key*/, T /*end_key*/) { return 0; }
+};
+
+struct ModHashHint {
+    static constexpr const char *name = "mod hash";
+    static constexpr bool adaptive = false;
+
+    template<size_t SIZE, typename BucketType, typename T>
+    static inline size_t hint(const BucketType &/*bucket*/, T key, T /*start_key*/, T /*end_key*/) { return key % SIZE; }
+};
+
+struct MurmurHashHint {
+    static constexpr const char *name = "murmur hash";
+    static constexpr bool adaptive = false;
+
+    template<size_t SIZE, typename BucketType, typename T>
+    static inline size_t hint(const BucketType &/*bucket*/, T key, T /*start_key*/, T /*end_key*/) {
+        return murmur64(key) % SIZE;
+    }
+};
+
+#ifdef HINT_CL_HASH
+// clhash is only compiled in with HINT_CL_HASH
+struct ClHashHint {
+    static constexpr const char *name = "cl hash";
+    static constexpr bool adaptive = false;
+
+    template<size_t SIZE, typename BucketType, typename T>
+    static inline size_t hint(const BucketType &/*bucket*/, T key, T /*start_key*/, T /*end_key*/) {
+        return clhash64(key) % SIZE;
+    }
+};
+#endif
+
+struct ModelPredictHint {
+    static constexpr const char *name = "model prediction";
+    static constexpr bool adaptive = false;
+
+    template<size_t SIZE, typename BucketType, typename T>
+    static inline size_t hint(const BucketType &/*bucket*/, T key, T start_key, T end_key) {
+        return BucketType::model_hint(key, start_key, end_key);
+    }
+};
+
+struct AdaptiveHint {
+    static constexpr const char *name = "adaptive per-bucket hint";
+    static constexpr bool adaptive = true;
+
+    template<size_t SIZE, typename BucketType, typename T>
+    static inline size_t hint(const BucketType &bucket, T key, T /*start_key*/, T /*end_key*/) {
+        return bucket.get_hint(key);
+    }
+};
+
+/**
+ * ModelPolicy: how a linear model is fitted to a sorted list of keys
+ * If needs_keys is false, the model only depends on the endpoints and the number of keys,
+ * and segmentation does not need to keep the keys of each cut
+ */
+struct EndpointModel {
+    static constexpr const char *name = "endpoint linear model";
+    static constexpr bool needs_keys = false;
+
+    template<typename T>
+    static inline LinearModel<T> build(const std::vector<T> &keys) {
+        return LinearModel<T>::get_endpoints_model(keys);
+    }
+};
+
+struct RegressionModel {
+    static constexpr const char *name = "linear regression";
+    static constexpr bool needs_keys = true;
+
+    template<typename T>
+    static inline LinearModel<T> build(const std::vector<T> &keys) {
+        return LinearModel<T>::get_regression_model(keys);
+    }
+};
+
+/**
+ * StatsPolicy: whether runtime statistics (timings, layer sizes, prediction errors) are collected
+ */
+struct NoStats {
+    static constexpr const char *name = "Release mode";
+    static constexpr bool enabled = false;
+};
+
+struct DebugStats {
+    static constexpr const char *name = "Debug mode";
+    static constexpr bool enabled = true;
+};
+
+/**
+ * SearchKernel: how a D-Bucket is probed for a key
+ * SIMDSearch requires the D-Bucket to store keys contiguously (KeyListValueList, or KeyOffsetListValueList)
+ */
+struct ScalarSearch {
+    static constexpr const char *name = "Not using SIMD";
+    static constexpr bool use_simd = false;
+};
+
+struct SIMDSearch {
+    static constexpr const char *name = "Using SIMD";
+    static constexpr bool use_simd = true;
+};
+
+/**
+ * DataListPolicy: the layout of the key-value list of a D-Bucket (see keyvalue.h)
+ * KeyOffsetLayout stores 64-bit keys as 32-bit offsets from a base key, so SIMDSearch compares twice as many keys
+ * at once; a D-Bucket whose keys span more than 32 bits holds only half as many pairs (see Bucket::capacity())
+ */
+struct KeyValueLayout {
+    static constexpr const char *name = "key-value pairs";
+
+    template<typename T, typename V, size_t SIZE>
+    using List = KeyValueList<T, V, SIZE>;
+};
+
+struct KeyOffsetLayout {
+    static constexpr const char *name = "keys narrowed to 32-bit offsets";
+
+    template<typename T, typename V, size_t SIZE>
+    using List = KeyOffsetListValueList<T, V, SIZE>;
+};
+
+// Default policies from the legacy build flags
+#if defined(HINT_MOD_HASH)
+using DefaultHintPolicy = ModHashHint;
+#elif defined(HINT_CL_HASH)
+using DefaultHintPolicy = ClHashHint;
+#elif defined(HINT_MURMUR_HASH)
+using DefaultHintPolicy = MurmurHashHint;
+#elif defined(HINT_MODEL_PREDICT)
+using DefaultHintPolicy = ModelPredictHint;
+#elif defined(HINT_ADAPTIVE)
+using DefaultHintPolicy = AdaptiveHint;
+#else
+using DefaultHintPolicy = NoHint;
+#endif
+
+#ifdef BUCKINDEX_USE_LINEAR_REGRESSION
+using DefaultModelPolicy = RegressionModel;
+#else
+using DefaultModelPolicy = EndpointModel;
+#endif
+
+#ifdef BUCKINDEX_DEBUG
+using DefaultStatsPolicy = DebugStats;
+#else
+using DefaultStatsPolicy = NoStats;
+#endif
+
+#ifdef BUCKINDEX_USE_SIMD
+using DefaultSearchKernel = SIMDSearch;
+#else
+using DefaultSearchKernel = ScalarSearch;
+#endif
+
+using DefaultDataListPolicy = KeyValueLayout;
+
+} // end namespace buckindex
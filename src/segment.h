@@ -8,22 +8,30 @@
 #include "bucket.h"
 #include "linear_model.h"
 #include "segmentation.h"
+#include "node_arena.h"
+#include "version_lock.h"
 
 namespace buckindex {
 
 
 // T is the key type, SBUCKET_SIZE is the size of S-Bucket; value type is uintptr_t
-template<typename T, size_t SBUCKET_SIZE>
+// ModelPolicy fits the models of the segments rebuilt by segment_and_batch_update;
+// StatsPolicy decides whether the prediction statistics below are collected
+template<typename T, size_t SBUCKET_SIZE,
+         typename ModelPolicy = DefaultModelPolicy, typename StatsPolicy = DefaultStatsPolicy>
 class Segment {
 public:
-    using SegmentType = Segment<T, SBUCKET_SIZE>;
+    using SegmentType = Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>;
     using KeyValuePtrType = KeyValue<T, uintptr_t>;
-    using BucketType = Bucket<KeyValueList<T, uintptr_t,  SBUCKET_SIZE>, T, uintptr_t, SBUCKET_SIZE>;
+    static constexpr unsigned int RETRAIN_ERROR = 2; // S-Buckets beyond the error at build time; see needs_retrain()
+    // S-Buckets are searched with lb_lookup and filled without hints
+    // the keys and the child pointers are in separate arrays, so the scan of lb_lookup reads packed keys
+    using BucketType = Bucket<KeyListValueList<T, uintptr_t,  SBUCKET_SIZE>, T, uintptr_t, SBUCKET_SIZE,
+                              NoHint, ScalarSearch>;
     // T base; // key compression
     // TBD: flag to determine whether it has rebalanced
 
-    // stats
-#ifdef BUCKINDEX_DEBUG
+    // stats, only updated if StatsPolicy::enabled
     inline static int fail_predict = 0;
     inline static int success_predict = 0;
     inline static int num_locate = 0;
@@ -41,15 +49,15 @@ public:
     inline static int num_segment_and_update = 0;
     inline static int num_segment_and_update_fail = 0;
 
-#endif
-
     int num_bucket_; // total num of buckets
+    VersionLock<uint32_t> version_; // bumped by insert() and batch_update(); see read_begin()
     BucketType* sbucket_list_; // a list of S-Buckets
 
     // default constructors
     Segment(){
         num_bucket_ = 0; // indicating it is empty now
         sbucket_list_ = nullptr;
+        pivots_ = nullptr;
     }
 
     /**
@@ -60,18 +68,26 @@ public:
      * @param model the linear model(before scaling) used to predict the bucket ID
      * @param it the start iterator of the list of entries
      * @param end the end iterator of the list of entries
+     * @param inline_buckets if true, the pivots and the S-Buckets are placed right after the segment object,
+     *                       which must have room for them (see create())
     */
     template<typename IterType>
     Segment(size_t num_kv, double fill_ratio, const LinearModel<T> &model, 
-            IterType it, IterType end)
+            IterType it, IterType end, bool inline_buckets = false)
     :model_(model){
         //assert(it+num_kv == end); // + operator may not be supported 
         assert(num_kv>0);
         assert(fill_ratio > 0.01 && fill_ratio <= 1);
-        size_t num_slot = ceil(num_kv / fill_ratio);
-        num_bucket_ = ceil((double)num_slot / SBUCKET_SIZE);
+        num_bucket_ = get_num_bucket(num_kv, fill_ratio);
         assert((int)num_bucket_ > 0);
-        sbucket_list_ = new BucketType[num_bucket_];
+        if (inline_buckets) {
+            pivots_ = inline_pivots();
+            sbucket_list_ = inline_bucket_list();
+            for (size_t i = 0; i < num_bucket_; i++) new (&sbucket_list_[i]) BucketType();
+        } else {
+            pivots_ = new T[num_bucket_];
+            sbucket_list_ = new BucketType[num_bucket_];
+        }
         model_.expand(1/fill_ratio);
 
         // model_based insertion
@@ -88,7 +104,7 @@ public:
         size_t current_max_bukID = 0;
         for(;it!=end;it++){
             assert(remaining_keys <= remaining_slots);
-            buckID = model_.predict(it->get_key()) / SBUCKET_SIZE;
+            buckID = predict_buck(it->get_key()); // a regression model may predict beyond the last bucket
 
             while(buckID + 1 < num_bucket_ && sbucket_list_[buckID].num_keys()==SBUCKET_SIZE){
                 buckID++; // search forwards until find a bucket with empty slot
@@ -109,7 +125,6 @@ public:
             bool succuess = sbucket_list_[buckID].insert(*it, true, 0 /*hint*/);
             assert(succuess);
 
-#ifdef BUCKINDEX_DEBUG
             // int act = buckID;
             // int pred = model_.predict(it->get_key()) / SBUCKET_SIZE;
             // if(act != pred){
@@ -120,10 +135,10 @@ public:
             //     success_predict_bulk++;
             // }
 
-#endif
             remaining_keys--;
             remaining_slots--;
         }
+        init_pivots();
     }
 
     ~Segment(){
@@ -131,10 +146,80 @@ public:
             for(size_t i = 0; i<num_bucket_;i++){
                 sbucket_list_[i].~BucketType();
             }
-            delete[] sbucket_list_; // delete the array of pointers
+            if (sbucket_list_ != inline_bucket_list()) {
+                delete[] sbucket_list_; // delete the array of pointers
+                delete[] pivots_;
+            }
         }
     }
 
+    /**
+     * @brief Copy Constructor from a saved image, e.g., a snapshot (see BuckIndex::load())
+     * The pivots and the S-Buckets are placed right after the segment object, which must have room for them
+     * (see allocate_image()); the version locks of the S-Buckets are reset
+     * @param model the linear model of the saved segment
+     * @param num_bucket the number of S-Buckets
+     * @param sbuckets the saved S-Buckets
+    */
+    Segment(const LinearModel<T> &model, size_t num_bucket, const BucketType *sbuckets)
+    :model_(model){
+        assert(num_bucket > 0);
+        num_bucket_ = num_bucket;
+        pivots_ = inline_pivots();
+        sbucket_list_ = inline_bucket_list();
+        for (size_t i = 0; i < num_bucket_; i++) new (&sbucket_list_[i]) BucketType(sbuckets[i]);
+        init_pivots();
+    }
+
+    /**
+     * @brief allocate a segment from the arena, with its pivots and S-Buckets in the same block right after it
+     * The parameters are the same as the parameterized constructor
+     * @return the new segment; release it with destroy()
+    */
+    template<typename IterType>
+    static SegmentType* create(NodeArena &arena, size_t num_kv, double fill_ratio, const LinearModel<T> &model,
+                               IterType it, IterType end) {
+        return create_in(allocate(arena, num_kv, fill_ratio), num_kv, fill_ratio, model, it, end);
+    }
+
+    /**
+     * @brief the two steps of create(): allocate the block, then construct the segment in it
+     * e.g., a bulk load allocates serially, so the layout is deterministic, and constructs in parallel
+    */
+    static void* allocate(NodeArena &arena, size_t num_kv, double fill_ratio) {
+        return arena.allocate(get_alloc_size(get_num_bucket(num_kv, fill_ratio)));
+    }
+
+    /**
+     * @brief allocate the block of a segment with num_bucket S-Buckets, to be constructed from a saved image
+    */
+    static void* allocate_image(NodeArena &arena, size_t num_bucket) {
+        return arena.allocate(get_alloc_size(num_bucket));
+    }
+
+    template<typename IterType>
+    static SegmentType* create_in(void *block, size_t num_kv, double fill_ratio, const LinearModel<T> &model,
+                                  IterType it, IterType end) {
+        return new (block) SegmentType(num_kv, fill_ratio, model, it, end, true);
+    }
+
+    /**
+     * @brief destroy a segment allocated by create(), and return its block to the arena
+    */
+    static void destroy(NodeArena &arena, SegmentType *seg) {
+        size_t size = get_alloc_size(seg->num_bucket_);
+        seg->~Segment();
+        arena.deallocate(seg, size);
+    }
+
+    /**
+     * @return the number of S-Buckets of a segment holding num_kv entries at the given fill ratio
+    */
+    static size_t get_num_bucket(size_t num_kv, double fill_ratio) {
+        size_t num_slot = ceil(num_kv / fill_ratio);
+        return ceil((double)num_slot / SBUCKET_SIZE);
+    }
+
 
     // iterator-related
     // class UnsortedIterator;
@@ -165,7 +250,8 @@ public:
 
     size_t mem_size() const{
         size_t ret = 0;
-        ret += sizeof(SegmentType); // model_, num_bucket_, sbucket_list_
+        ret += sizeof(SegmentType); // model_, num_bucket_, sbucket_list_, pivots_
+        ret += get_pivots_size(num_bucket_); // pivots_
         ret += num_bucket_ * sizeof(BucketType); // sbucket_list_
 
         // bucket has no pointer type member variable, 
@@ -173,6 +259,8 @@ public:
         return ret;
     }
 
+    inline const LinearModel<T>& get_model() const { return model_; }
+
     // TODO: a non-pivoting version (deferred)
 
     /**
@@ -184,6 +272,89 @@ public:
     */
     bool lb_lookup(T key, KeyValuePtrType &kvptr, KeyValuePtrType &next_kvptr) const;
 
+    /**
+     * @brief lb_lookup() on the image of a segment, e.g., in a memory-mapped index (see MappedBuckIndex)
+     * @param model the linear model of the segment
+     * @param sbuckets the S-Buckets of the segment
+     * @param pivots the dense pivots of the S-Buckets (see get_pivots())
+     * @param num_bucket the number of S-Buckets
+     * @param error the error of the model (see get_max_error())
+    */
+    static bool lb_lookup(const LinearModel<T> &model, const BucketType *sbuckets, const T *pivots, size_t num_bucket,
+                          size_t error, T key, KeyValuePtrType &kvptr, KeyValuePtrType &next_kvptr) {
+        assert(num_bucket > 0);
+        return sbuckets[locate_buck(model, pivots, num_bucket, error, key)].lb_lookup(key, kvptr, next_kvptr);
+    }
+
+    /**
+     * @brief the state of the pivot search, e.g., to write the image of the segment (see BuckIndex::freeze())
+     * the pivots never decrease: an empty S-Bucket has the pivot of the next non-empty one
+    */
+    inline const T* get_pivots() const { return pivots_; }
+    inline unsigned int get_max_error() const { return max_error_; }
+
+    /**
+     * @brief the end of the key range routed to the S-Bucket that covers key
+     * @param key the key to be looked up
+     * @return the pivot of the next non-empty S-Bucket (see pivots_); max_key if there is none
+    */
+    inline T next_pivot(T key) const {
+        unsigned int buckID = locate_buck(key);
+        return buckID + 1 < num_bucket_ ? pivots_[buckID + 1] : std::numeric_limits<T>::max();
+    }
+
+    /**
+     * @brief whether the model of the segment drifted, i.e., inserts and rebalances moved the pivot of an S-Bucket
+     * more than RETRAIN_ERROR S-Buckets further from its prediction than the error of the segment when it was built,
+     * which follows the error bound of the segmentation;
+     * such a segment is rebuilt with a new model by its next batch_update() (see BuckIndex::split_and_propagate())
+    */
+    inline bool needs_retrain() const { return max_error_ > build_error_ + RETRAIN_ERROR; }
+
+    /**
+     * @brief optimistic read of the segment, against a concurrent writer calling insert()/batch_update()
+     * read_begin() returns the version to pass to read_validate() after reading (e.g., lb_lookup());
+     * if the validation fails, what was read may be torn and must be read again
+    */
+    inline uint32_t read_begin() const { return version_.read_begin(); }
+    inline bool read_validate(uint32_t version) const { return version_.read_validate(version); }
+
+    /**
+     * @brief writer lock of the segment, for concurrent writers (see VersionLock)
+     * try_lock() upgrades an optimistic read to the lock; it fails if the segment is locked, obsolete
+     * (i.e., rebuilt and replaced in the index), or was modified since read_begin() returned version
+    */
+    inline bool try_lock(uint32_t version) { return version_.try_lock(version); }
+    inline void unlock() { version_.unlock(); }
+    inline void mark_obsolete() { version_.mark_obsolete(); }
+
+    /**
+     * @brief writer lock of the segment, waiting for its current owner
+     * @return true if the lock is taken; false if the segment is obsolete
+    */
+    inline bool lock() { return version_.lock(); }
+
+    /**
+     * @brief replace the child of an entry, if it is still the expected one
+     * e.g., a D-Bucket and its image in the cold tier are swapped (see BuckIndex::enable_tiering())
+     * NOTE: the caller holds the lock; readers see the new child as a write of the segment
+     * @param key: the pivot of the entry
+     * @param expected: the child the caller read
+     * @param desired: the new child
+     * @return the child of the entry before the call, replaced only if it is expected; 0 if there is no entry
+    */
+    uintptr_t replace_child(T key, uintptr_t expected, uintptr_t desired) {
+        BucketType &s_bucket = sbucket_list_[locate_buck(key)];
+        int pos = s_bucket.get_pos(key);
+        if (pos < 0) return 0;
+        uintptr_t current = s_bucket.at(pos).value_;
+        if (current == expected) {
+            typename VersionLock<uint32_t>::WriteGuard write_guard(version_);
+            s_bucket.set_value(pos, desired);
+        }
+        return current;
+    }
+
     /**
      * @brief return the S-Bucket at the given position
      * @param pos the position of the S-Bucket
@@ -219,12 +390,16 @@ public:
      * We can still use this multi-bucket version to support the future multi-bucket insertion
      * And the multi-bucket insertion overhead is small in the same bucket case
      * @param old_pivot: the old segment or d-bucket pointer to be replaced
-     * @param new_pivots: the new pivots to be inserted
+     * @param new_pivots: the new pivots to be inserted; the first one has the key of old_pivot, as the first half
+     *                    of a split keeps the pivot of the node it replaces
      * @param is_segment: true if old_pivot is a segment, false if old_pivot is a d-bucket
      * @return true if success, false if fail
     */
     bool batch_update(KeyValuePtrType old_pivot, std::vector<KeyValuePtrType> &new_pivots, bool is_segment) {
-        T old_pivot_key = old_pivot.key_;
+        assert(old_pivot.key_ == new_pivots[0].key_);
+
+        // a segment whose model drifted is rebuilt, and retrained, instead of updated in place
+        if (needs_retrain()) { return false; }
 
         // check if have enough space to insert new_pivots
         int cnt_current_bucket = 0;
@@ -232,7 +407,7 @@ public:
         int current_buckID = first_buckID;
         for (int i = 0; i < new_pivots.size(); i++) {
             int buckID = current_buckID;
-            while(buckID + 1 < num_bucket_ && sbucket_list_[buckID+1].get_pivot() <= new_pivots[i].key_){
+            while(buckID + 1 < num_bucket_ && pivots_[buckID+1] <= new_pivots[i].key_){
                 buckID++;
             }
 
@@ -251,31 +426,23 @@ public:
             if (left < cnt_current_bucket) { return false; }
         }
 
+        // the checks above only read; readers see the updates below as a whole
+        typename VersionLock<uint32_t>::WriteGuard write_guard(version_);
+
         // insert new_pivots except the first one
         if (new_pivots.size() > 1) current_buckID = locate_buck(new_pivots[1].key_);
         for (int i = 1; i < new_pivots.size(); i++) {
-            while(current_buckID + 1 < num_bucket_ && sbucket_list_[current_buckID+1].get_pivot() <= new_pivots[i].key_){
+            while(current_buckID + 1 < num_bucket_ && pivots_[current_buckID+1] <= new_pivots[i].key_){
                 current_buckID++;
             }
             bool success = sbucket_list_[current_buckID].insert(new_pivots[i], true, 0 /*hint*/);
             assert(success);
+            sync_pivot(current_buckID);
         }
 
-        // insert the first pivot
-        bool success;
-        assert(old_pivot_key == new_pivots[0].key_);
-        if (old_pivot_key == new_pivots[0].key_) {  // update the first pivot
-            success = sbucket_list_[first_buckID].update(new_pivots[0]);
-            assert(success);
-        } else { // insert the first pivot, and invalidate the old pivot
-            success = sbucket_list_[first_buckID].insert(new_pivots[0], true, 0 /*hint*/);
-            assert(success);
-
-            int buckID = locate_buck(old_pivot_key);
-            int pos = sbucket_list_[buckID].get_pos(old_pivot_key);
-            assert(pos >= 0);
-            sbucket_list_[buckID].invalidate(pos);
-        }  
+        // the first new pivot replaces the entry of the old one, in place
+        bool success = sbucket_list_[first_buckID].update(new_pivots[0]);
+        assert(success);
         
         return true;
     }
@@ -288,81 +455,155 @@ public:
     * @return true if scale and batch insert success, false otherwise
     * NOTE: the SBUCKET_SIZE of new segments is the same as the old one
     * NOTE: the new segments are not inserted into the tree index and old segment is not destroyed
+    * @param arena: if not nullptr, the new segments are allocated with create() from the arena; otherwise with new
     */
-    bool segment_and_batch_update(double fill_ratio, const std::vector<KeyValue<T,uintptr_t>> &insert_anchors,std::vector<KeyValue<T,uintptr_t>> &new_segs);
+    bool segment_and_batch_update(double fill_ratio, const std::vector<KeyValue<T,uintptr_t>> &insert_anchors,std::vector<KeyValue<T,uintptr_t>> &new_segs,
+                                  NodeArena *arena = nullptr);
 
 private:
     LinearModel<T> model_;
 
+    // the pivot of each S-Bucket, dense, so that locate_buck() reads a few cache lines instead of a pivot
+    // per S-Bucket; kept in sync with the S-Buckets by the writers (see sync_pivot())
+    // an empty S-Bucket takes the pivot of the next non-empty one, so the pivots never decrease
+    T* pivots_;
+    // the largest distance between the predicted S-Bucket of a pivot and its S-Bucket, when built and now,
+    // updated by the writers; max_error_ bounds the search of locate_buck()
+    unsigned int build_error_ = 0;
+    unsigned int max_error_ = 0;
+
+    // the block of an inline segment: the segment object, the pivots, padded to align the S-Buckets, the S-Buckets
+    static size_t get_alloc_size(size_t num_bucket) {
+        static_assert(sizeof(SegmentType) % alignof(BucketType) == 0, "inline S-Buckets must be aligned");
+        static_assert(sizeof(SegmentType) % alignof(T) == 0, "inline pivots must be aligned");
+        return sizeof(SegmentType) + get_pivots_size(num_bucket) + num_bucket * sizeof(BucketType);
+    }
+
+    static size_t get_pivots_size(size_t num_bucket) {
+        size_t size = num_bucket * sizeof(T);
+        return (size + alignof(BucketType) - 1) / alignof(BucketType) * alignof(BucketType);
+    }
+
+    T *inline_pivots() {
+        return reinterpret_cast<T*>(this + 1);
+    }
+
+    BucketType *inline_bucket_list() {
+        return reinterpret_cast<BucketType*>(reinterpret_cast<char*>(this + 1) + get_pivots_size(num_bucket_));
+    }
+
+    // fill pivots_ from the S-Buckets, and record the error of the model
+    void init_pivots() {
+        max_error_ = 0;
+        for (size_t i = num_bucket_; i-- > 0;) {
+            T pivot = sbucket_list_[i].get_pivot();
+            if (pivot == std::numeric_limits<T>::max() && i + 1 < num_bucket_) pivot = pivots_[i + 1];
+            set_pivot_entry(i, pivot);
+        }
+        build_error_ = max_error_;
+    }
+
+    // update pivots_ after the pivot of an S-Bucket changed; called by the writers only
+    inline void sync_pivot(size_t buckID) {
+        T pivot = sbucket_list_[buckID].get_pivot();
+        if (pivot == std::numeric_limits<T>::max() && buckID + 1 < num_bucket_) pivot = pivots_[buckID + 1];
+        set_pivot_entry(buckID, pivot);
+        for (size_t i = buckID; i > 0 && sbucket_list_[i - 1].get_pivot() == std::numeric_limits<T>::max(); i--) {
+            set_pivot_entry(i - 1, pivot);
+        }
+    }
+
+    inline void set_pivot_entry(size_t buckID, T pivot) {
+        pivots_[buckID] = pivot;
+        if (pivot == std::numeric_limits<T>::max()) return; // the empty S-Buckets at the end are never located
+        unsigned int pred_buckID = predict_buck(pivot);
+        unsigned int error = pred_buckID > buckID ? pred_buckID - buckID : buckID - pred_buckID;
+        max_error_ = std::max(max_error_, error);
+    }
+
     // TODO: TBD-do we explicitly store x_sum, y_sum, xx_sum and xy_sum
 
     inline unsigned int predict_buck(T key) const { // get the predicted S-Bucket ID based on the model computing
-        unsigned int buckID = (unsigned int)(model_.predict(key) / SBUCKET_SIZE);
+        return predict_buck(model_, num_bucket_, key);
+    }
+
+    static inline unsigned int predict_buck(const LinearModel<T> &model, size_t num_bucket, T key) {
+        unsigned int buckID = (unsigned int)(model.predict(key) / SBUCKET_SIZE);
         
         buckID = std::max(buckID, 0U);
-        buckID = std::min(buckID, (unsigned int)(num_bucket_-1)); // ensure num_bucket>0
-        assert(buckID < num_bucket_);
+        buckID = std::min(buckID, (unsigned int)(num_bucket-1)); // ensure num_bucket>0
+        assert(buckID < num_bucket);
         return buckID;
     }
 
-    inline unsigned int locate_buck(T key) const {
-        // prediction may be incorrect, this function is to find the exact bucket whose range covers the key based on prediction
-        // Step1: call predict_buck to get an intial position
-        // Step2: search neighbors to find the exact match (linear search)
-        unsigned int buckID = predict_buck(key); // ensure buckID is valid s
-       
-        // search forward
-        while(buckID+1<num_bucket_ && sbucket_list_[buckID+1].get_pivot() <= key){
-            buckID++;
+    /**
+     * @brief find the S-Bucket whose range covers key over the dense pivots of a segment, bounded by the model error
+     * If the pivot of every S-Bucket is predicted within error buckets, the S-Bucket of any key is in
+     * [pred - error - 1, pred + error]; a binary search of that window is logarithmic in the error.
+     * If the window misses (e.g., a reader saw the pivots before the error was updated), the search
+     * grows exponentially from the window, so the result is always exact
+     * @param pivots the pivots, never decreasing
+     * @param error the recorded error of the model
+     * @return the last S-Bucket whose pivot <= key; 0 if there is none
+    */
+    static inline unsigned int locate_buck(const LinearModel<T> &model, const T *pivots, size_t num_bucket,
+                                           size_t error, T key) {
+        size_t pred_buckID = predict_buck(model, num_bucket, key);
+        size_t lo = pred_buckID > error + 1 ? pred_buckID - error - 1 : 0;
+        size_t end = std::min(pred_buckID + error + 1, num_bucket); // exclusive
+        size_t step = error + 1;
+        if (lo > 0 && pivots[lo] > key) { // the S-Bucket is before the window
+            do {
+                end = lo;
+                lo = lo > step ? lo - step : 0;
+                step *= 2;
+            } while (lo > 0 && pivots[lo] > key);
+        } else if (end < num_bucket && pivots[end] <= key) { // the S-Bucket is after the window
+            do {
+                lo = end;
+                end = std::min(end + step, num_bucket);
+                step *= 2;
+            } while (end < num_bucket && pivots[end] <= key);
         }
-        // search backward
-        while(buckID>0 && sbucket_list_[buckID].get_pivot() > key){
-            buckID--;
+
+        // branch-free binary search of [lo, end): pivots[lo] <= key unless lo is 0, and pivots[end] > key
+        const T *base = pivots + lo;
+        size_t len = end - lo;
+        while (len > 1) {
+            size_t half = len / 2;
+            base = base[half] <= key ? base + half : base;
+            len -= half;
         }
+        return base - pivots;
+    }
 
-        // //std::cout << "buckID: " << buckID << std::endl;
-        // if(sbucket_list_[buckID].get_pivot() <= key){ // search forwards
-        //     while(buckID+1<num_bucket_){
-        //         if(sbucket_list_[buckID+1].get_pivot() > key){
-        //             break;
-        //         }
-        //         buckID++;
-        //     }
-        // }
-        // else{ // search backwards
-        //     while(buckID>0){
-        //         if(sbucket_list_[buckID-1].get_pivot() <= key){
-        //             buckID--;
-        //             break;
-        //         }
-        //         buckID--;
-        //     }
-        // }
-#ifdef BUCKINDEX_DEBUG
-        num_locate++;
-        auto pred_buckID = predict_buck(key);
-        if (buckID != pred_buckID){
-            fail_predict++;
-            fail_distance += abs(((int)buckID - (int)pred_buckID));
-            if(abs(((int)buckID - (int)pred_buckID)) > 10){
-                std::cout << "buckID: " << buckID << " predict_buck(key): " << pred_buckID << " key: "<<key<<std::endl;
-                model_.dump();
-                //auto offset = model_.get_offset();
-                //std::cout<< "model: "<<slope<<" "<<offset<<std::endl;
-                auto min_id = std::min(buckID, pred_buckID);
-                auto max_id = std::max(buckID, pred_buckID);
-                for (int i = 0; i < num_bucket_; i++){
-                    std::cout <<i << ", " << sbucket_list_[i].get_pivot()<<std::endl;
+    inline unsigned int locate_buck(T key) const {
+        unsigned int buckID = locate_buck(model_, pivots_, num_bucket_, max_error_, key);
+        if constexpr (StatsPolicy::enabled) {
+            num_locate++;
+            auto pred_buckID = predict_buck(key);
+            if (buckID != pred_buckID){
+                fail_predict++;
+                fail_distance += abs(((int)buckID - (int)pred_buckID));
+                if(abs(((int)buckID - (int)pred_buckID)) > 10){
+                    std::cout << "buckID: " << buckID << " predict_buck(key): " << pred_buckID << " key: "<<key<<std::endl;
+                    model_.dump();
+                    //auto offset = model_.get_offset();
+                    //std::cout<< "model: "<<slope<<" "<<offset<<std::endl;
+                    auto min_id = std::min(buckID, pred_buckID);
+                    auto max_id = std::max(buckID, pred_buckID);
+                    for (int i = 0; i < num_bucket_; i++){
+                        std::cout <<i << ", " << sbucket_list_[i].get_pivot()<<std::endl;
+                    }
+                    //std::cout << std::endl;
+                    std::cout <<"-------------------"<< std::endl;
                 }
-                //std::cout << std::endl;
-                std::cout <<"-------------------"<< std::endl;
-            }
             
+            }
+            else{
+                success_predict++;
+            }
         }
-        else{
-            success_predict++;
-        }
-#endif
         return buckID;
     }
 
@@ -371,8 +612,8 @@ private:
 
 
 /*
-template<typename T, size_t SBUCKET_SIZE>
-bool Segment<T, SBUCKET_SIZE>::scale_and_segmentation(double fill_ratio, std::vector<KeyValue<T,uintptr_t>> &new_segs){
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+bool Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::scale_and_segmentation(double fill_ratio, std::vector<KeyValue<T,uintptr_t>> &new_segs){
 
     // the error_bound should be less than 1/2 of the bucket size.
     uint64_t error_bound = 0.5 * SBUCKET_SIZE;
@@ -402,11 +643,12 @@ bool Segment<T, SBUCKET_SIZE>::scale_and_segmentation(double fill_ratio, std::ve
 */
 
 
-template<typename T, size_t SBUCKET_SIZE>
-bool Segment<T, SBUCKET_SIZE>::segment_and_batch_update(
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+bool Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::segment_and_batch_update(
     double fill_ratio, 
     const std::vector<KeyValue<T,uintptr_t>> &input_pivots,
-    std::vector<KeyValue<T,uintptr_t>> &new_segs){
+    std::vector<KeyValue<T,uintptr_t>> &new_segs,
+    NodeArena *arena){
 
     // the error_bound should be less than 1/2 of the bucket size.
     uint64_t error_bound = 0.5 * SBUCKET_SIZE;
@@ -445,14 +687,19 @@ bool Segment<T, SBUCKET_SIZE>::segment_and_batch_update(
     out_cuts.clear();
 
     vector<LinearModel<T>> out_models;
-    Segmentation<std::vector<KeyValue<T,uintptr_t>>, T>::compute_dynamic_segmentation(list, out_cuts, out_models, error_bound);
+    Segmentation<std::vector<KeyValue<T,uintptr_t>>, T, ModelPolicy>::compute_dynamic_segmentation(list, out_cuts, out_models, error_bound);
 
     // put result of segmentation into multiple segments
     size_t start_pos = 0;
     for(size_t i = 0;i<out_cuts.size();i++){
         // using dynamic allocation in case the segment is destroyed after the loop
         // SegmentType* seg = new SegmentType(out_cuts[i].size_, fill_ratio, out_cuts[i].get_model(), list.begin() + start_pos, list.begin() + start_pos+out_cuts[i].size_);
-        SegmentType* seg = new SegmentType(out_cuts[i].size_, fill_ratio, out_models[i], list.begin() + start_pos, list.begin() + start_pos+out_cuts[i].size_);
+        SegmentType* seg;
+        if (arena != nullptr) {
+            seg = SegmentType::create(*arena, out_cuts[i].size_, fill_ratio, out_models[i], list.begin() + start_pos, list.begin() + start_pos+out_cuts[i].size_);
+        } else {
+            seg = new SegmentType(out_cuts[i].size_, fill_ratio, out_models[i], list.begin() + start_pos, list.begin() + start_pos+out_cuts[i].size_);
+        }
         T key = out_cuts[i].start_key_;
         KeyValue<T,uintptr_t> kv(key, (uintptr_t)seg);
         new_segs.push_back(kv);
@@ -462,8 +709,8 @@ bool Segment<T, SBUCKET_SIZE>::segment_and_batch_update(
     return true;
 }
 
-template<typename T, size_t SBUCKET_SIZE>
-bool Segment<T, SBUCKET_SIZE>::bucket_rebalance(unsigned int buckID) { // re-balance between adjcent bucket
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+bool Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::bucket_rebalance(unsigned int buckID) { // re-balance between adjcent bucket
     // Case 1: migrate forwards
 
     // Case 2: migrate backwards
@@ -494,6 +741,7 @@ bool Segment<T, SBUCKET_SIZE>::bucket_rebalance(unsigned int buckID) { // re-bal
             }
         }
         sbucket_list_[buckID+1].set_pivot(new_pivot);
+        sync_pivot(buckID+1);
 
 
         for(size_t i = 0; i<SBUCKET_SIZE;i++){
@@ -524,6 +772,7 @@ bool Segment<T, SBUCKET_SIZE>::bucket_rebalance(unsigned int buckID) { // re-bal
             }
         }
         sbucket_list_[buckID].set_pivot(new_pivot);
+        sync_pivot(buckID);
         for(size_t i = 0; i<SBUCKET_SIZE;i++){
             if(!sbucket_list_[buckID].valid(i)){
                 continue;
@@ -539,8 +788,8 @@ bool Segment<T, SBUCKET_SIZE>::bucket_rebalance(unsigned int buckID) { // re-bal
 }
 
 
-template<typename T, size_t SBUCKET_SIZE>
-bool Segment<T, SBUCKET_SIZE>::lb_lookup(T key, KeyValuePtrType &kvptr, KeyValuePtrType &next_kvptr) const {
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+bool Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::lb_lookup(T key, KeyValuePtrType &kvptr, KeyValuePtrType &next_kvptr) const {
     assert(num_bucket_>0);
     unsigned int buckID = locate_buck(key);
     bool success = sbucket_list_[buckID].lb_lookup(key, kvptr, next_kvptr);
@@ -549,8 +798,9 @@ bool Segment<T, SBUCKET_SIZE>::lb_lookup(T key, KeyValuePtrType &kvptr, KeyValue
     return success;
 }
 
-template<typename T, size_t SBUCKET_SIZE>
-bool Segment<T, SBUCKET_SIZE>::insert(KeyValue<T, uintptr_t> &kv) {
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+bool Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::insert(KeyValue<T, uintptr_t> &kv) {
+    typename VersionLock<uint32_t>::WriteGuard write_guard(version_); // covers the bucket rebalance
 
     assert(num_bucket_>0);
 
@@ -582,13 +832,14 @@ bool Segment<T, SBUCKET_SIZE>::insert(KeyValue<T, uintptr_t> &kv) {
     // then we need to update the pivot
     
     bool ret = sbucket_list_[buckID].insert(kv, true, 0 /*hint*/);
+    sync_pivot(buckID);
 
     return ret;
 }
 
 // return the first element that is not less than key
-template<typename T, size_t SBUCKET_SIZE>
-typename Segment<T, SBUCKET_SIZE>::const_iterator Segment<T, SBUCKET_SIZE>::lower_bound(T key){
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+typename Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::const_iterator Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::lower_bound(T key){
     assert(num_bucket_>0);
     unsigned int buckID = locate_buck(key);
 
@@ -596,8 +847,8 @@ typename Segment<T, SBUCKET_SIZE>::const_iterator Segment<T, SBUCKET_SIZE>::lowe
 }
 
 // return the first element that is greater than key
-template<typename T, size_t SBUCKET_SIZE>
-typename Segment<T, SBUCKET_SIZE>::const_iterator Segment<T, SBUCKET_SIZE>::upper_bound(T key){
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+typename Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::const_iterator Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::upper_bound(T key){
     assert(num_bucket_>0);
     //unsigned int buckID = locate_buck(key);
 
@@ -660,10 +911,10 @@ private:
 };
 */
 
-template<typename T, size_t SBUCKET_SIZE>
-class Segment<T, SBUCKET_SIZE>::const_iterator {
+template<typename T, size_t SBUCKET_SIZE, typename ModelPolicy, typename StatsPolicy>
+class Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>::const_iterator {
 public:
-    using SegmentType = Segment<T, SBUCKET_SIZE>;
+    using SegmentType = Segment<T, SBUCKET_SIZE, ModelPolicy, StatsPolicy>;
 
     /*
     // explicit const_iterator(SegmentType *segment) : segment_(segment) {
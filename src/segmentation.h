@@ -1,6 +1,8 @@
 #pragma once
 #include "linear_model.h"
 #include "greedy_error_corridor.h"
+#include "policy.h"
+#include "task_pool.h"
 
 
 namespace buckindex {
@@ -50,55 +52,73 @@ namespace buckindex {
         T end_key_;
     };
 
-    template<typename Container, typename KeyType>
+    /**
+     * ModelPolicy decides how the model of each cut is fitted
+     */
+    template<typename Container, typename KeyType, typename ModelPolicy = DefaultModelPolicy>
     class Segmentation {
     public:
         static void compute_dynamic_segmentation(Container &in_kv_array,
                                                  vector<Cut<KeyType>>& out_cuts, vector<LinearModel<KeyType>> &out_models,
                                                  uint64_t error_bound) {
-            GreedyErrorCorridor<KeyType> alg;
-            int idx = 0;
-            Cut<KeyType> c;
-            if (in_kv_array.size() == 0) return;
-            typename Container::const_iterator start = in_kv_array.cbegin();
-            typename Container::const_iterator end = in_kv_array.cend();
+            uint64_t idx = 0;
+            while (idx < in_kv_array.size()) {
+                idx = next_cut(in_kv_array, idx, in_kv_array.size(), error_bound, out_cuts, out_models);
+            }
+        }
 
-            vector<KeyType> keys;
+        /**
+         * Parallel compute_dynamic_segmentation(), with the same result
+         * The greedy cut only depends on where it starts, so the chunks of in_kv_array are cut in parallel, each
+         * from its start; then the cuts are stitched serially: the last cut of a chunk is redone across the chunk
+         * boundary, until a redone cut ends where a cut of the next chunk starts, from which on both agree
+         * @param pool: runs the chunks
+         * @param min_chunk_size: inputs smaller than two chunks are cut serially
+         */
+        static void compute_dynamic_segmentation_parallel(Container &in_kv_array,
+                                                          vector<Cut<KeyType>>& out_cuts,
+                                                          vector<LinearModel<KeyType>> &out_models,
+                                                          uint64_t error_bound, TaskPool &pool,
+                                                          uint64_t min_chunk_size = 1 << 16) {
+            uint64_t n = in_kv_array.size();
+            uint64_t num_chunks = std::min<uint64_t>(n / min_chunk_size, (pool.num_workers() + 1) * 4);
+            if (num_chunks < 2) {
+                compute_dynamic_segmentation(in_kv_array, out_cuts, out_models, error_bound);
+                return;
+            }
 
-            alg.init(start->get_key(), error_bound);
-            c.add_sample(start->get_key());
-#ifdef BUICKINDEX_USE_LINEAR_REGRESSION
-            keys.push_back(start->get_key());
-#endif
-            idx = 1;
-            start++;
-            while (start != end) {
-                if (alg.is_bounded(start->get_key())) {
-                    c.add_sample(start->get_key());
-                    keys.push_back(start->get_key());
-                } else {
-                    out_cuts.push_back(c);
-#ifdef BUICKINDEX_USE_LINEAR_REGRESSION
-                    out_models.push_back(LinearModel<KeyType>::get_regression_model(keys));
-                    keys.clear();
-                    keys.push_back(start->get_key());
-#else
-                    out_models.push_back(c.get_model());
-#endif
-                    alg.init(start->get_key(), error_bound);
-                    c = Cut<KeyType>(idx);
-                    c.add_sample(start->get_key());
+            vector<vector<Cut<KeyType>>> chunk_cuts(num_chunks);
+            vector<vector<LinearModel<KeyType>>> chunk_models(num_chunks);
+            pool.parallel_for(0, num_chunks, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    uint64_t idx = n * c / num_chunks;
+                    uint64_t chunk_end = n * (c + 1) / num_chunks;
+                    while (idx < chunk_end) {
+                        idx = next_cut(in_kv_array, idx, chunk_end, error_bound, chunk_cuts[c], chunk_models[c]);
+                    }
                 }
-                idx++;
-                start++;
-            };
-            out_cuts.push_back(c);
-#ifdef BUICKINDEX_USE_LINEAR_REGRESSION
-            out_models.push_back(LinearModel<KeyType>::get_regression_model(keys));
-            keys.clear();
-#else
-            out_models.push_back(c.get_model());
-#endif
+            });
+
+            out_cuts = std::move(chunk_cuts[0]);
+            out_models = std::move(chunk_models[0]);
+            for (uint64_t c = 1; c < num_chunks; c++) {
+                const vector<Cut<KeyType>> &cuts = chunk_cuts[c];
+                // the last cut may have been stopped by the chunk boundary
+                uint64_t idx = out_cuts.back().start_;
+                out_cuts.pop_back();
+                out_models.pop_back();
+                size_t j = 0;
+                while (idx < n) {
+                    idx = next_cut(in_kv_array, idx, n, error_bound, out_cuts, out_models);
+                    while (j < cuts.size() && cuts[j].start_ < idx) j++;
+                    if (j < cuts.size() && cuts[j].start_ == idx) { // synchronized with the chunk
+                        out_cuts.insert(out_cuts.end(), cuts.begin() + j, cuts.end());
+                        out_models.insert(out_models.end(), chunk_models[c].begin() + j, chunk_models[c].end());
+                        break;
+                    }
+                    if (j == cuts.size()) break; // past the chunk; the next chunk redoes the last cut
+                }
+            }
         }
 
         static void compute_fixed_segmentation(Container &in_kv_array,
@@ -125,5 +145,35 @@ namespace buckindex {
                 c = Cut<KeyType>(idx);
             }
         }
+
+    private:
+        /**
+         * Greedy cut starting at idx, stopped by the error bound or at end
+         * @return the end of the cut, i.e., the start of the next one
+         */
+        static uint64_t next_cut(Container &in_kv_array, uint64_t idx, uint64_t end, uint64_t error_bound,
+                                 vector<Cut<KeyType>>& out_cuts, vector<LinearModel<KeyType>> &out_models) {
+            GreedyErrorCorridor<KeyType> alg;
+            Cut<KeyType> c(idx);
+            vector<KeyType> keys;
+            typename Container::const_iterator it = in_kv_array.cbegin() + idx;
+
+            alg.init(it->get_key(), error_bound);
+            c.add_sample(it->get_key());
+            if constexpr (ModelPolicy::needs_keys) keys.push_back(it->get_key());
+            for (idx++, it++; idx < end && alg.is_bounded(it->get_key()); idx++, it++) {
+                c.add_sample(it->get_key());
+                if constexpr (ModelPolicy::needs_keys) keys.push_back(it->get_key());
+            }
+            out_cuts.push_back(c);
+            out_models.push_back(get_model(c, keys));
+            return idx;
+        }
+
+        // the model of a cut; keys are only collected if the ModelPolicy needs them
+        static inline LinearModel<KeyType> get_model(Cut<KeyType> &c, const vector<KeyType> &keys) {
+            if constexpr (ModelPolicy::needs_keys) return ModelPolicy::build(keys);
+            else return c.get_model();
+        }
     };
 }
@@ -0,0 +1,247 @@
+#pragma once
+
+#include<cstddef>
+#include<cassert>
+#include<algorithm>
+#include<atomic>
+#include<deque>
+#include<functional>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<vector>
+#include<pthread.h>
+
+#include "atomic_queue/spinlock.h"
+#include "event_count.h"
+
+namespace buckindex {
+
+/**
+ * TaskPool: a work-stealing pool of worker threads, for the parallel parts of the index (e.g., scan_parallel(),
+ * bulk load, SMO rebuilds)
+ * parallel_for() cuts a range into chunks and pushes them in batches, one contiguous batch per worker deque
+ * (one lock per worker, not per task). A worker pops the chunks of its own deque from the back, and when it
+ * runs out, steals from the front of the others. The calling thread runs chunks too until the whole range is
+ * done, so a parallel_for() nested in a task does not deadlock.
+ * The worker threads start on the first parallel_for(), and sleep while there is no task (see EventCount).
+ * shared() is the process-wide pool used by default; configure it with configure_shared() before its first use.
+ */
+class TaskPool {
+public:
+    /**
+     * @param num_workers: the number of worker threads; 0 for one per core, minus the calling thread
+     * @param pin_workers: pin worker i to core i (modulo the number of cores)
+     */
+    explicit TaskPool(size_t num_workers = 0, bool pin_workers = false)
+        : num_workers_(num_workers), pin_workers_(pin_workers), started_(false), shutdown_(false), num_tasks_(0) {
+        if (num_workers_ == 0) num_workers_ = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    }
+
+    ~TaskPool() {
+        if (!started_.load(std::memory_order_acquire)) return;
+        shutdown_.store(true, std::memory_order_release);
+        work_.notify_all();
+        for (auto &thread : threads_) thread.join();
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    /**
+     * @return the process-wide pool
+     */
+    static TaskPool& shared() {
+        return *shared_instance();
+    }
+
+    /**
+     * Configure the process-wide pool
+     * NOTE: must be called before its first use
+     */
+    static void configure_shared(size_t num_workers, bool pin_workers = false) {
+        std::unique_ptr<TaskPool> &pool = shared_instance();
+        assert(!pool->started_.load());
+        pool.reset(new TaskPool(num_workers, pin_workers));
+    }
+
+    /**
+     * @return the number of worker threads (the calling thread of parallel_for() is not counted)
+     */
+    size_t num_workers() const { return num_workers_; }
+
+    /**
+     * Run f(chunk_begin, chunk_end) over the chunks of [begin, end), in parallel, and wait until all are done
+     * @param grain: the max size of a chunk; 0 picks one that gives each thread a few chunks to balance
+     * @param f: called concurrently on disjoint chunks
+     */
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F &&f) {
+        if (begin >= end) return;
+        size_t n = end - begin;
+        if (grain == 0) grain = std::max<size_t>(1, n / ((num_workers_ + 1) * CHUNKS_PER_THREAD));
+        if (num_workers_ == 0 || n <= grain) {
+            f(begin, end);
+            return;
+        }
+        start();
+
+        Job job;
+        job.fn = [&f](size_t b, size_t e) { f(b, e); };
+        size_t num_chunks = (n + grain - 1) / grain;
+        job.remaining.store(num_chunks, std::memory_order_relaxed);
+
+        // one contiguous batch of chunks per worker
+        num_tasks_.fetch_add(num_chunks, std::memory_order_relaxed);
+        size_t chunk = 0;
+        for (size_t w = 0; w < num_workers_ && chunk < num_chunks; w++) {
+            size_t batch_end = chunk + (num_chunks - chunk + (num_workers_ - w) - 1) / (num_workers_ - w);
+            Worker &worker = *workers_[w];
+            {
+                std::lock_guard<atomic_queue::Spinlock> lock(worker.lock);
+                for (; chunk < batch_end; chunk++) {
+                    worker.tasks.push_back(Task{&job, begin + chunk * grain, std::min(end, begin + (chunk + 1) * grain)});
+                }
+            }
+        }
+        work_.notify_all();
+
+        // help until the job is done; then wait for the chunks still running in the workers
+        Task task;
+        while (job.remaining.load(std::memory_order_acquire) > 0 && steal(0, task)) run(task);
+        done_.await([&job]() { return job.remaining.load(std::memory_order_acquire) == 0; });
+    }
+
+    /**
+     * Stable sort of [first, last) in parallel: the chunks are sorted concurrently, then neighboring runs are
+     * merged pairwise, each round in parallel
+     * @param comp: the strict weak order
+     * @param min_chunk_size: inputs smaller than two chunks are sorted serially
+     */
+    template<typename Iter, typename Compare>
+    void parallel_stable_sort(Iter first, Iter last, Compare comp, size_t min_chunk_size = 1 << 14) {
+        size_t n = last - first;
+        size_t num_chunks = std::min(n / std::max<size_t>(min_chunk_size, 1), (num_workers_ + 1) * CHUNKS_PER_THREAD);
+        if (num_workers_ == 0 || num_chunks < 2) {
+            std::stable_sort(first, last, comp);
+            return;
+        }
+        auto bound = [first, n, num_chunks](size_t chunk) { return first + n * std::min(chunk, num_chunks) / num_chunks; };
+
+        parallel_for(0, num_chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) std::stable_sort(bound(c), bound(c + 1), comp);
+        });
+        for (size_t width = 1; width < num_chunks; width *= 2) {
+            size_t num_merges = (num_chunks + 2 * width - 1) / (2 * width);
+            parallel_for(0, num_merges, 1, [&](size_t begin, size_t end) {
+                for (size_t m = begin; m < end; m++) {
+                    size_t lo = m * 2 * width;
+                    if (lo + width < num_chunks) std::inplace_merge(bound(lo), bound(lo + width), bound(lo + 2 * width), comp);
+                }
+            });
+        }
+    }
+
+private:
+    static constexpr size_t CHUNKS_PER_THREAD = 4;
+
+    struct Job {
+        std::function<void(size_t, size_t)> fn;
+        std::atomic<size_t> remaining; // the chunks not done yet
+    };
+
+    struct Task {
+        Job *job;
+        size_t begin;
+        size_t end;
+    };
+
+    struct alignas(64) Worker {
+        atomic_queue::Spinlock lock;
+        std::deque<Task> tasks; // the owner pops from the back, thieves steal from the front
+    };
+
+    static std::unique_ptr<TaskPool>& shared_instance() {
+        static std::unique_ptr<TaskPool> pool(new TaskPool());
+        return pool;
+    }
+
+    // start the worker threads, once
+    void start() {
+        if (started_.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> lock(start_mutex_);
+        if (started_.load(std::memory_order_relaxed)) return;
+        for (size_t i = 0; i < num_workers_; i++) workers_.emplace_back(new Worker());
+        size_t num_cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < num_workers_; i++) {
+            threads_.emplace_back(&TaskPool::work, this, i, pin_workers_ ? (int)(i % num_cores) : -1);
+        }
+        started_.store(true, std::memory_order_release);
+    }
+
+    // the worker threads
+    void work(size_t id, int cpu) {
+        if (cpu >= 0) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+        }
+        Task task;
+        while (true) {
+            if (pop(id, task) || steal(id + 1, task)) {
+                run(task);
+                continue;
+            }
+            work_.await([this]() {
+                return num_tasks_.load(std::memory_order_acquire) > 0 || shutdown_.load(std::memory_order_acquire);
+            });
+            if (shutdown_.load(std::memory_order_acquire) && num_tasks_.load(std::memory_order_acquire) == 0) return;
+        }
+    }
+
+    bool pop(size_t id, Task &task) {
+        Worker &worker = *workers_[id];
+        std::lock_guard<atomic_queue::Spinlock> lock(worker.lock);
+        if (worker.tasks.empty()) return false;
+        task = worker.tasks.back();
+        worker.tasks.pop_back();
+        num_tasks_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // steal a task from the workers, starting with worker first
+    bool steal(size_t first, Task &task) {
+        for (size_t i = 0; i < num_workers_; i++) {
+            Worker &worker = *workers_[(first + i) % num_workers_];
+            if (num_tasks_.load(std::memory_order_relaxed) == 0) return false;
+            std::lock_guard<atomic_queue::Spinlock> lock(worker.lock);
+            if (worker.tasks.empty()) continue;
+            task = worker.tasks.front();
+            worker.tasks.pop_front();
+            num_tasks_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void run(Task &task) {
+        Job *job = task.job;
+        job->fn(task.begin, task.end);
+        // NOTE: the job may be gone as soon as remaining is 0
+        if (job->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) done_.notify_all();
+    }
+
+    size_t num_workers_;
+    bool pin_workers_;
+    std::atomic<bool> started_;
+    std::mutex start_mutex_;
+    std::atomic<bool> shutdown_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> num_tasks_; // the tasks in the deques
+    EventCount work_; // the workers wait for tasks
+    EventCount done_; // the callers of parallel_for() wait for their jobs
+};
+
+} // end namespace buckindex
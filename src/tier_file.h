@@ -0,0 +1,104 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+#include<mutex>
+#include<stdexcept>
+#include<string>
+#include<vector>
+#include<fcntl.h>
+#include<unistd.h>
+
+namespace buckindex {
+
+/**
+ * TierFile: a local file of fixed-size slots, the cold tier of a tiered index (see BuckIndex::enable_tiering())
+ * write() stores a node image in a free slot and returns the slot; read() copies it back. The freed slots are
+ * reused before the file grows. The file is scratch space: it is created empty, and removed when closed.
+ * NOTE: thread-safe; a slot must not be freed while it may still be read
+ */
+class TierFile {
+public:
+    /**
+     * Create the file
+     * @param path: the file; overwritten
+     * @param slot_size: the size of a slot
+     * @throw std::runtime_error if the file cannot be created
+     */
+    TierFile(const std::string &path, size_t slot_size) : path_(path), slot_size_(slot_size), num_slots_(0) {
+        fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) throw std::runtime_error("cannot create tier file " + path);
+    }
+
+    ~TierFile() {
+        close(fd_);
+        unlink(path_.c_str());
+    }
+
+    TierFile(const TierFile&) = delete;
+    TierFile& operator=(const TierFile&) = delete;
+
+    /**
+     * Store an image in a free slot
+     * @param data: slot_size bytes
+     * @return the slot
+     * @throw std::runtime_error if the write fails; the slot is not used
+     */
+    uint64_t write(const void *data) {
+        uint64_t slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (free_slots_.empty()) {
+                slot = num_slots_++;
+            } else {
+                slot = free_slots_.back();
+                free_slots_.pop_back();
+            }
+        }
+        if (pwrite(fd_, data, slot_size_, slot * slot_size_) != (ssize_t)slot_size_) {
+            free(slot);
+            throw std::runtime_error("cannot write tier file " + path_);
+        }
+        return slot;
+    }
+
+    /**
+     * Copy the image of a slot
+     * @param slot: a slot returned by write(), not freed
+     * @param data: slot_size bytes
+     * @throw std::runtime_error if the read fails
+     */
+    void read(uint64_t slot, void *data) const {
+        if (pread(fd_, data, slot_size_, slot * slot_size_) != (ssize_t)slot_size_) {
+            throw std::runtime_error("cannot read tier file " + path_);
+        }
+    }
+
+    /**
+     * Return a slot for reuse
+     */
+    void free(uint64_t slot) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_slots_.push_back(slot);
+    }
+
+    /**
+     * @return the number of slots in use
+     */
+    uint64_t num_used() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_slots_ - free_slots_.size();
+    }
+
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    size_t slot_size_;
+    int fd_;
+    std::mutex mutex_; // protects num_slots_ and free_slots_
+    uint64_t num_slots_; // the size of the file, in slots
+    std::vector<uint64_t> free_slots_;
+};
+
+} // end namespace buckindex
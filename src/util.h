@@ -598,9 +598,9 @@ void * get_random_key_for_clhash(uint64_t seed1, uint64_t seed2) {
 }
 #endif //HINT_CL_HASH
 
-#ifdef HINT_MURMUR_HASH
 // murmur hash function for 64-bit
-uint64_t murmur64(uint64_t key) {
+// always available: used by HINT_MURMUR_HASH and by the hash-based hint type of HINT_ADAPTIVE
+inline uint64_t murmur64(uint64_t key) {
     key ^= key >> 33;
     key *= 0xff51afd7ed558ccd;
     key ^= key >> 33;
@@ -608,7 +608,6 @@ uint64_t murmur64(uint64_t key) {
     key ^= key >> 33;
     return key;
 }
-#endif
 
 #ifdef HINT_CL_HASH
 uint64_t clhash64(uint64_t key) {
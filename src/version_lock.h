@@ -0,0 +1,137 @@
+#pragma once
+
+#include<cstdint>
+#include<atomic>
+#include<limits>
+#include<thread>
+
+namespace buckindex {
+
+/**
+ * VersionLock: a seqlock-style version counter for optimistic reads, with a writer lock
+ * The writer makes the version odd while it modifies the protected data, and even again afterwards.
+ * A reader takes the (even) version before reading and validates it did not change after reading;
+ * otherwise the data may be torn and the read must be retried. Readers never write shared memory.
+ * With multiple writers, a writer must own the node before modifying it: either lock() it, or upgrade
+ * an optimistic read with try_lock(), which fails if the node changed since the read (lock coupling).
+ * A node replaced by a structural modification is marked obsolete, so it can not be locked anymore.
+ * The lock and obsolete flags are the two top bits; the counter wraps below them.
+ * T is the counter type; a narrow counter only risks a false validation if a reader stalls during
+ * a multiple of 2^(bits-3) writes to the same node.
+ */
+template<typename T>
+class VersionLock {
+public:
+    static constexpr T LOCKED = T(1) << (std::numeric_limits<T>::digits - 1);
+    static constexpr T OBSOLETE = T(1) << (std::numeric_limits<T>::digits - 2);
+    static constexpr T FLAGS = LOCKED | OBSOLETE;
+
+    VersionLock() : version_(0) {}
+
+    // a copied node is a new node; it does not inherit the version
+    VersionLock(const VersionLock&) : version_(0) {}
+    VersionLock& operator=(const VersionLock&) { return *this; }
+
+    /**
+     * Writer: start modifying the protected data
+     * NOTE: the caller is the only writer, or holds the lock
+     */
+    inline void write_begin() {
+        T v = version_.load(std::memory_order_relaxed);
+        version_.store(T((v & FLAGS) | ((v + 1) & ~FLAGS)), std::memory_order_relaxed);
+        // the odd version is visible before any of the modifications
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /**
+     * Writer: finish modifying the protected data
+     */
+    inline void write_end() {
+        T v = version_.load(std::memory_order_relaxed);
+        version_.store(T((v & FLAGS) | ((v + 1) & ~FLAGS)), std::memory_order_release);
+    }
+
+    /**
+     * Reader: wait until no write is in progress
+     * @return the version to validate against
+     */
+    inline T read_begin() const {
+        T v = version_.load(std::memory_order_acquire);
+        while (v & 1) {
+            std::this_thread::yield();
+            v = version_.load(std::memory_order_acquire);
+        }
+        return v;
+    }
+
+    /**
+     * Reader: check that the data read since read_begin() is consistent
+     * Taking or releasing the lock does not modify the data, so it does not fail the validation
+     * @param v: the version returned by read_begin()
+     * @return true if no write happened in between
+     */
+    inline bool read_validate(T v) const {
+        // the reads of the data happen before the version is re-read
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return T((version_.load(std::memory_order_relaxed) ^ v) & ~LOCKED) == 0;
+    }
+
+    inline T get_version() const { return version_.load(std::memory_order_relaxed); }
+
+    /**
+     * Writer: upgrade an optimistic read to the lock
+     * @param v: the version returned by read_begin()
+     * @return true if the lock is taken; false if the node is locked, obsolete or was modified since v
+     */
+    inline bool try_lock(T v) {
+        if (v & FLAGS) return false;
+        return version_.compare_exchange_strong(v, T(v | LOCKED), std::memory_order_acquire);
+    }
+
+    /**
+     * Writer: take the lock, waiting for its current owner
+     * @return true if the lock is taken; false if the node is obsolete
+     */
+    inline bool lock() {
+        while (true) {
+            T v = version_.load(std::memory_order_relaxed);
+            if (v & OBSOLETE) return false;
+            if (!(v & (LOCKED | 1)) && version_.compare_exchange_weak(v, T(v | LOCKED), std::memory_order_acquire)) {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Writer: release the lock taken by lock() or try_lock()
+     */
+    inline void unlock() {
+        version_.fetch_and(T(~LOCKED), std::memory_order_release);
+    }
+
+    /**
+     * Writer: mark the locked node as replaced; lock() and try_lock() fail from now on
+     */
+    inline void mark_obsolete() {
+        version_.fetch_or(OBSOLETE, std::memory_order_release);
+    }
+
+    /**
+     * RAII write_begin()/write_end()
+     */
+    class WriteGuard {
+    public:
+        explicit WriteGuard(VersionLock &lock) : lock_(lock) { lock_.write_begin(); }
+        ~WriteGuard() { lock_.write_end(); }
+        WriteGuard(const WriteGuard&) = delete;
+        WriteGuard& operator=(const WriteGuard&) = delete;
+    private:
+        VersionLock &lock_;
+    };
+
+private:
+    std::atomic<T> version_;
+};
+
+} // end namespace buckindex
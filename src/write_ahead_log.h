@@ -0,0 +1,386 @@
+#pragma once
+
+#include<cstdint>
+#include<cstddef>
+#include<cstring>
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<functional>
+#include<mutex>
+#include<stdexcept>
+#include<string>
+#include<thread>
+#include<vector>
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+#include "atomic_queue/spinlock.h"
+#include "keyvalue.h"
+#include "event_count.h"
+
+namespace buckindex {
+
+/**
+ * Type of a record of the write-ahead log
+ */
+enum WalRecordType : uint32_t {
+    WAL_INSERT = 1 // BuckIndex::insert()
+};
+
+/**
+ * WriteAheadLog: an append-only log of the writes to an index, with group commit
+ * append() assigns the next log sequence number (LSN) to a record and copies it to an in-memory buffer; a flusher
+ * thread writes the buffer to the file and syncs it (fdatasync) once per commit interval, or as soon as
+ * GROUP_COMMIT_BYTES are buffered, so one sync makes the records of many writers durable. wait_durable() blocks
+ * until the sync that covers an LSN (see EventCount).
+ * File: a header (magic, version, sizes, base LSN), then fixed-size records with consecutive LSNs from base + 1,
+ * each with a checksum; a torn or corrupt tail (e.g., a crash during a write) ends the log, and is cut off when
+ * the log is reopened. restart() replaces the log by an empty one after a checkpoint (see BLI_durable).
+ * Native byte order
+ */
+template<typename T, typename V>
+class WriteAheadLog {
+public:
+    using KeyValueType = KeyValue<T, V>;
+    static constexpr size_t GROUP_COMMIT_BYTES = 1 << 20; // buffered bytes that trigger a sync before the interval
+
+    /**
+     * Open a log for appending, or create it
+     * @param path: the log file; its valid records are kept, after a torn tail is cut off
+     * @param commit_interval: the latency budget of the group commit, i.e., the max wait before a sync
+     * @param base_lsn: the LSN before the first record, if the log is created
+     * @throw std::runtime_error if the file cannot be opened or is not a log of the same key and value types
+     */
+    WriteAheadLog(const std::string &path, std::chrono::microseconds commit_interval, uint64_t base_lsn = 0)
+        : path_(path), commit_interval_(commit_interval), fd_(-1), stop_(false), failed_(false) {
+        uint64_t last_lsn = base_lsn;
+        uint64_t valid_bytes = 0;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            valid_bytes = replay(path, 0, [&last_lsn](uint64_t lsn, WalRecordType, const KeyValueType&) {
+                last_lsn = lsn;
+            }, &last_lsn);
+            fd_ = open(path.c_str(), O_WRONLY);
+            if (fd_ < 0 || ftruncate(fd_, valid_bytes) != 0 || lseek(fd_, 0, SEEK_END) < 0) {
+                if (fd_ >= 0) close(fd_);
+                throw std::runtime_error("cannot open log " + path);
+            }
+        } else {
+            fd_ = create(path, base_lsn);
+        }
+        next_lsn_ = last_lsn + 1;
+        appended_lsn_.store(last_lsn, std::memory_order_relaxed);
+        durable_lsn_.store(last_lsn, std::memory_order_relaxed);
+        flusher_ = std::thread(&WriteAheadLog::run, this);
+    }
+
+    // the appended records are made durable before the flusher thread exits
+    ~WriteAheadLog() {
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex_);
+            stop_ = true;
+        }
+        flush_cv_.notify_one();
+        flusher_.join();
+        close(fd_);
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /**
+     * Append a record; it is durable once wait_durable() returns for its LSN
+     * @return the LSN of the record
+     */
+    uint64_t append(WalRecordType type, const KeyValueType &kv) {
+        Record record = make_record(0, type, kv);
+        uint64_t lsn;
+        bool first;
+        {
+            std::lock_guard<atomic_queue::Spinlock> lock(buffer_lock_);
+            lsn = next_lsn_++;
+            record.lsn = lsn;
+            record.checksum = checksum(record);
+            first = buffer_.empty();
+            buffer_.insert(buffer_.end(), (const char *)&record, (const char *)&record + sizeof(record));
+            appended_lsn_.store(lsn, std::memory_order_release);
+            if (buffer_.size() >= GROUP_COMMIT_BYTES && buffer_.size() - sizeof(record) < GROUP_COMMIT_BYTES) {
+                first = true; // the batch is full: sync now
+            }
+        }
+        if (first) {
+            // the flusher sleeps on flush_mutex_; taking it orders this append before its next check
+            { std::lock_guard<std::mutex> lock(flush_mutex_); }
+            flush_cv_.notify_one();
+        }
+        return lsn;
+    }
+
+    /**
+     * Wait until the record of lsn is durable
+     * @throw std::runtime_error if the log could not be written
+     */
+    void wait_durable(uint64_t lsn) {
+        durable_.await([this, lsn]() {
+            return durable_lsn_.load(std::memory_order_acquire) >= lsn || failed_.load(std::memory_order_acquire);
+        });
+        if (durable_lsn_.load(std::memory_order_acquire) < lsn) throw std::runtime_error("cannot write log " + path_);
+    }
+
+    /**
+     * Make all the appended records durable, without waiting for the commit interval
+     */
+    void flush() {
+        uint64_t lsn = appended_lsn_.load(std::memory_order_acquire);
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex_);
+            flush_now_ = true;
+        }
+        flush_cv_.notify_one();
+        wait_durable(lsn);
+    }
+
+    /**
+     * @return the LSN of the last appended record (or the base LSN)
+     */
+    uint64_t last_lsn() const { return appended_lsn_.load(std::memory_order_acquire); }
+
+    /**
+     * @return the LSN of the last durable record (or the base LSN)
+     */
+    uint64_t durable_lsn() const { return durable_lsn_.load(std::memory_order_acquire); }
+
+    /**
+     * Replace the log by an empty one whose base LSN is the last LSN, e.g., once a checkpoint covers all the records
+     * The new log is synced and renamed over the old one, so a crash leaves one of them
+     * NOTE: no append may run concurrently
+     */
+    void restart() {
+        flush();
+        std::lock_guard<std::mutex> lock(io_mutex_);
+        std::string tmp_path = path_ + ".tmp";
+        int fd = create(tmp_path, last_lsn());
+        if (rename(tmp_path.c_str(), path_.c_str()) != 0) {
+            close(fd);
+            throw std::runtime_error("cannot restart log " + path_);
+        }
+        sync_parent_dir(path_);
+        close(fd_);
+        fd_ = fd;
+    }
+
+    /**
+     * Read the valid records of a log, in order
+     * @param from_lsn: the records up to this LSN are skipped
+     * @param f: called with (lsn, type, kv) for each record after from_lsn
+     * @param base_lsn: if not nullptr, set to the base LSN of the log
+     * @return the size of the valid part of the log, i.e., before a torn or corrupt tail
+     * @throw std::runtime_error if the file cannot be read or is not a log of the same key and value types
+     */
+    template<typename F>
+    static uint64_t replay(const std::string &path, uint64_t from_lsn, F &&f, uint64_t *base_lsn = nullptr) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open log " + path);
+        Header header;
+        if (read_fully(fd, &header, sizeof(header)) != sizeof(header) || !header_matches(header)) {
+            close(fd);
+            throw std::runtime_error("not a log of this index: " + path);
+        }
+        if (base_lsn) *base_lsn = header.base_lsn;
+
+        uint64_t valid_bytes = sizeof(header);
+        uint64_t expected_lsn = header.base_lsn + 1;
+        std::vector<Record> chunk(REPLAY_CHUNK_RECORDS);
+        bool torn = false;
+        while (!torn) {
+            size_t n = read_fully(fd, chunk.data(), chunk.size() * sizeof(Record)) / sizeof(Record);
+            for (size_t i = 0; i < n; i++) {
+                const Record &record = chunk[i];
+                if (record.lsn != expected_lsn || record.checksum != checksum(record)) {
+                    torn = true;
+                    break;
+                }
+                if (record.lsn > from_lsn) f(record.lsn, (WalRecordType)record.type, KeyValueType(record.key, record.value));
+                expected_lsn++;
+                valid_bytes += sizeof(Record);
+            }
+            if (n < chunk.size()) break;
+        }
+        close(fd);
+        return valid_bytes;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'B', 'L', 'I', 'W', 'A', 'L', 0, 0};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t REPLAY_CHUNK_RECORDS = 1 << 16;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_size; // sizeof(T)
+        uint32_t value_size; // sizeof(V)
+        uint32_t record_size;
+        uint64_t base_lsn; // the LSN before the first record
+    };
+
+    struct Record {
+        uint64_t lsn;
+        uint32_t type; // WalRecordType
+        uint32_t checksum; // of the record with checksum = 0
+        T key;
+        V value;
+    };
+
+    static Header make_header(uint64_t base_lsn) {
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.key_size = sizeof(T);
+        header.value_size = sizeof(V);
+        header.record_size = sizeof(Record);
+        header.base_lsn = base_lsn;
+        return header;
+    }
+
+    static bool header_matches(const Header &header) {
+        Header expected = make_header(header.base_lsn);
+        return memcmp(&header, &expected, sizeof(Header)) == 0;
+    }
+
+    static Record make_record(uint64_t lsn, WalRecordType type, const KeyValueType &kv) {
+        Record record;
+        memset(&record, 0, sizeof(record)); // the padding is checksummed too
+        record.lsn = lsn;
+        record.type = type;
+        record.key = kv.key_;
+        record.value = kv.value_;
+        return record;
+    }
+
+    // FNV-1a of the record, with the checksum field as 0
+    static uint32_t checksum(const Record &record) {
+        Record copy = record;
+        copy.checksum = 0;
+        const unsigned char *bytes = (const unsigned char *)&copy;
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(copy); i++) hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+
+    // create a synced log with only a header
+    static int create(const std::string &path, uint64_t base_lsn) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        Header header = make_header(base_lsn);
+        if (fd < 0 || !write_fully(fd, &header, sizeof(header)) || fdatasync(fd) != 0) {
+            if (fd >= 0) close(fd);
+            throw std::runtime_error("cannot create log " + path);
+        }
+        sync_parent_dir(path);
+        return fd;
+    }
+
+    // sync the directory of path, so a created or renamed file survives a crash
+    static void sync_parent_dir(const std::string &path) {
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        int fd = open(dir.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        fsync(fd);
+        close(fd);
+    }
+
+    static bool write_fully(int fd, const void *data, size_t bytes) {
+        const char *p = (const char *)data;
+        while (bytes > 0) {
+            ssize_t n = write(fd, p, bytes);
+            if (n <= 0) return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    // @return the number of bytes read; less than bytes at the end of the file
+    static size_t read_fully(int fd, void *data, size_t bytes) {
+        char *p = (char *)data;
+        size_t total = 0;
+        while (total < bytes) {
+            ssize_t n = read(fd, p + total, bytes - total);
+            if (n <= 0) break;
+            total += n;
+        }
+        return total;
+    }
+
+    // the flusher thread: one write and one sync per group of records
+    void run() {
+        std::vector<char> batch;
+        std::unique_lock<std::mutex> lock(flush_mutex_);
+        while (true) {
+            flush_cv_.wait(lock, [this]() { return stop_ || pending(); });
+            // let the group grow for the commit interval, unless it is full or a flush is requested
+            flush_cv_.wait_for(lock, commit_interval_, [this]() {
+                return stop_ || flush_now_ || pending_bytes() >= GROUP_COMMIT_BYTES;
+            });
+            flush_now_ = false;
+            bool stop = stop_;
+            lock.unlock();
+
+            uint64_t lsn;
+            {
+                std::lock_guard<atomic_queue::Spinlock> buffer_lock(buffer_lock_);
+                batch.swap(buffer_);
+                lsn = appended_lsn_.load(std::memory_order_relaxed);
+            }
+            if (!batch.empty() && !failed_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> io_lock(io_mutex_);
+                if (write_fully(fd_, batch.data(), batch.size()) && fdatasync(fd_) == 0) {
+                    durable_lsn_.store(lsn, std::memory_order_release);
+                } else {
+                    failed_.store(true, std::memory_order_release);
+                }
+            }
+            batch.clear();
+            durable_.notify_all();
+
+            lock.lock();
+            if (stop && !pending()) return;
+        }
+    }
+
+    bool pending() {
+        return appended_lsn_.load(std::memory_order_acquire) != durable_lsn_.load(std::memory_order_relaxed) &&
+               !failed_.load(std::memory_order_relaxed);
+    }
+
+    size_t pending_bytes() {
+        std::lock_guard<atomic_queue::Spinlock> lock(buffer_lock_);
+        return buffer_.size();
+    }
+
+    std::string path_;
+    std::chrono::microseconds commit_interval_;
+    int fd_;
+    std::mutex io_mutex_; // serializes the writes to fd_ and restart()
+
+    atomic_queue::Spinlock buffer_lock_; // protects next_lsn_ and buffer_
+    uint64_t next_lsn_;
+    std::vector<char> buffer_; // the records not handed to the flusher yet
+    std::atomic<uint64_t> appended_lsn_;
+
+    std::mutex flush_mutex_; // the flusher sleeps on flush_cv_ with it
+    std::condition_variable flush_cv_;
+    bool stop_;
+    bool flush_now_ = false;
+    std::thread flusher_;
+
+    alignas(64) std::atomic<uint64_t> durable_lsn_;
+    std::atomic<bool> failed_;
+    EventCount durable_; // the writers wait for their records
+};
+
+} // end namespace buckindex
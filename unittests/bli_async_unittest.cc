@@ -0,0 +1,83 @@
+#include "gtest/gtest.h"
+
+#include "bli_async.h"
+
+#include<vector>
+#include<thread>
+
+
+namespace buckindex {
+    using AsyncIndex = BLI_async<uint64_t, uint64_t, 8, 16>;
+
+    TEST(BLI_async, tokens) {
+        AsyncIndex bli;
+        AsyncIndex::Client &client = bli.register_client();
+
+        std::vector<AsyncIndex::Token> tokens;
+        const uint64_t N = 1000; // more than RING_SIZE, so the client is throttled
+        for (uint64_t i = 1; i <= N; i++) {
+            tokens.push_back(bli.insert_async(client, KeyValue<uint64_t, uint64_t>(i * 10, i)));
+            EXPECT_LE(client.num_outstanding(), AsyncIndex::RING_SIZE);
+        }
+        // the latest tokens are still readable
+        for (uint64_t i = N - AsyncIndex::RING_SIZE; i < N; i++) {
+            EXPECT_TRUE(client.wait(tokens[i]));
+            EXPECT_TRUE(client.done(tokens[i]));
+        }
+        EXPECT_EQ(0u, client.num_outstanding());
+
+        uint64_t value;
+        for (uint64_t i = 1; i <= N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10, value));
+            EXPECT_EQ(i, value);
+        }
+        bool found = true;
+        bli.lookup_async(5, [&found](bool f, uint64_t v) { found = f; });
+        EXPECT_FALSE(found);
+    }
+
+    TEST(BLI_async, callbacks) {
+        AsyncIndex bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < 1000; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10, i));
+        bli.bulk_load(kvs);
+
+        // each client polls its completions, like an event loop
+        const int num_clients = 4;
+        const uint64_t N = 2000;
+        std::vector<std::thread> clients;
+        for (int t = 0; t < num_clients; t++) {
+            clients.emplace_back([&bli, t, N]() {
+                AsyncIndex::Client &client = bli.register_client();
+                uint64_t num_succeeded = 0, num_completed = 0;
+                for (uint64_t i = 0; i < N; i++) {
+                    uint64_t key = (i * num_clients + t) * 10 + 5;
+                    bli.insert_async(client, KeyValue<uint64_t, uint64_t>(key, key + 1),
+                                     [&](bool success) { num_succeeded += success; num_completed++; });
+                    client.poll();
+                    uint64_t value;
+                    EXPECT_TRUE(bli.lookup((i % 1000) * 10, value)); // reads do not wait for the writes
+                }
+                client.drain();
+                EXPECT_EQ(N, num_completed);
+                EXPECT_EQ(N, num_succeeded);
+            });
+        }
+        for (auto &client : clients) client.join();
+
+        uint64_t value;
+        for (uint64_t i = 0; i < N * num_clients; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 5, value));
+            EXPECT_EQ(i * 10 + 6, value);
+        }
+    }
+
+    TEST(BLI_async, destructor_with_outstanding) {
+        AsyncIndex bli;
+        AsyncIndex::Client &client = bli.register_client();
+        for (uint64_t i = 1; i <= 10; i++) {
+            bli.insert_async(client, KeyValue<uint64_t, uint64_t>(i, i));
+        }
+        // the destructor joins the owner thread once the inserts are applied
+    }
+}
@@ -0,0 +1,58 @@
+#include "gtest/gtest.h"
+
+#include "bli_concurrent.h"
+
+#include<vector>
+#include<thread>
+#include<random>
+#include<algorithm>
+
+
+namespace buckindex {
+    void insert_from_threads(BLI_concurrent<uint64_t, uint64_t, 4, 8> &bli, int num_threads, uint64_t n) {
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < n; i++) {
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        }
+        bli.bulk_load(kvs);
+
+        // each thread inserts its own keys in random order; the key ranges of the threads interleave
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&bli, t, n]() {
+                std::vector<uint64_t> keys;
+                for (uint64_t i = 0; i < n; i++) keys.push_back(i * 10 + 2 + t);
+                std::shuffle(keys.begin(), keys.end(), std::mt19937(t));
+                for (auto key : keys) {
+                    int ret = -1;
+                    bli.insert(KeyValue<uint64_t, uint64_t>(key, key * 2), &ret);
+                    EXPECT_EQ(1, ret);
+                }
+            });
+        }
+        for (auto &thread : threads) thread.join();
+
+        uint64_t value;
+        for (uint64_t i = 0; i < n; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+            for (int t = 0; t < num_threads; t++) {
+                uint64_t key = i * 10 + 2 + t;
+                EXPECT_TRUE(bli.lookup(key, value));
+                EXPECT_EQ(key * 2, value);
+            }
+        }
+    }
+
+    TEST(BLI_concurrent, combined_inserts) {
+        BLI_concurrent<uint64_t, uint64_t, 4, 8> bli;
+        bli.init(0.7, 8);
+        insert_from_threads(bli, 4, 10000);
+    }
+
+    TEST(BLI_concurrent, parallel_inserts) {
+        BLI_concurrent<uint64_t, uint64_t, 4, 8> bli;
+        bli.init(0.7, 8, false);
+        insert_from_threads(bli, 4, 10000);
+    }
+}
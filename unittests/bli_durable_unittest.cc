@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+
+#include "bli_durable.h"
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+
+namespace buckindex {
+    using DurableIndex = BLI_durable<uint64_t, uint64_t, 8, 16>;
+
+    TEST(BLI_durable, recovery) {
+        const std::string dir = testing::TempDir() + "bli_durable";
+        std::filesystem::remove_all(dir);
+        TaskPool pool(3);
+        const uint64_t N = 20000;
+        {
+            DurableIndex bli(dir, std::chrono::microseconds(100), 0.7, 8, &pool);
+            for (uint64_t i = 1; i <= 100; i++) EXPECT_TRUE(bli.insert(KeyValue<uint64_t, uint64_t>(i * 10, i)));
+            std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+            std::vector<bool> results;
+            for (uint64_t i = 101; i <= N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10, i));
+            EXPECT_EQ(kvs.size(), bli.insert_batch(kvs, results));
+            EXPECT_EQ(N, bli.durable_lsn());
+        }
+
+        // the whole log is replayed
+        {
+            DurableIndex bli(dir, std::chrono::microseconds(100), 0.7, 8, &pool);
+            uint64_t value;
+            for (uint64_t i = 1; i <= N; i++) {
+                ASSERT_TRUE(bli.lookup(i * 10, value));
+                ASSERT_EQ(i, value);
+            }
+            bli.checkpoint();
+            EXPECT_TRUE(std::filesystem::exists(dir + "/snapshot-" + std::string(15, '0') + "20000"));
+
+            // writers that do not wait, from several threads
+            std::vector<std::thread> threads;
+            for (uint64_t t = 0; t < 4; t++) {
+                threads.emplace_back([&bli, t]() {
+                    for (uint64_t i = 0; i < 1000; i++) bli.insert_nowait(KeyValue<uint64_t, uint64_t>((i * 4 + t) * 10 + 5, t));
+                });
+            }
+            for (auto &thread : threads) thread.join();
+            bli.sync();
+            EXPECT_EQ(N + 4000, bli.durable_lsn());
+        }
+
+        // the checkpoint, then the log after it; a torn last record is dropped
+        struct stat st;
+        ASSERT_EQ(0, stat((dir + "/wal").c_str(), &st));
+        ASSERT_EQ(0, truncate((dir + "/wal").c_str(), st.st_size - 1));
+        {
+            DurableIndex bli(dir, std::chrono::microseconds(100), 0.7, 8, &pool);
+            EXPECT_EQ(N + 3999, bli.durable_lsn());
+            uint64_t value;
+            for (uint64_t i = 1; i <= N; i++) {
+                ASSERT_TRUE(bli.lookup(i * 10, value));
+                ASSERT_EQ(i, value);
+            }
+            size_t num_found = 0;
+            for (uint64_t i = 0; i < 4000; i++) num_found += bli.lookup(i * 10 + 5, value);
+            EXPECT_EQ(3999u, num_found);
+            EXPECT_TRUE(bli.insert(KeyValue<uint64_t, uint64_t>(N * 10 + 10, 1))); // the LSNs go on
+            EXPECT_EQ(N + 4000, bli.durable_lsn());
+        }
+        std::filesystem::remove_all(dir);
+    }
+}
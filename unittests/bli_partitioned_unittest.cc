@@ -0,0 +1,163 @@
+#include "gtest/gtest.h"
+
+#include "bli_partitioned.h"
+
+#include<vector>
+#include<thread>
+#include<random>
+#include<algorithm>
+#include<chrono>
+#include<ctime>
+
+
+namespace buckindex {
+    using PartitionedIndex = BLI_partitioned<uint64_t, uint64_t, 8, 16>;
+
+    TEST(BLI_partitioned, insert_from_empty) {
+        PartitionedIndex bli(4, 0.7, 8, false);
+        EXPECT_EQ(4u, bli.get_num_shards());
+
+        // the initial ranges are uniform, so the keys spread over all the shards
+        const int num_clients = 4;
+        const uint64_t N = 5000;
+        const uint64_t stride = std::numeric_limits<uint64_t>::max() / (N * num_clients);
+        std::vector<std::thread> clients;
+        for (int t = 0; t < num_clients; t++) {
+            clients.emplace_back([&bli, t, N, stride]() {
+                for (uint64_t i = 1; i <= N; i++) {
+                    uint64_t key = (i * num_clients + t) * stride;
+                    EXPECT_TRUE(bli.insert(KeyValue<uint64_t, uint64_t>(key, i)));
+                }
+            });
+        }
+        for (auto &client : clients) client.join();
+
+        for (auto size : bli.get_shard_sizes()) EXPECT_GT(size, N / 2);
+        uint64_t value;
+        for (int t = 0; t < num_clients; t++) {
+            for (uint64_t i = 1; i <= N; i++) {
+                EXPECT_TRUE(bli.lookup((i * num_clients + t) * stride, value));
+                EXPECT_EQ(i, value);
+            }
+        }
+        EXPECT_FALSE(bli.lookup(stride / 2, value));
+    }
+
+    TEST(BLI_partitioned, bulk_load_and_scan) {
+        PartitionedIndex bli(4, 0.7, 8, false);
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 10000;
+        for (uint64_t i = 0; i < N; i++) {
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 3 + 100, i));
+        }
+        bli.bulk_load(kvs);
+
+        // the ranges are cut at the quantiles of the keys
+        auto boundaries = bli.get_boundaries();
+        for (size_t i = 1; i < boundaries.size(); i++) {
+            EXPECT_EQ(kvs[N * i / 4].key_, boundaries[i]);
+        }
+        for (auto size : bli.get_shard_sizes()) EXPECT_EQ(N / 4, size);
+
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 3 + 100, value));
+            EXPECT_EQ(i, value);
+            EXPECT_FALSE(bli.lookup(i * 3 + 101, value));
+        }
+        EXPECT_FALSE(bli.lookup(50, value)); // below the smallest key
+        EXPECT_FALSE(bli.insert(KeyValue<uint64_t, uint64_t>(50, 0)));
+
+        // scans continue across the shards
+        std::vector<std::pair<uint64_t, uint64_t>> result(N);
+        size_t n = bli.scan(0, N, result.data());
+        EXPECT_EQ(N, n);
+        for (uint64_t i = 0; i < n; i++) {
+            EXPECT_EQ(i * 3 + 100, result[i].first);
+            EXPECT_EQ(i, result[i].second);
+        }
+        n = bli.scan(boundaries[2] - 1, 10, result.data());
+        EXPECT_EQ(10u, n);
+        EXPECT_EQ(boundaries[2], result[0].first);
+        n = bli.scan((N - 5) * 3 + 100, 100, result.data());
+        EXPECT_EQ(5u, n);
+    }
+
+    TEST(BLI_partitioned, rebalance) {
+        PartitionedIndex bli(4, 0.7, 8, false);
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 8000;
+        for (uint64_t i = 0; i < N; i++) {
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        }
+        bli.bulk_load(kvs);
+        EXPECT_EQ(0u, bli.rebalance());
+
+        // skew: insert many keys into the range of the second shard
+        std::vector<uint64_t> keys;
+        for (uint64_t i = N / 4; i < N / 2; i++) {
+            for (uint64_t j = 2; j < 10; j++) keys.push_back(i * 10 + j);
+        }
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(0));
+        for (auto key : keys) EXPECT_TRUE(bli.insert(KeyValue<uint64_t, uint64_t>(key, key * 2)));
+        auto sizes = bli.get_shard_sizes();
+        EXPECT_EQ(N / 4 + keys.size(), sizes[1]);
+
+        // lookups from another client go on during the rebalance
+        std::atomic<bool> done(false);
+        std::thread client([&]() {
+            uint64_t value;
+            while (!done.load()) {
+                for (uint64_t i = 0; i < N; i += 7) {
+                    EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+                    EXPECT_EQ(i, value);
+                }
+            }
+        });
+        size_t num_rebalanced = 0;
+        for (int round = 0; round < 4; round++) num_rebalanced += bli.rebalance();
+        done = true;
+        client.join();
+        EXPECT_GT(num_rebalanced, 0u);
+
+        auto new_sizes = bli.get_shard_sizes();
+        EXPECT_LT(*std::max_element(new_sizes.begin(), new_sizes.end()), sizes[1]);
+        size_t total = 0;
+        for (auto size : new_sizes) total += size;
+        EXPECT_EQ(N + keys.size(), total);
+
+        // every key is still found, in its new shard, and inserts go on
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+        }
+        for (auto key : keys) {
+            EXPECT_TRUE(bli.lookup(key, value));
+            EXPECT_EQ(key * 2, value);
+        }
+        for (uint64_t i = 1; i < N; i++) {
+            EXPECT_TRUE(bli.insert(KeyValue<uint64_t, uint64_t>(i * 10, i)));
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> result(N * 10);
+        size_t n = bli.scan(0, N * 10, result.data());
+        EXPECT_EQ(2 * N - 1 + keys.size(), n);
+        for (size_t i = 1; i < n; i++) EXPECT_LT(result[i-1].first, result[i].first);
+    }
+
+    TEST(BLI_partitioned, idle_owners_sleep) {
+        PartitionedIndex bli(4, 0.7, 8, false);
+        EXPECT_TRUE(bli.insert(KeyValue<uint64_t, uint64_t>(1, 1)));
+
+        // the owners sleep while no request arrives, so the process uses (almost) no CPU
+        std::clock_t start = std::clock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        double cpu_ms = 1000.0 * (std::clock() - start) / CLOCKS_PER_SEC;
+        EXPECT_LT(cpu_ms, 50.0);
+
+        // and wake up on the next request
+        uint64_t value;
+        EXPECT_TRUE(bli.lookup(1, value));
+        EXPECT_EQ(1u, value);
+    }
+}
@@ -6,6 +6,11 @@
 #include <stdlib.h>
 #include <time.h>
 #include <unordered_set>
+#include <thread>
+#include <random>
+#include <list>
+#include <cstdio>
+#include <unistd.h>
 
 namespace buckindex {
 
@@ -250,6 +255,189 @@ namespace buckindex {
     }
 
 
+    TEST(BuckIndex, insert_batch) {
+        BuckIndex<uint64_t, uint64_t, 4, 8> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 2000;
+        for (uint64_t i = 0; i < N; i++) {
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        }
+        bli.bulk_load(kvs);
+
+        // sorted batches of various sizes, spanning one or many D-Buckets, some of which are split
+        std::vector<KeyValue<uint64_t, uint64_t>> batch;
+        std::vector<bool> results;
+        uint64_t num_batches = 0;
+        for (uint64_t j = 2; j < 10; j++) {
+            uint64_t batch_size;
+            for (uint64_t i = 0; i < N; i += batch_size) {
+                batch_size = num_batches++ % 7 + 1;
+                batch.clear();
+                for (uint64_t k = i; k < std::min(N, i + batch_size); k++) {
+                    batch.push_back(KeyValue<uint64_t, uint64_t>(k * 10 + j, k * 10 + j + 5));
+                }
+                EXPECT_EQ(batch.size(), bli.insert_batch(batch, results));
+                EXPECT_EQ(batch.size(), results.size());
+                for (auto result : results) EXPECT_TRUE(result);
+            }
+        }
+
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+            for (uint64_t j = 2; j < 10; j++) {
+                EXPECT_TRUE(bli.lookup(i * 10 + j, value));
+                EXPECT_EQ(i * 10 + j + 5, value);
+            }
+        }
+
+        // a batch into an empty index
+        BuckIndex<uint64_t, uint64_t, 4, 8> empty_bli;
+        for (uint64_t i = 0; i < 100; i++) {
+            batch.push_back(KeyValue<uint64_t, uint64_t>(i + 1, i));
+        }
+        batch.erase(batch.begin(), batch.end() - 100);
+        EXPECT_EQ(100u, empty_bli.insert_batch(batch, results));
+        for (uint64_t i = 0; i < 100; i++) {
+            EXPECT_TRUE(empty_bli.lookup(i + 1, value));
+            EXPECT_EQ(i, value);
+        }
+    }
+
+    TEST(BuckIndex, insert_batch_empty_sbucket) {
+        // blocks of 40 keys separated by gaps: the leaf segment keeps empty S-Buckets for the gaps,
+        // between non-empty ones, so a D-Bucket before a gap ends at the pivot of the next non-empty S-Bucket
+        BuckIndex<uint64_t, uint64_t, 4, 8> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        std::vector<uint64_t> keys;
+        for (uint64_t i = 0; i < 2000; i++) {
+            uint64_t key = (i / 40) * 400 + i * 10 + 1;
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(key, key));
+            keys.push_back(key);
+        }
+        bli.bulk_load(kvs);
+
+        // each batch has a key in a gap, and a key in the block after it, which belongs to the next D-Bucket
+        std::vector<KeyValue<uint64_t, uint64_t>> batch;
+        std::vector<bool> results;
+        for (uint64_t i = 40; i < 2000; i += 40) {
+            batch.clear();
+            batch.push_back(KeyValue<uint64_t, uint64_t>(kvs[i - 1].key_ + 200, 0));
+            batch.push_back(KeyValue<uint64_t, uint64_t>(kvs[i].key_ + 2, 0));
+            for (auto &kv : batch) {
+                kv.value_ = kv.key_;
+                keys.push_back(kv.key_);
+            }
+            EXPECT_EQ(batch.size(), bli.insert_batch(batch, results));
+        }
+
+        uint64_t value;
+        for (uint64_t key : keys) {
+            EXPECT_TRUE(bli.lookup(key, value));
+            EXPECT_EQ(key, value);
+        }
+        std::sort(keys.begin(), keys.end());
+        std::vector<std::pair<uint64_t, uint64_t>> result(keys.size());
+        EXPECT_EQ(keys.size(), bli.scan(keys[0], keys.size(), result.data()));
+        for (size_t i = 0; i < keys.size(); i++) EXPECT_EQ(keys[i], result[i].first);
+    }
+
+    TEST(BuckIndex, concurrent_insert) {
+        // small buckets, so the writers split D-Buckets and rebuild segments at every level concurrently
+        BuckIndex<uint64_t, uint64_t, 4, 8> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 20000;
+        const int num_writers = 4;
+        for (uint64_t i = 0; i < N; i++) {
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        }
+        bli.bulk_load(kvs);
+        uint64_t num_levels = bli.get_num_levels();
+
+        // each writer inserts its own keys in random order; the key ranges of the writers interleave
+        std::vector<std::thread> writers;
+        for (int t = 0; t < num_writers; t++) {
+            writers.emplace_back([&bli, t]() {
+                std::vector<uint64_t> keys;
+                for (uint64_t i = 0; i < N; i++) keys.push_back(i * 10 + 2 + t);
+                std::shuffle(keys.begin(), keys.end(), std::mt19937(t));
+                for (auto key : keys) {
+                    EpochGuard guard = bli.enter_epoch();
+                    KeyValue<uint64_t, uint64_t> kv(key, key * 2);
+                    EXPECT_TRUE(bli.insert(kv));
+                }
+            });
+        }
+
+        // the bulk loaded keys stay visible during the inserts
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EpochGuard guard = bli.enter_epoch();
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+        }
+        for (auto &writer : writers) writer.join();
+
+        EXPECT_GT(bli.get_num_levels(), num_levels);
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+            for (int t = 0; t < num_writers; t++) {
+                uint64_t key = i * 10 + 2 + t;
+                EXPECT_TRUE(bli.lookup(key, value));
+                EXPECT_EQ(key * 2, value);
+            }
+        }
+        EXPECT_FALSE(bli.lookup(N * 10 + 5, value));
+    }
+
+
+    template<typename IndexType>
+    void insert_and_lookup_random_keys(IndexType &bli, int n) {
+        std::unordered_set<uint64_t> keys_set;
+        std::vector<uint64_t> keys;
+        while (keys.size() < n) {
+            uint64_t key = rand() % 10000000 + 1;
+            if (keys_set.insert(key).second) keys.push_back(key);
+        }
+
+        uint64_t value;
+        for (auto key: keys) {
+            KeyValue<uint64_t, uint64_t> kv = KeyValue<uint64_t, uint64_t>(key, key * 2 + 5);
+            EXPECT_TRUE(bli.insert(kv));
+        }
+        for (auto key: keys) {
+            EXPECT_TRUE(bli.lookup(key, value));
+            EXPECT_EQ(key * 2 + 5, value);
+        }
+        EXPECT_FALSE(bli.lookup(1000000000, value));
+    }
+
+    TEST(BuckIndex, policy_configurations) {
+        srand (time(NULL));
+        const int N = 5000;
+
+        // differently configured indexes live in the same binary
+        BuckIndex<uint64_t, uint64_t, 8, 16, NoHint, EndpointModel, NoStats> bli_no_hint;
+        BuckIndex<uint64_t, uint64_t, 8, 16, ModHashHint> bli_mod_hash;
+        BuckIndex<uint64_t, uint64_t, 8, 16, MurmurHashHint> bli_murmur_hash;
+        BuckIndex<uint64_t, uint64_t, 8, 16, ModelPredictHint, RegressionModel> bli_model_predict;
+        BuckIndex<uint64_t, uint64_t, 8, 16, AdaptiveHint, EndpointModel, DebugStats> bli_adaptive;
+
+        insert_and_lookup_random_keys(bli_no_hint, N);
+        insert_and_lookup_random_keys(bli_mod_hash, N);
+        insert_and_lookup_random_keys(bli_murmur_hash, N);
+        insert_and_lookup_random_keys(bli_model_predict, N);
+        insert_and_lookup_random_keys(bli_adaptive, N);
+
+        // stats are only collected with DebugStats
+        EXPECT_EQ(0, bli_no_hint.get_num_data_buckets());
+        EXPECT_EQ(0, bli_no_hint.get_level_stat(0));
+        EXPECT_LT(0, bli_adaptive.get_num_data_buckets());
+        EXPECT_EQ(bli_adaptive.get_num_data_buckets(), bli_adaptive.get_level_stat(0));
+    }
+
     TEST(BuckIndex, scan_one_segment) {
         BuckIndex<uint64_t, uint64_t, 8, 64> bli(0.5);
         std::pair<uint64_t, uint64_t> *result;
@@ -514,7 +702,9 @@ namespace buckindex {
     }
 
     TEST(BuckIndex, scan_parallel_multi_segment) {
+        TaskPool pool(3); // sort the buckets in parallel, whatever the number of cores
         BuckIndex<uint64_t, uint64_t, 8, 16> bli(0.5);
+        bli.set_task_pool(&pool);
         std::pair<uint64_t, uint64_t> *result;
         result = new std::pair<uint64_t, uint64_t>[1000];
         int n_result = 0;
@@ -581,4 +771,556 @@ namespace buckindex {
 
         delete[] result;
     }
+
+    TEST(BuckIndex, scan_parallel_large_range) {
+        TaskPool pool(3);
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        bli.set_task_pool(&pool);
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 200000;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 4, i));
+        bli.bulk_load(kvs);
+        for (uint64_t i = 0; i < N; i += 7) { // partly filled D-Buckets
+            KeyValue<uint64_t, uint64_t> kv(i * 4 + 1, i);
+            EXPECT_TRUE(bli.insert(kv));
+        }
+
+        std::vector<std::pair<uint64_t, uint64_t>> expected(N * 2), result(N * 2);
+        for (uint64_t start_key : {0ul, 1ul, 2ul, 4003ul, N * 2 + 1, N * 4 - 3}) {
+            for (size_t num_to_scan : {1ul, 100ul, 12345ul, N * 2}) {
+                size_t n_expected = bli.scan(start_key, num_to_scan, expected.data());
+                size_t n_result = bli.scan_parallel(start_key, num_to_scan, result.data());
+                ASSERT_EQ(n_expected, n_result);
+                for (size_t i = 0; i < n_result; i++) ASSERT_EQ(expected[i], result[i]);
+            }
+        }
+        EXPECT_EQ(0u, bli.scan_parallel(N * 4, 10, result.data()));
+    }
+
+    TEST(BuckIndex, scan_batch) {
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 50000;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 4, i));
+        bli.bulk_load(kvs);
+        for (uint64_t i = 0; i < N; i += 3) {
+            KeyValue<uint64_t, uint64_t> kv(i * 4 + 1, i);
+            EXPECT_TRUE(bli.insert(kv));
+        }
+
+        // short scans in random order: overlapping, adjacent, far apart, empty, and past the last key
+        std::mt19937_64 gen(42);
+        std::uniform_int_distribution<uint64_t> key_dist(0, N * 4 + 10);
+        std::uniform_int_distribution<size_t> num_dist(0, 100);
+        const size_t num_requests = 2000;
+        using ScanRequest = BuckIndex<uint64_t, uint64_t, 8, 16>::ScanRequest;
+        std::vector<ScanRequest> requests(num_requests);
+        std::vector<std::vector<std::pair<uint64_t, uint64_t>>> outputs(num_requests);
+        for (size_t i = 0; i < num_requests; i++) {
+            uint64_t start_key = i % 4 == 0 && i > 0 ? requests[i-1].start_key + 1 : key_dist(gen);
+            size_t num_to_scan = num_dist(gen);
+            outputs[i].resize(num_to_scan);
+            requests[i] = ScanRequest{start_key, num_to_scan, outputs[i].data(), 0};
+        }
+
+        size_t total = bli.scan_batch(requests);
+        size_t expected_total = 0;
+        std::vector<std::pair<uint64_t, uint64_t>> expected(100);
+        for (size_t i = 0; i < num_requests; i++) {
+            size_t n_expected = bli.scan(requests[i].start_key, requests[i].num_to_scan, expected.data());
+            ASSERT_EQ(n_expected, requests[i].num_scanned);
+            for (size_t j = 0; j < n_expected; j++) ASSERT_EQ(expected[j], outputs[i][j]);
+            expected_total += n_expected;
+        }
+        EXPECT_EQ(expected_total, total);
+    }
+
+    TEST(BuckIndex, parallel_bulk_load) {
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        std::mt19937_64 gen(3);
+        uint64_t key = 0;
+        const uint64_t N = 500000;
+        for (uint64_t i = 0; i < N; i++) {
+            key += gen() % 100 + 1;
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(key, i));
+        }
+
+        // the structure does not depend on the pool
+        TaskPool pool2(2), pool3(3);
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli2, bli3;
+        bli2.set_task_pool(&pool2);
+        bli3.set_task_pool(&pool3);
+        bli2.bulk_load(kvs);
+        bli3.bulk_load(kvs);
+        EXPECT_EQ(bli2.get_num_levels(), bli3.get_num_levels());
+        for (uint64_t level = 0; level < bli2.get_num_levels(); level++) {
+            EXPECT_EQ(bli2.get_level_stat(level), bli3.get_level_stat(level));
+        }
+        EXPECT_EQ(bli2.mem_size(), bli3.mem_size());
+
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(bli3.lookup(kvs[i].key_, value));
+            ASSERT_EQ(i, value);
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> result(N);
+        EXPECT_EQ(N, bli3.scan(kvs[0].key_, N, result.data()));
+        for (uint64_t i = 0; i < N; i++) ASSERT_EQ(kvs[i].key_, result[i].first);
+    }
+
+    TEST(BuckIndex, bulk_load_unsorted) {
+        // shuffled keys, each one three times, with the input order in the value
+        const uint64_t N = 100000;
+        std::vector<KeyValue<uint64_t, uint64_t>> input;
+        for (uint64_t r = 0; r < 3; r++) {
+            for (uint64_t i = 0; i < N; i++) input.push_back(KeyValue<uint64_t, uint64_t>(i * 2 + 1, 0));
+        }
+        std::shuffle(input.begin(), input.end(), std::mt19937_64(5));
+        std::vector<uint64_t> first(N * 2, 0), last(N * 2, 0), sum(N * 2, 0);
+        for (uint64_t i = 0; i < input.size(); i++) {
+            uint64_t key = input[i].key_;
+            input[i].value_ = i + 1;
+            if (first[key] == 0) first[key] = i + 1;
+            last[key] = i + 1;
+            sum[key] += i + 1;
+        }
+
+        TaskPool pool(3);
+        std::vector<DuplicatePolicy> policies = {DuplicatePolicy::KEEP_FIRST, DuplicatePolicy::KEEP_LAST,
+                                                 DuplicatePolicy::MERGE};
+        for (auto policy : policies) {
+            BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+            bli.set_task_pool(&pool);
+            std::vector<KeyValue<uint64_t, uint64_t>> kvs = input;
+            bli.bulk_load_unsorted(kvs, policy, [](const uint64_t &a, const uint64_t &b) { return a + b; });
+            EXPECT_EQ(N, kvs.size()); // deduplicated in place
+
+            uint64_t value;
+            for (uint64_t i = 0; i < N; i++) {
+                uint64_t key = i * 2 + 1;
+                ASSERT_TRUE(bli.lookup(key, value));
+                ASSERT_EQ(policy == DuplicatePolicy::KEEP_FIRST ? first[key] :
+                          policy == DuplicatePolicy::KEEP_LAST ? last[key] : sum[key], value);
+                ASSERT_FALSE(bli.lookup(key + 1, value));
+            }
+        }
+    }
+
+    TEST(BuckIndex, bulk_load_bad_input) {
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        EXPECT_THROW(bli.bulk_load(kvs), std::invalid_argument);
+        EXPECT_THROW(bli.bulk_load_unsorted(kvs), std::invalid_argument);
+
+        for (uint64_t i = 1; i <= 100; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i, i));
+        kvs[50].key_ = 50; // a duplicate
+        EXPECT_THROW(bli.bulk_load(kvs), std::invalid_argument);
+        kvs[50].key_ = 10; // out of order
+        EXPECT_THROW(bli.bulk_load(kvs), std::invalid_argument);
+        EXPECT_THROW(bli.bulk_load_unsorted(kvs, DuplicatePolicy::MERGE), std::invalid_argument);
+        EXPECT_EQ(0u, bli.get_num_levels()); // not modified
+
+        BuckIndex<double, uint64_t, 8, 16> bli_double;
+        std::vector<KeyValue<double, uint64_t>> double_kvs = {{1.0, 1}, {std::nan(""), 2}, {0.5, 3}};
+        EXPECT_THROW(bli_double.bulk_load_unsorted(double_kvs), std::invalid_argument);
+        double_kvs[1].key_ = 2.0;
+        bli_double.bulk_load_unsorted(double_kvs);
+        uint64_t value;
+        EXPECT_TRUE(bli_double.lookup(0.5, value));
+        EXPECT_EQ(3u, value);
+    }
+
+    TEST(BuckIndex, streaming_bulk_load) {
+        // more pairs than one chunk of D-Buckets
+        const uint64_t N = 300000;
+        std::vector<uint64_t> keys(N), values(N);
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < N; i++) {
+            keys[i] = i * 3 + 7;
+            values[i] = i;
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(keys[i], values[i]));
+        }
+
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli_vector, bli_iterator, bli_columns;
+        bli_vector.bulk_load(kvs);
+        std::list<KeyValue<uint64_t, uint64_t>> kv_list(kvs.begin(), kvs.end()); // one pass, in order
+        bli_iterator.bulk_load(kv_list.begin(), kv_list.end());
+        bli_columns.bulk_load(keys.data(), values.data(), N);
+
+        // same structure as the in-memory bulk load
+        for (auto *bli : {&bli_iterator, &bli_columns}) {
+            EXPECT_EQ(bli_vector.get_num_levels(), bli->get_num_levels());
+            for (uint64_t level = 0; level < bli_vector.get_num_levels(); level++) {
+                EXPECT_EQ(bli_vector.get_level_stat(level), bli->get_level_stat(level));
+            }
+            EXPECT_EQ(bli_vector.mem_size(), bli->mem_size());
+            uint64_t value;
+            for (uint64_t i = 0; i < N; i++) {
+                ASSERT_TRUE(bli->lookup(keys[i], value));
+                ASSERT_EQ(i, value);
+                ASSERT_FALSE(bli->lookup(keys[i] + 1, value));
+            }
+        }
+
+        // bad input
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        EXPECT_THROW(bli.bulk_load(keys.data(), values.data(), 0), std::invalid_argument);
+        keys[N - 10] = keys[N - 11]; // a duplicate in the last chunk
+        EXPECT_THROW(bli.bulk_load(keys.data(), values.data(), N), std::invalid_argument);
+        EXPECT_EQ(0u, bli.get_num_levels()); // not modified
+    }
+
+    TEST(BuckIndex, snapshot) {
+        const uint64_t N = 100000;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 10, i));
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        bli.bulk_load(kvs);
+        for (uint64_t i = 0; i < N; i += 3) { // with SMOs
+            KeyValue<uint64_t, uint64_t> kv(i * 10 + 15, i);
+            EXPECT_TRUE(bli.insert(kv));
+        }
+
+        const std::string path = testing::TempDir() + "bli_snapshot";
+        bli.save(path);
+        BuckIndex<uint64_t, uint64_t, 8, 16> restored;
+        restored.load(path);
+
+        // same structure, same content
+        EXPECT_EQ(bli.get_num_levels(), restored.get_num_levels());
+        for (uint64_t level = 0; level < bli.get_num_levels(); level++) {
+            EXPECT_EQ(bli.get_level_stat(level), restored.get_level_stat(level));
+        }
+        EXPECT_EQ(bli.get_num_keys(), restored.get_num_keys());
+        EXPECT_EQ(bli.mem_size(), restored.mem_size());
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(restored.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+            ASSERT_EQ(i % 3 == 0, restored.lookup(i * 10 + 15, value));
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> expected(1000), scanned(1000);
+        EXPECT_EQ(1000u, bli.scan(50000, 1000, expected.data()));
+        EXPECT_EQ(1000u, restored.scan(50000, 1000, scanned.data()));
+        EXPECT_EQ(expected, scanned);
+        KeyValue<uint64_t, uint64_t> kv(N * 10 + 20, 1);
+        EXPECT_TRUE(restored.insert(kv)); // writable
+        EXPECT_TRUE(restored.lookup(N * 10 + 20, value));
+
+        // an empty index
+        BuckIndex<uint64_t, uint64_t, 8, 16> empty, empty_restored;
+        empty.save(path);
+        empty_restored.load(path);
+        EXPECT_EQ(0u, empty_restored.get_num_levels());
+        EXPECT_FALSE(empty_restored.lookup(10, value));
+
+        // bad snapshots are rejected, and the index is not modified
+        BuckIndex<uint64_t, uint64_t, 8, 32> other_config;
+        bli.save(path);
+        EXPECT_THROW(other_config.load(path), std::runtime_error);
+        EXPECT_THROW(restored.load(path + ".missing"), std::runtime_error);
+        std::FILE *file = std::fopen(path.c_str(), "r+b");
+        ASSERT_NE(nullptr, file);
+        std::fseek(file, 0, SEEK_END);
+        long size = std::ftell(file);
+        std::fclose(file);
+        ASSERT_EQ(0, truncate(path.c_str(), size - 1));
+        EXPECT_THROW(restored.load(path), std::runtime_error);
+        EXPECT_TRUE(restored.lookup(N * 10 + 20, value));
+        std::remove(path.c_str());
+    }
+
+    TEST(BuckIndex, tiering) {
+        const uint64_t N = 100000;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 10, i));
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        bli.bulk_load(kvs);
+        size_t resident_size = bli.mem_size();
+
+        const std::string path = testing::TempDir() + "bli_tier";
+        const size_t budget = 64;
+        EXPECT_THROW(bli.enable_tiering(path, 0), std::invalid_argument);
+        bli.enable_tiering(path, budget);
+        EXPECT_THROW(bli.enable_tiering(path, budget), std::runtime_error);
+        EXPECT_EQ(budget, bli.get_num_resident_buckets());
+        EXPECT_GT(bli.get_num_spilled_buckets(), 0u);
+        EXPECT_LT(bli.mem_size(), resident_size);
+
+        // the spilled D-Buckets are faulted in, and the cold ones spilled again
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(bli.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+            ASSERT_FALSE(bli.lookup(i * 10 + 15, value));
+        }
+        EXPECT_LE(bli.get_num_resident_buckets(), budget);
+        for (uint64_t i = 0; i < N; i += 3) { // with SMOs
+            KeyValue<uint64_t, uint64_t> kv(i * 10 + 15, i);
+            ASSERT_TRUE(bli.insert(kv));
+        }
+        EXPECT_LE(bli.get_num_resident_buckets(), budget);
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(bli.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+            ASSERT_EQ(i % 3 == 0, bli.lookup(i * 10 + 15, value));
+        }
+
+        // scans across spilled D-Buckets
+        std::vector<std::pair<uint64_t, uint64_t>> scanned(5000), expected;
+        for (uint64_t i = 5000; expected.size() < 5000; i++) {
+            expected.push_back(std::make_pair(i * 10 + 10, i));
+            if (i % 3 == 0 && expected.size() < 5000) expected.push_back(std::make_pair(i * 10 + 15, i));
+        }
+        EXPECT_EQ(5000u, bli.scan(50010, 5000, scanned.data()));
+        EXPECT_EQ(expected, scanned);
+        std::fill(scanned.begin(), scanned.end(), std::make_pair(0, 0));
+        EXPECT_EQ(5000u, bli.scan_parallel(50010, 5000, scanned.data()));
+        EXPECT_EQ(expected, scanned);
+
+        // a snapshot includes the spilled D-Buckets
+        const std::string snapshot_path = testing::TempDir() + "bli_tier_snapshot";
+        bli.save(snapshot_path);
+        BuckIndex<uint64_t, uint64_t, 8, 16> restored;
+        restored.load(snapshot_path);
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(restored.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+        }
+        std::remove(snapshot_path.c_str());
+    }
+
+    TEST(BuckIndex, concurrent_tiering) {
+        // the writers and the readers fault D-Buckets in, and spill them, concurrently
+        BuckIndex<uint64_t, uint64_t, 4, 8> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 20000;
+        const int num_writers = 3;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        bli.bulk_load(kvs);
+        bli.enable_tiering(testing::TempDir() + "bli_concurrent_tier", 32);
+
+        std::vector<std::thread> writers;
+        for (int t = 0; t < num_writers; t++) {
+            writers.emplace_back([&bli, t]() {
+                std::vector<uint64_t> keys;
+                for (uint64_t i = 0; i < N; i++) keys.push_back(i * 10 + 2 + t);
+                std::shuffle(keys.begin(), keys.end(), std::mt19937(t));
+                for (auto key : keys) {
+                    EpochGuard guard = bli.enter_epoch();
+                    KeyValue<uint64_t, uint64_t> kv(key, key * 2);
+                    EXPECT_TRUE(bli.insert(kv));
+                }
+            });
+        }
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EpochGuard guard = bli.enter_epoch();
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+        }
+        for (auto &writer : writers) writer.join();
+
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+            for (int t = 0; t < num_writers; t++) {
+                uint64_t key = i * 10 + 2 + t;
+                EXPECT_TRUE(bli.lookup(key, value));
+                EXPECT_EQ(key * 2, value);
+            }
+        }
+        EXPECT_LE(bli.get_num_resident_buckets(), 32u);
+    }
+
+    TEST(BuckIndex, concurrent_tiering_readers) {
+        // the readers alone fault D-Buckets in, and spill them, concurrently: they lock the leaf segments and the
+        // D-Buckets, while the other readers read the same D-Buckets
+        BuckIndex<uint64_t, uint64_t, 4, 8> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 20000;
+        const int num_readers = 4;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        bli.bulk_load(kvs);
+        bli.enable_tiering(testing::TempDir() + "bli_concurrent_tier_readers", 16);
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < num_readers; t++) {
+            readers.emplace_back([&bli, t]() {
+                std::vector<uint64_t> ids(N);
+                std::iota(ids.begin(), ids.end(), 0);
+                std::shuffle(ids.begin(), ids.end(), std::mt19937(t));
+                uint64_t value;
+                std::vector<std::pair<uint64_t, uint64_t>> scanned(20);
+                for (size_t j = 0; j < ids.size(); j++) {
+                    EpochGuard guard = bli.enter_epoch();
+                    uint64_t i = ids[j];
+                    EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+                    EXPECT_EQ(i, value);
+                    if (j % 16 == 0) {
+                        size_t n = bli.scan(i * 10 + 1, scanned.size(), scanned.data());
+                        EXPECT_EQ(std::min<uint64_t>(scanned.size(), N - i), n);
+                        for (size_t k = 0; k < n; k++) EXPECT_EQ(i + k, scanned[k].second);
+                    }
+                }
+            });
+        }
+        for (auto &reader : readers) reader.join();
+
+        EXPECT_LE(bli.get_num_resident_buckets(), 16u);
+        EXPECT_GT(bli.get_num_spilled_buckets(), 0u);
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+        }
+    }
+
+    // keys in dense runs, which narrow to 32-bit offsets, and sparse runs, whose D-Buckets fall back to full width
+    template<typename SearchKernel>
+    void check_key_offsets() {
+        BuckIndex<uint64_t, uint64_t, 8, 16, NoHint, EndpointModel, NoStats, SearchKernel, KeyOffsetLayout> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < 3000; i++) {
+            uint64_t key = (i / 500) % 2 ? (i << 33) : (1ull << 50) * (i / 1000) + i * 7 + 1;
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(key, i));
+        }
+        std::sort(kvs.begin(), kvs.end());
+        bli.bulk_load(kvs);
+
+        // inserts between the loaded keys, splitting both kinds of D-Buckets
+        std::vector<KeyValue<uint64_t, uint64_t>> all = kvs;
+        for (size_t i = 0; i + 1 < kvs.size(); i += 2) {
+            KeyValue<uint64_t, uint64_t> kv(kvs[i].key_ + (kvs[i + 1].key_ - kvs[i].key_) / 2, i + 1000000);
+            if (kv.key_ == kvs[i].key_) continue;
+            EXPECT_TRUE(bli.insert(kv));
+            all.push_back(kv);
+        }
+        std::sort(all.begin(), all.end());
+
+        uint64_t value;
+        for (auto &kv : all) {
+            EXPECT_TRUE(bli.lookup(kv.key_, value));
+            EXPECT_EQ(kv.value_, value);
+        }
+        EXPECT_FALSE(bli.lookup(kvs[0].key_ + 2, value));
+        EXPECT_FALSE(bli.lookup((1ull << 33) + 1, value));
+
+        std::vector<std::pair<uint64_t, uint64_t>> result(all.size());
+        EXPECT_EQ(all.size(), bli.scan(all[0].key_, all.size(), result.data()));
+        for (size_t i = 0; i < all.size(); i++) {
+            EXPECT_EQ(all[i].key_, result[i].first);
+            EXPECT_EQ(all[i].value_, result[i].second);
+        }
+    }
+
+    TEST(BuckIndex, key_offsets) {
+        check_key_offsets<ScalarSearch>();
+        check_key_offsets<SIMDSearch>();
+    }
+
+    TEST(BuckIndex, compress_cold) {
+        const uint64_t N = 100000;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 10, i));
+        BuckIndex<uint64_t, uint64_t, 8, 64> bli;
+        bli.bulk_load(kvs);
+        size_t uncompressed_size = bli.mem_size();
+
+        size_t num_d_buckets = bli.compress_cold();
+        EXPECT_GT(num_d_buckets, 0u);
+        EXPECT_EQ(num_d_buckets, bli.get_num_compressed_buckets());
+        EXPECT_LT(bli.mem_size() * 3, uncompressed_size);
+        EXPECT_EQ(0u, bli.compress_cold()); // nothing left
+
+        // the lookups search the compressed D-Buckets in place
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(bli.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+            ASSERT_FALSE(bli.lookup(i * 10 + 15, value));
+        }
+        EXPECT_EQ(num_d_buckets, bli.get_num_compressed_buckets());
+
+        std::vector<std::pair<uint64_t, uint64_t>> scanned(5000), expected;
+        for (uint64_t i = 5000; i < 10000; i++) expected.push_back(std::make_pair(i * 10 + 10, i));
+        EXPECT_EQ(5000u, bli.scan(50010, 5000, scanned.data()));
+        EXPECT_EQ(expected, scanned);
+        std::fill(scanned.begin(), scanned.end(), std::make_pair(0, 0));
+        EXPECT_EQ(5000u, bli.scan_parallel(50010, 5000, scanned.data()));
+        EXPECT_EQ(expected, scanned);
+        EXPECT_EQ(num_d_buckets, bli.get_num_compressed_buckets());
+
+        // the writes decompress the D-Buckets they touch
+        for (uint64_t i = 0; i < N / 2; i += 3) { // with SMOs
+            KeyValue<uint64_t, uint64_t> kv(i * 10 + 15, i);
+            ASSERT_TRUE(bli.insert(kv));
+        }
+        EXPECT_LT(bli.get_num_compressed_buckets(), num_d_buckets);
+        EXPECT_GT(bli.get_num_compressed_buckets(), 0u);
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(bli.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+            ASSERT_EQ(i < N / 2 && i % 3 == 0, bli.lookup(i * 10 + 15, value));
+        }
+
+        // the D-Buckets accessed since the last call are hot; each call halves their counts, until they are cold
+        EXPECT_EQ(0u, bli.compress_cold());
+        size_t num_recompressed = 0;
+        for (int i = 0; i < 8; i++) num_recompressed += bli.compress_cold();
+        EXPECT_GT(num_recompressed, 0u);
+        EXPECT_EQ(0u, bli.compress_cold());
+        for (uint64_t i = 0; i < N; i++) {
+            ASSERT_TRUE(bli.lookup(i * 10 + 10, value));
+            ASSERT_EQ(i, value);
+        }
+    }
+
+    TEST(BuckIndex, concurrent_compress_cold) {
+        // the writers decompress D-Buckets while they are compressed, with tiering
+        BuckIndex<uint64_t, uint64_t, 4, 16> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 20000;
+        const int num_writers = 2;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 1, i));
+        bli.bulk_load(kvs);
+        bli.enable_tiering(testing::TempDir() + "bli_compress_tier", 256);
+
+        std::atomic<bool> done(false);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < num_writers; t++) {
+            writers.emplace_back([&bli, t]() {
+                std::vector<uint64_t> keys;
+                for (uint64_t i = 0; i < N; i++) keys.push_back(i * 10 + 2 + t);
+                std::shuffle(keys.begin(), keys.end(), std::mt19937(t));
+                for (auto key : keys) {
+                    EpochGuard guard = bli.enter_epoch();
+                    KeyValue<uint64_t, uint64_t> kv(key, key * 2);
+                    EXPECT_TRUE(bli.insert(kv));
+                }
+            });
+        }
+        std::thread compressor([&bli, &done]() {
+            while (!done) bli.compress_cold();
+        });
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EpochGuard guard = bli.enter_epoch();
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+        }
+        for (auto &writer : writers) writer.join();
+        done = true;
+        compressor.join();
+
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10 + 1, value));
+            EXPECT_EQ(i, value);
+            for (int t = 0; t < num_writers; t++) {
+                uint64_t key = i * 10 + 2 + t;
+                EXPECT_TRUE(bli.lookup(key, value));
+                EXPECT_EQ(key * 2, value);
+            }
+        }
+    }
 }
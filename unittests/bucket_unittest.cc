@@ -8,6 +8,9 @@
 #include <ctime>
 #include <random>
 #include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
 #define BUCKINDEX_DEBUG
 
@@ -86,6 +89,28 @@ namespace buckindex {
         EXPECT_EQ(20, kv.value_);
     }
 
+    TEST(Bucket, lb_lookup_contiguous_keys) {
+        // the S-Bucket layout, with the keys and the child pointers in separate arrays, finds the same bounds
+        Bucket<KeyValueList<key_t, uintptr_t, 16>, key_t, uintptr_t, 16, NoHint, ScalarSearch> kv_bucket;
+        Bucket<KeyListValueList<key_t, uintptr_t, 16>, key_t, uintptr_t, 16, NoHint, ScalarSearch> key_bucket;
+        std::mt19937_64 gen(3);
+        for (int i = 0; i < 12; i++) {
+            KeyValue<key_t, uintptr_t> kv(gen() % 1000 + 1, i);
+            EXPECT_TRUE(kv_bucket.insert(kv, true, 0));
+            EXPECT_TRUE(key_bucket.insert(kv, true, 0));
+        }
+        KeyValue<key_t, uintptr_t> lb, next, expected_lb, expected_next;
+        for (key_t key = 0; key < 1100; key++) {
+            bool found = kv_bucket.lb_lookup(key, expected_lb, expected_next);
+            ASSERT_EQ(found, key_bucket.lb_lookup(key, lb, next));
+            if (!found) continue;
+            EXPECT_EQ(expected_lb.key_, lb.key_);
+            EXPECT_EQ(expected_lb.value_, lb.value_);
+            EXPECT_EQ(expected_next.key_, next.key_);
+            if (next.key_ != std::numeric_limits<key_t>::max()) EXPECT_EQ(expected_next.value_, next.value_);
+        }
+    }
+
     TEST(Bucket, lookup_insert_basic) {
         Bucket<KListVList8, key_t, value_t, 8> bucket;
         KeyListValueList<key_t, value_t, 8> list;
@@ -771,6 +796,128 @@ namespace buckindex {
         }
     }
 
+    TEST(Bucket, avg_probe_distance) {
+        Bucket<KeyValueList<key_t, value_t, 16>, key_t, value_t, 16> bucket;
+        EXPECT_EQ(0, bucket.avg_probe_distance());
+
+        for (int i = 0; i < 4; i++) { // all hint = 14, slots = 14, 15, 0, 1
+            EXPECT_TRUE(bucket.insert(KV(i, i), true, 14));
+        }
+        EXPECT_EQ(15, bucket.get_pos(1));
+        EXPECT_EQ(0, bucket.get_pos(2));
+        EXPECT_DOUBLE_EQ(1.5, bucket.avg_probe_distance()); // (0 + 1 + 2 + 3) / 4
+    }
+
+    TEST(Bucket, choose_hint_type) {
+        using BucketType = Bucket<KeyValueList<key_t, value_t, 64>, key_t, value_t, 64>;
+        std::vector<KV> kvs;
+
+        // evenly spread keys: the model places every key at its own slot
+        for (int i = 0; i < 32; i++) kvs.push_back(KV(1000 + i * 20, i));
+        EXPECT_EQ(HINT_TYPE_MODEL, BucketType::choose_hint_type(kvs.begin(), kvs.end(), 1000, 1000 + 64 * 10));
+
+        // keys packed at the start of the range: the model maps all of them to slot 0
+        kvs.clear();
+        for (int i = 0; i < 32; i++) kvs.push_back(KV(1000 + i, i));
+        EXPECT_EQ(HINT_TYPE_HASH, BucketType::choose_hint_type(kvs.begin(), kvs.end(), 1000, 1000000));
+
+        // rebuild places the keys with the chosen hint type, and lookups with get_hint() find them
+        BucketType bucket;
+        bucket.set_hint_type(HINT_TYPE_HASH);
+        EXPECT_EQ(HINT_TYPE_HASH, bucket.get_hint_type());
+        for (auto &kv : kvs) {
+            EXPECT_TRUE(bucket.insert(kv, true, bucket.get_hint(kv.key_)));
+        }
+        value_t value;
+        for (auto &kv : kvs) {
+            EXPECT_TRUE(bucket.lookup(kv.key_, value, bucket.get_hint(kv.key_)));
+            EXPECT_EQ(kv.value_, value);
+        }
+    }
+
+    TEST(Bucket, split_and_insert_hint_range) {
+        using BucketType = Bucket<KeyValueList<key_t, value_t, 8>, key_t, value_t, 8>;
+        BucketType bucket;
+        std::vector<KV> kvs;
+        for (int i = 0; i < 8; i++) kvs.push_back(KV(10 * (i + 1), i));
+        bucket.rebuild(kvs.begin(), kvs.end(), 10, 100);
+        EXPECT_EQ(8, bucket.num_keys());
+        EXPECT_EQ(10, bucket.get_pivot());
+        EXPECT_EQ(100, bucket.get_hint_end());
+
+        // keys = 10, 20, ..., 80 + 45; median = 40
+        auto new_buckets = bucket.split_and_insert(KV(45, 8));
+        BucketType *bucket1 = (BucketType *)(void *)(new_buckets.first.value_);
+        BucketType *bucket2 = (BucketType *)(void *)(new_buckets.second.value_);
+        EXPECT_EQ(10, bucket1->get_pivot());
+        EXPECT_EQ(45, bucket1->get_hint_end());
+        EXPECT_EQ(45, bucket2->get_pivot());
+        EXPECT_EQ(100, bucket2->get_hint_end());
+        EXPECT_EQ(9, bucket1->num_keys() + bucket2->num_keys());
+        delete bucket1;
+        delete bucket2;
+    }
+
+    TEST(Bucket, optimistic_read) {
+        Bucket<KeyValueList<key_t, value_t, 8>, key_t, value_t, 8> bucket;
+        uint16_t version = bucket.read_begin();
+        EXPECT_EQ(0, version);
+        EXPECT_TRUE(bucket.read_validate(version));
+
+        // every write bumps the version by 2, and invalidates the reads started before it
+        EXPECT_TRUE(bucket.insert(KV(1, 10), true, 0));
+        EXPECT_FALSE(bucket.read_validate(version));
+        version = bucket.read_begin();
+        EXPECT_EQ(2, version);
+        EXPECT_TRUE(bucket.update(KV(1, 11)));
+        EXPECT_FALSE(bucket.read_validate(version));
+        EXPECT_EQ(4, bucket.read_begin());
+
+        // failed writes do not change the version
+        EXPECT_FALSE(bucket.update(KV(2, 20)));
+        for (int i = 2; i <= 8; i++) EXPECT_TRUE(bucket.insert(KV(i, i), true, 0));
+        version = bucket.read_begin();
+        EXPECT_FALSE(bucket.insert(KV(9, 9), true, 0));
+        EXPECT_TRUE(bucket.read_validate(version));
+    }
+
+    TEST(Bucket, lock) {
+        Bucket<KeyValueList<key_t, value_t, 8>, key_t, value_t, 8> bucket;
+        EXPECT_TRUE(bucket.insert(KV(1, 10), true, 0));
+        uint16_t version = bucket.read_begin();
+
+        // taking the lock does not modify the bucket, so it does not fail optimistic reads
+        EXPECT_TRUE(bucket.lock());
+        EXPECT_TRUE(bucket.read_validate(version));
+        EXPECT_TRUE(bucket.insert(KV(2, 20), true, 0));
+        EXPECT_FALSE(bucket.read_validate(version));
+        bucket.unlock();
+        EXPECT_EQ(4, bucket.read_begin());
+
+        // the lock waits for its owner
+        EXPECT_TRUE(bucket.lock());
+        std::atomic<bool> locked(false);
+        std::thread writer([&bucket, &locked]() {
+            EXPECT_TRUE(bucket.lock());
+            locked = true;
+            bucket.unlock();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT_FALSE(locked.load());
+        bucket.unlock();
+        writer.join();
+        EXPECT_TRUE(locked.load());
+
+        // an obsolete bucket can not be locked anymore, but can still be read
+        EXPECT_TRUE(bucket.lock());
+        bucket.mark_obsolete();
+        bucket.unlock();
+        EXPECT_FALSE(bucket.lock());
+        value_t value;
+        EXPECT_TRUE(bucket.lookup(2, value, 0));
+        EXPECT_EQ(20, value);
+    }
+
     TEST(Bucket, mem_size){
         Bucket<KeyValueList<key_t, value_t, 8>, key_t, value_t, 8> bucket;
         size_t meta_size = sizeof(key_t) + sizeof(int) + sizeof(uint64_t) + sizeof(size_t);
@@ -798,5 +945,124 @@ namespace buckindex {
         EXPECT_GE(bucket4.mem_size(), meta_size + 128 * kv_size);
         EXPECT_LT(bucket4.mem_size(), meta_size + 128 * kv_size + 10);
     }
+    TEST(Bucket, key_offsets) {
+        // the keys are narrowed to 32-bit offsets, and fall back to full width when their range overflows
+        using ScalarBucket = Bucket<KeyOffsetListValueList<key_t, value_t, 256>, key_t, value_t, 256,
+                                    NoHint, ScalarSearch>;
+        using SIMDBucket = Bucket<KeyOffsetListValueList<key_t, value_t, 256>, key_t, value_t, 256,
+                                  NoHint, SIMDSearch>;
+        EXPECT_LT(sizeof(SIMDBucket), sizeof(Bucket<KeyListValueList<key_t, value_t, 256>, key_t, value_t, 256>));
+
+        std::mt19937_64 gen(7);
+        const key_t base = 1ull << 40;
+        std::vector<KV> kvs;
+        for (int i = 0; i < 100; i++) kvs.push_back(KV(base + (gen() % (1ull << 31)), i));
+        std::sort(kvs.begin(), kvs.end());
+        kvs.erase(std::unique(kvs.begin(), kvs.end(), [](const KV &a, const KV &b) { return a.key_ == b.key_; }),
+                  kvs.end());
+        ScalarBucket scalar_bucket;
+        SIMDBucket simd_bucket;
+        auto check = [&](size_t capacity) {
+            EXPECT_EQ(capacity, scalar_bucket.capacity());
+            EXPECT_EQ(capacity, simd_bucket.capacity());
+            value_t value;
+            for (auto &kv : kvs) {
+                for (size_t hint : {size_t(0), size_t(kv.value_ % 256)}) {
+                    ASSERT_TRUE(scalar_bucket.lookup(kv.key_, value, hint));
+                    EXPECT_EQ(kv.value_, value);
+                    ASSERT_TRUE(simd_bucket.lookup(kv.key_, value, hint));
+                    EXPECT_EQ(kv.value_, value);
+                }
+                EXPECT_FALSE(simd_bucket.lookup(kv.key_ + (1ull << 32), value, 0));
+                EXPECT_FALSE(simd_bucket.lookup(kv.key_ - (1ull << 32), value, 0));
+                EXPECT_FALSE(scalar_bucket.lookup(kv.key_ + (1ull << 32), value, 0));
+            }
+            EXPECT_FALSE(simd_bucket.lookup(0, value, 0));
+            EXPECT_FALSE(simd_bucket.lookup(base - 1, value, 0));
+            std::vector<KV> valid_kvs;
+            simd_bucket.get_valid_kvs(valid_kvs);
+            std::vector<KV> sorted_kvs(kvs);
+            std::sort(valid_kvs.begin(), valid_kvs.end());
+            std::sort(sorted_kvs.begin(), sorted_kvs.end());
+            ASSERT_EQ(sorted_kvs.size(), valid_kvs.size());
+            for (size_t i = 0; i < kvs.size(); i++) EXPECT_EQ(sorted_kvs[i].key_, valid_kvs[i].key_);
+        };
+
+        // the base is the first key, then moves down to a smaller key
+        for (auto it = kvs.rbegin(); it != kvs.rend(); it++) {
+            EXPECT_TRUE(scalar_bucket.insert(*it, true, it->value_ % 256));
+            EXPECT_TRUE(simd_bucket.insert(*it, true, it->value_ % 256));
+        }
+        EXPECT_EQ(kvs[0].key_, simd_bucket.get_pivot());
+        check(256);
+
+        // a key out of the 32-bit range: the keys fall back to full width, in half of the slots
+        KV far_kv(base + (1ull << 35), 1000);
+        kvs.push_back(far_kv);
+        EXPECT_TRUE(scalar_bucket.insert(far_kv, true, 0));
+        EXPECT_TRUE(simd_bucket.insert(far_kv, true, 0));
+        check(128);
+        while (simd_bucket.num_keys() < 128) {
+            KV kv(gen(), kvs.size());
+            kvs.push_back(kv);
+            EXPECT_TRUE(simd_bucket.insert(kv, true, kv.value_ % 256));
+            EXPECT_TRUE(scalar_bucket.insert(kv, true, kv.value_ % 256));
+        }
+        check(128);
+        EXPECT_FALSE(simd_bucket.insert(KV(gen(), 0), true, 200)); // full
+
+        // rebuilt with the keys in range, the bucket goes back to offsets
+        SIMDBucket rebuilt;
+        std::vector<KV> narrow_kvs(kvs.begin(), kvs.begin() + 100);
+        std::sort(narrow_kvs.begin(), narrow_kvs.end());
+        rebuilt.rebuild(narrow_kvs.begin(), narrow_kvs.end(), 0, std::numeric_limits<key_t>::max());
+        EXPECT_EQ(256u, rebuilt.capacity());
+        value_t value;
+        for (auto &kv : narrow_kvs) {
+            EXPECT_TRUE(rebuilt.lookup(kv.key_, value, 0));
+            EXPECT_EQ(kv.value_, value);
+        }
+    }
+
+    TEST(Bucket, key_offsets_split) {
+        using KeyValuePtrType = KeyValue<key_t, uintptr_t>;
+        using BucketType = Bucket<KeyOffsetListValueList<key_t, value_t, 8>, key_t, value_t, 8>;
+        value_t value;
+
+        // full with keys in range; the new key is far above them, so it goes on its own
+        BucketType bucket;
+        for (key_t i = 0; i < 8; i++) EXPECT_TRUE(bucket.insert(KV(100 + i, i), true, i));
+        EXPECT_FALSE(bucket.insert(KV(1ull << 40, 8), true, 0));
+        std::pair<KeyValuePtrType, KeyValuePtrType> new_buckets = bucket.split_and_insert(KV(1ull << 40, 8));
+        BucketType *bucket1 = (BucketType *)new_buckets.first.value_;
+        BucketType *bucket2 = (BucketType *)new_buckets.second.value_;
+        EXPECT_EQ(100u, new_buckets.first.key_);
+        EXPECT_EQ(1ull << 40, new_buckets.second.key_);
+        EXPECT_EQ(8u, bucket1->num_keys());
+        EXPECT_EQ(1u, bucket2->num_keys());
+        for (key_t i = 0; i < 8; i++) {
+            EXPECT_TRUE(bucket1->lookup(100 + i, value, 0));
+            EXPECT_EQ(i, value);
+        }
+        EXPECT_TRUE(bucket2->lookup(1ull << 40, value, 0));
+        EXPECT_EQ(8u, value);
+        delete bucket1;
+        delete bucket2;
+
+        // full with full-width keys: split by the median
+        BucketType wide_bucket;
+        for (key_t i = 0; i < 4; i++) EXPECT_TRUE(wide_bucket.insert(KV(i << 40, i), true, 0));
+        EXPECT_EQ(4u, wide_bucket.capacity());
+        EXPECT_FALSE(wide_bucket.insert(KV(5ull << 40, 5), true, 0));
+        new_buckets = wide_bucket.split_and_insert(KV(5ull << 40, 5));
+        bucket1 = (BucketType *)new_buckets.first.value_;
+        bucket2 = (BucketType *)new_buckets.second.value_;
+        EXPECT_EQ(2u, bucket1->num_keys());
+        EXPECT_EQ(3u, bucket2->num_keys());
+        for (key_t i : {0, 1}) EXPECT_TRUE(bucket1->lookup(i << 40, value, 0));
+        for (key_t i : {2, 3, 5}) EXPECT_TRUE(bucket2->lookup(i << 40, value, 0));
+        delete bucket1;
+        delete bucket2;
+    }
 
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+
+#include "bucket.h"
+#include "compressed_bucket.h"
+
+#include<vector>
+#include<random>
+#include<algorithm>
+
+
+namespace buckindex {
+    template<typename T, typename V>
+    void check_round_trip(const std::vector<KeyValue<T, V>> &kvs) {
+        NodeArena arena;
+        CompressedBucket<T, V> *compressed = CompressedBucket<T, V>::create(arena, kvs, kvs.empty() ? 0 : kvs[0].key_, 0);
+        EXPECT_EQ(kvs.size(), compressed->num_keys());
+
+        std::vector<KeyValue<T, V>> decoded;
+        compressed->get_kvs(decoded);
+        ASSERT_EQ(kvs.size(), decoded.size());
+        for (size_t i = 0; i < kvs.size(); i++) {
+            EXPECT_EQ(kvs[i].key_, decoded[i].key_);
+            EXPECT_EQ(kvs[i].value_, decoded[i].value_);
+            V value;
+            EXPECT_TRUE(compressed->lookup(kvs[i].key_, value));
+            EXPECT_EQ(kvs[i].value_, value);
+            if (i + 1 < kvs.size() && kvs[i].key_ + 1 < kvs[i+1].key_) {
+                EXPECT_FALSE(compressed->lookup(kvs[i].key_ + 1, value));
+            }
+        }
+        V value;
+        if (!kvs.empty()) {
+            EXPECT_FALSE(compressed->lookup(kvs.back().key_ + 1, value));
+            if (kvs[0].key_ > std::numeric_limits<T>::min()) EXPECT_FALSE(compressed->lookup(kvs[0].key_ - 1, value));
+        }
+        CompressedBucket<T, V>::destroy(arena, compressed);
+    }
+
+    TEST(CompressedBucket, round_trip) {
+        std::mt19937_64 gen(5);
+        // delta-encoded values: row ids
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < 200; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(1000000 + i * 37, 500 + i));
+        check_round_trip(kvs);
+
+        // frame-of-reference values, in random order
+        for (auto &kv : kvs) kv.value_ = 1000 + gen() % 100000;
+        check_round_trip(kvs);
+
+        // full-width keys and values
+        kvs.clear();
+        for (int i = 0; i < 100; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(gen(), gen()));
+        std::sort(kvs.begin(), kvs.end());
+        kvs.erase(std::unique(kvs.begin(), kvs.end(), [](const KeyValue<uint64_t, uint64_t> &a,
+                                                         const KeyValue<uint64_t, uint64_t> &b) {
+            return a.key_ == b.key_;
+        }), kvs.end());
+        check_round_trip(kvs);
+
+        // one pair, equal values, and no pair
+        check_round_trip(std::vector<KeyValue<uint64_t, uint64_t>>{KeyValue<uint64_t, uint64_t>(7, 9)});
+        std::vector<KeyValue<uint64_t, uint64_t>> equal;
+        for (uint64_t i = 0; i < 50; i++) equal.push_back(KeyValue<uint64_t, uint64_t>(i * 2, 42));
+        check_round_trip(equal);
+        check_round_trip(std::vector<KeyValue<uint64_t, uint64_t>>());
+
+        // signed and 32-bit types
+        std::vector<KeyValue<int32_t, int32_t>> signed_kvs;
+        for (int32_t i = -100; i < 100; i++) signed_kvs.push_back(KeyValue<int32_t, int32_t>(i * 3, -i * 5));
+        check_round_trip(signed_kvs);
+    }
+
+    TEST(CompressedBucket, size_and_decompress) {
+        // 60% full D-Bucket of close keys: the compressed form is a fraction of the slots
+        using DataBucket = Bucket<KeyValueList<uint64_t, uint64_t, 256>, uint64_t, uint64_t, 256>;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < 154; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(1 << 20 | i * 10, i));
+        NodeArena arena;
+        auto *compressed = CompressedBucket<uint64_t, uint64_t>::create(arena, kvs, kvs[0].key_, 1 << 21);
+        EXPECT_LT(compressed->mem_size() * 5, sizeof(DataBucket));
+
+        DataBucket bucket;
+        compressed->decompress(bucket);
+        EXPECT_EQ(kvs.size(), bucket.num_keys());
+        EXPECT_EQ(kvs[0].key_, bucket.get_pivot());
+        EXPECT_EQ(uint64_t(1 << 21), bucket.get_hint_end());
+        for (auto &kv : kvs) {
+            uint64_t value;
+            EXPECT_TRUE(bucket.lookup(kv.key_, value, 0));
+            EXPECT_EQ(kv.value_, value);
+        }
+        CompressedBucket<uint64_t, uint64_t>::destroy(arena, compressed);
+    }
+}
@@ -0,0 +1,122 @@
+#include "gtest/gtest.h"
+
+#define BUCKINDEX_DEBUG
+#include "epoch.h"
+#include "buck_index.h"
+
+#include<vector>
+#include<thread>
+#include<atomic>
+
+
+namespace buckindex {
+    TEST(Epoch, retire_without_readers) {
+        EpochManager epoch;
+        int num_freed = 0;
+        int node = 0;
+        epoch.retire(&node, [&num_freed](void *p) { num_freed++; });
+        EXPECT_EQ(1u, epoch.num_retired());
+        EXPECT_EQ(1u, epoch.reclaim());
+        EXPECT_EQ(1, num_freed);
+        EXPECT_EQ(0u, epoch.num_retired());
+    }
+
+    TEST(Epoch, retire_with_readers) {
+        EpochManager epoch;
+        int num_freed = 0;
+        int node1 = 0, node2 = 0;
+
+        EpochGuard guard1 = epoch.enter();
+        epoch.retire(&node1, [&num_freed](void *p) { num_freed++; });
+        // guard1 may still see node1
+        EXPECT_EQ(0u, epoch.reclaim());
+
+        // guard2 arrives after node1 was retired, so it does not block node1, but blocks node2
+        EpochGuard guard2 = epoch.enter();
+        epoch.retire(&node2, [&num_freed](void *p) { num_freed++; });
+        guard1.release();
+        EXPECT_EQ(1u, epoch.reclaim());
+        EXPECT_EQ(1, num_freed);
+
+        guard2.release();
+        EXPECT_EQ(1u, epoch.reclaim());
+        EXPECT_EQ(2, num_freed);
+    }
+
+    TEST(Epoch, destructor_frees_retired) {
+        int num_freed = 0;
+        int node = 0;
+        {
+            EpochManager epoch;
+            EpochGuard guard = epoch.enter();
+            epoch.retire(&node, [&num_freed](void *p) { num_freed++; });
+            guard.release();
+        }
+        EXPECT_EQ(1, num_freed);
+    }
+
+    TEST(Epoch, many_readers) {
+        EpochManager epoch;
+        // more guards than slots in total, but at most MAX_SLOTS at a time
+        const int num_threads = 8;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&epoch]() {
+                for (int i = 0; i < 1000; i++) {
+                    std::vector<EpochGuard> guards;
+                    for (int j = 0; j < EpochManager::MAX_SLOTS / num_threads; j++) {
+                        guards.push_back(epoch.enter());
+                    }
+                }
+            });
+        }
+        for (auto &thread : threads) thread.join();
+
+        int node = 0;
+        epoch.retire(&node, [](void *p) {});
+        EXPECT_EQ(1u, epoch.reclaim()); // no slot is left pinned
+    }
+
+    TEST(Epoch, lookup_during_insert) {
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        const uint64_t N = 20000;
+        for (uint64_t i = 0; i < N; i++) {
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10, i * 10 + 1));
+        }
+        bli.bulk_load(kvs);
+
+        // the reader must never touch a reclaimed node, and never miss a key (optimistic reads)
+        std::atomic<bool> done(false);
+        std::atomic<uint64_t> num_missing(0);
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; t++) {
+            readers.emplace_back([&, t]() {
+                uint64_t value;
+                while (!done.load()) {
+                    for (uint64_t i = t; i < N; i += 7) {
+                        EpochGuard guard = bli.enter_epoch();
+                        if (!bli.lookup(i * 10, value) || value != i * 10 + 1) num_missing++;
+                    }
+                }
+            });
+        }
+
+        // the inserts split D-Buckets and rebuild segments, retiring the old nodes
+        for (uint64_t i = 0; i < N; i++) {
+            KeyValue<uint64_t, uint64_t> kv(i * 10 + 5, i);
+            EXPECT_TRUE(bli.insert(kv));
+        }
+        done = true;
+        for (auto &reader : readers) reader.join();
+        EXPECT_EQ(0u, num_missing.load());
+
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            EXPECT_TRUE(bli.lookup(i * 10, value));
+            EXPECT_EQ(i * 10 + 1, value);
+            EXPECT_TRUE(bli.lookup(i * 10 + 5, value));
+            EXPECT_EQ(i, value);
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#include "gtest/gtest.h"
+
+#include "event_count.h"
+
+#include<atomic>
+#include<chrono>
+#include<thread>
+#include<vector>
+
+
+namespace buckindex {
+    TEST(EventCount, condition_already_true) {
+        EventCount event;
+        event.await([]() { return true; });
+        EXPECT_EQ(0u, event.num_waiters());
+        event.notify_all(); // no waiter, no effect
+    }
+
+    TEST(EventCount, wake_sleeper) {
+        EventCount event;
+        std::atomic<bool> ready(false);
+        std::thread waiter([&]() {
+            event.await([&]() { return ready.load(); });
+        });
+
+        // the waiter gives up spinning and sleeps
+        while (event.num_waiters() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ready = true;
+        event.notify_all();
+        waiter.join();
+        EXPECT_EQ(0u, event.num_waiters());
+    }
+
+    TEST(EventCount, ping_pong) {
+        // no wakeup is lost between the check of the condition and the sleep
+        EventCount event;
+        std::atomic<int> turn(0);
+        const int num_rounds = 10000;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 2; t++) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < num_rounds; i++) {
+                    event.await([&]() { return turn.load() % 2 == t; });
+                    turn++;
+                    event.notify_all();
+                }
+            });
+        }
+        for (auto &thread : threads) thread.join();
+        EXPECT_EQ(2 * num_rounds, turn.load());
+    }
+}
@@ -0,0 +1,111 @@
+#include "gtest/gtest.h"
+#define UNITTEST
+#define BUCKINDEX_DEBUG
+#include "mapped_buck_index.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <utility>
+
+
+namespace buckindex {
+    TEST(MappedBuckIndex, lookup_and_scan) {
+        const uint64_t N = 100000;
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < N; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i * 10 + 10, i));
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        bli.bulk_load(kvs);
+        for (uint64_t i = 0; i < N; i += 3) { // with SMOs
+            KeyValue<uint64_t, uint64_t> kv(i * 10 + 15, i);
+            EXPECT_TRUE(bli.insert(kv));
+        }
+
+        const std::string path = testing::TempDir() + "bli_frozen";
+        bli.freeze(path);
+        MappedBuckIndex<uint64_t, uint64_t, 8, 16> mapped(path);
+        MappedBuckIndex<uint64_t, uint64_t, 8, 16> mapped_again(path); // at another address
+
+        EXPECT_EQ(bli.get_num_levels(), mapped.get_num_levels());
+        EXPECT_EQ(bli.get_num_keys(), mapped.get_num_keys());
+        EXPECT_EQ(bli.get_num_data_buckets(), mapped.get_num_data_buckets());
+        uint64_t value;
+        for (uint64_t i = 0; i < N; i++) {
+            for (auto *index : {&mapped, &mapped_again}) {
+                ASSERT_TRUE(index->lookup(i * 10 + 10, value));
+                ASSERT_EQ(i, value);
+                ASSERT_EQ(i % 3 == 0, index->lookup(i * 10 + 15, value));
+                ASSERT_FALSE(index->lookup(i * 10 + 11, value));
+            }
+        }
+        EXPECT_FALSE(mapped.lookup(5, value)); // below the smallest key
+        EXPECT_FALSE(mapped.lookup(N * 100, value));
+
+        std::vector<std::pair<uint64_t, uint64_t>> expected(5000), scanned(5000);
+        for (uint64_t start : {10ul, 12345ul, N * 10 - 500}) {
+            size_t n = bli.scan(start, expected.size(), expected.data());
+            ASSERT_EQ(n, mapped.scan(start, scanned.size(), scanned.data()));
+            for (size_t i = 0; i < n; i++) ASSERT_EQ(expected[i], scanned[i]);
+        }
+        ASSERT_EQ(10u, mapped.scan(0, 10, scanned.data())); // from the first key
+        EXPECT_EQ(10u, scanned[0].first);
+        EXPECT_EQ(0u, mapped.scan(N * 100, 10, scanned.data()));
+        std::remove(path.c_str());
+    }
+
+    TEST(MappedBuckIndex, empty_sbuckets) {
+        // blocks of keys separated by gaps leave empty S-Buckets between non-empty ones, whose dense pivots
+        // are written into the frozen index and searched by the mapped lookups
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 0; i < 20000; i++) {
+            uint64_t key = (i / 40) * 4000 + i * 10 + 1;
+            kvs.push_back(KeyValue<uint64_t, uint64_t>(key, i));
+        }
+        BuckIndex<uint64_t, uint64_t, 4, 8> bli;
+        bli.bulk_load(kvs);
+
+        const std::string path = testing::TempDir() + "bli_frozen";
+        bli.freeze(path);
+        MappedBuckIndex<uint64_t, uint64_t, 4, 8> mapped(path);
+        uint64_t value;
+        for (size_t i = 0; i < kvs.size(); i++) {
+            ASSERT_TRUE(mapped.lookup(kvs[i].key_, value));
+            ASSERT_EQ(kvs[i].value_, value);
+            ASSERT_FALSE(mapped.lookup(kvs[i].key_ + 5, value)); // in a gap, or between two keys
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> scanned(100);
+        for (size_t i = 0; i < kvs.size(); i += 997) {
+            size_t n = mapped.scan(kvs[i].key_ + 5, scanned.size(), scanned.data());
+            ASSERT_EQ(std::min(scanned.size(), kvs.size() - i - 1), n);
+            for (size_t j = 0; j < n; j++) ASSERT_EQ(kvs[i + 1 + j].key_, scanned[j].first);
+        }
+        std::remove(path.c_str());
+    }
+
+    TEST(MappedBuckIndex, empty_and_bad_files) {
+        const std::string path = testing::TempDir() + "bli_frozen";
+        BuckIndex<uint64_t, uint64_t, 8, 16> empty;
+        empty.freeze(path);
+        {
+            MappedBuckIndex<uint64_t, uint64_t, 8, 16> mapped(path);
+            EXPECT_EQ(0u, mapped.get_num_levels());
+            uint64_t value;
+            EXPECT_FALSE(mapped.lookup(10, value));
+            std::pair<uint64_t, uint64_t> kv;
+            EXPECT_EQ(0u, mapped.scan(0, 1, &kv));
+        }
+
+        std::vector<KeyValue<uint64_t, uint64_t>> kvs;
+        for (uint64_t i = 1; i <= 1000; i++) kvs.push_back(KeyValue<uint64_t, uint64_t>(i, i));
+        BuckIndex<uint64_t, uint64_t, 8, 16> bli;
+        bli.bulk_load(kvs);
+        bli.freeze(path);
+        typedef MappedBuckIndex<uint64_t, uint64_t, 8, 32> OtherConfig;
+        EXPECT_THROW(OtherConfig other(path), std::runtime_error);
+        typedef MappedBuckIndex<uint64_t, uint64_t, 8, 16> SameConfig;
+        EXPECT_THROW(SameConfig missing(path + ".missing"), std::runtime_error);
+        bli.save(path); // a snapshot is not a frozen index
+        EXPECT_THROW(SameConfig snapshot(path), std::runtime_error);
+        std::remove(path.c_str());
+    }
+}
@@ -0,0 +1,125 @@
+#include "gtest/gtest.h"
+
+#include "node_arena.h"
+#include "segment.h"
+
+#include<vector>
+#include<thread>
+#include<set>
+
+
+namespace buckindex {
+    TEST(NodeArena, size_class) {
+        EXPECT_EQ(0u, NodeArena::size_class(1));
+        EXPECT_EQ(0u, NodeArena::size_class(16));
+        EXPECT_EQ(1u, NodeArena::size_class(17));
+        EXPECT_EQ(3u, NodeArena::size_class(64));
+        EXPECT_EQ(4u, NodeArena::size_class(65));
+        EXPECT_EQ(NodeArena::NUM_SIZE_CLASSES - 1, NodeArena::size_class(NodeArena::MAX_BLOCK_SIZE));
+
+        // every size fits in its class, and wastes at most 25% (or 15 bytes for tiny blocks)
+        for (size_t bytes = 1; bytes <= NodeArena::MAX_BLOCK_SIZE; bytes += 7) {
+            size_t c = NodeArena::size_class(bytes);
+            EXPECT_GE(NodeArena::class_size(c), bytes);
+            EXPECT_LE(NodeArena::class_size(c), std::max(bytes + 15, bytes + bytes / 4));
+            if (c > 0) EXPECT_LT(NodeArena::class_size(c - 1), bytes);
+        }
+    }
+
+    TEST(NodeArena, allocate_and_reuse) {
+        NodeArena arena;
+        EXPECT_EQ(0u, arena.reserved_bytes());
+
+        std::set<void*> blocks;
+        for (int i = 0; i < 1000; i++) {
+            void *p = arena.allocate(1000);
+            EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p) % NodeArena::MAX_ALIGNMENT);
+            EXPECT_TRUE(blocks.insert(p).second); // no overlapping blocks
+            memset(p, 0xff, 1000);
+        }
+        size_t reserved = arena.reserved_bytes();
+        EXPECT_GE(reserved, 1000u * 1000);
+
+        // freed blocks are recycled without reserving more memory
+        for (auto p : blocks) arena.deallocate(p, 1000);
+        for (int i = 0; i < 1000; i++) {
+            void *p = arena.allocate(1000);
+            EXPECT_TRUE(blocks.find(p) != blocks.end());
+        }
+        EXPECT_EQ(reserved, arena.reserved_bytes());
+
+        // large blocks
+        void *large = arena.allocate(NodeArena::MAX_BLOCK_SIZE + 1);
+        EXPECT_GE(arena.reserved_bytes(), reserved + NodeArena::MAX_BLOCK_SIZE + 1);
+        arena.deallocate(large, NodeArena::MAX_BLOCK_SIZE + 1);
+        EXPECT_EQ(reserved, arena.reserved_bytes());
+
+        arena.release_all();
+        EXPECT_EQ(0u, arena.reserved_bytes());
+    }
+
+    TEST(NodeArena, multi_thread) {
+        NodeArena arena;
+        const int num_threads = 4;
+        const int n = 10000;
+        std::vector<std::thread> threads;
+        std::vector<std::vector<uint64_t*>> results(num_threads);
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&arena, &results, t, n]() {
+                // blocks freed by one thread can be reused by the others through the shared free lists
+                for (int i = 0; i < n; i++) {
+                    uint64_t *p = arena.create<uint64_t>(t * n + i);
+                    if (i % 2) arena.destroy(p);
+                    else results[t].push_back(p);
+                }
+            });
+        }
+        for (auto &thread : threads) thread.join();
+
+        std::set<uint64_t*> blocks;
+        for (int t = 0; t < num_threads; t++) {
+            for (int i = 0; i < results[t].size(); i++) {
+                EXPECT_EQ(t * n + 2 * i, *results[t][i]);
+                EXPECT_TRUE(blocks.insert(results[t][i]).second);
+            }
+        }
+    }
+
+    TEST(NodeArena, segment) {
+        NodeArena arena;
+        using SegmentType = Segment<uint64_t, 8>;
+        std::vector<KeyValue<uint64_t, uintptr_t>> list;
+        for (uint64_t i = 0; i < 1000; i++) {
+            list.push_back(KeyValue<uint64_t, uintptr_t>(i * 3, i));
+        }
+        LinearModel<uint64_t> model(1.0 / 3, 0);
+
+        SegmentType *seg = SegmentType::create(arena, list.size(), 0.5, model, list.begin(), list.end());
+        // the pivots and the S-Buckets are in the same block, right after the segment
+        EXPECT_LT((void *)(seg + 1), (void *)seg->sbucket_list_);
+        EXPECT_GE((char *)(seg + 1) + seg->num_bucket_ * sizeof(uint64_t) + alignof(SegmentType::BucketType),
+                  (char *)seg->sbucket_list_);
+        EXPECT_EQ(0u, (uintptr_t)seg->sbucket_list_ % alignof(SegmentType::BucketType));
+        KeyValue<uint64_t, uintptr_t> kvptr, next_kvptr;
+        for (uint64_t i = 0; i < 1000; i++) {
+            EXPECT_TRUE(seg->lb_lookup(i * 3 + 1, kvptr, next_kvptr));
+            EXPECT_EQ(i * 3, kvptr.key_);
+            EXPECT_EQ(i, kvptr.value_);
+        }
+
+        // rebuild seg into new segments allocated from the arena
+        std::vector<KeyValue<uint64_t, uintptr_t>> pivots, new_segs;
+        pivots.push_back(KeyValue<uint64_t, uintptr_t>(300, 12345));
+        pivots.push_back(KeyValue<uint64_t, uintptr_t>(301, 12346));
+        EXPECT_TRUE(seg->segment_and_batch_update(0.5, pivots, new_segs, &arena));
+        size_t num_entries = 0;
+        for (auto &kv : new_segs) {
+            SegmentType *new_seg = (SegmentType *)kv.value_;
+            EXPECT_LT((void *)(new_seg + 1), (void *)new_seg->sbucket_list_);
+            num_entries += new_seg->size();
+            SegmentType::destroy(arena, new_seg);
+        }
+        EXPECT_EQ(1001u, num_entries);
+        SegmentType::destroy(arena, seg);
+    }
+}
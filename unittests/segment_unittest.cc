@@ -227,6 +227,118 @@ namespace buckindex {
         EXPECT_EQ(50,seg.sbucket_list_[1].get_pivot());
     }
 
+    // next_pivot() and locate_buck() read the dense pivots, which must follow the pivots of the S-Buckets
+    template<typename SegmentType>
+    void check_pivots(SegmentType &seg, const std::vector<key_t> &keys) {
+        for (int i = 0; i + 1 < seg.num_bucket_; i++) {
+            if (seg.sbucket_list_[i].get_pivot() == seg.sbucket_list_[i + 1].get_pivot()) continue; // empty buckets
+            EXPECT_EQ(seg.sbucket_list_[i + 1].get_pivot(), seg.next_pivot(seg.sbucket_list_[i].get_pivot()));
+        }
+        KeyValue<key_t, uintptr_t> kvptr, next_kvptr;
+        for (key_t key : keys) {
+            EXPECT_TRUE(seg.lb_lookup(key, kvptr, next_kvptr));
+            EXPECT_EQ(key, kvptr.key_);
+        }
+    }
+
+    TEST(Segment, pivots){
+        std::vector<KeyValue<key_t, uintptr_t>> in_array;
+        std::vector<key_t> keys;
+        for (key_t i = 0; i < 200; i++) {
+            in_array.push_back(KeyValue<key_t, uintptr_t>(i * 100, i));
+            keys.push_back(i * 100);
+        }
+        LinearModel<key_t> model(0.01, 0);
+        NodeArena arena;
+        using SegmentType = Segment<key_t, 8>;
+        SegmentType heap_seg(in_array.size(), 0.5, model, in_array.begin(), in_array.end());
+        SegmentType *arena_seg = SegmentType::create(arena, in_array.size(), 0.5, model, in_array.begin(), in_array.end());
+        check_pivots(heap_seg, keys);
+        check_pivots(*arena_seg, keys);
+
+        // skewed inserts rebalance the S-Buckets and move their pivots
+        std::mt19937_64 gen(7);
+        std::vector<key_t> inserted = keys;
+        for (int i = 0; i < 150; i++) {
+            KeyValue<key_t, uintptr_t> kv(5000 + gen() % 5000, i);
+            if (std::find(inserted.begin(), inserted.end(), kv.key_) != inserted.end()) continue;
+            bool heap_success = heap_seg.insert(kv);
+            EXPECT_EQ(heap_success, arena_seg->insert(kv));
+            if (!heap_success) break;
+            inserted.push_back(kv.key_);
+        }
+        check_pivots(heap_seg, inserted);
+        check_pivots(*arena_seg, inserted);
+        EXPECT_FALSE(heap_seg.needs_retrain());
+        SegmentType::destroy(arena, arena_seg);
+    }
+
+    TEST(Segment, locate_bounded_error){
+        std::vector<KeyValue<key_t, uintptr_t>> in_array;
+        std::vector<key_t> keys;
+        for (key_t i = 0; i < 98; i++) {
+            in_array.push_back(KeyValue<key_t, uintptr_t>(i * 10, i));
+            keys.push_back(i * 10);
+        }
+        // the model predicts the first S-Bucket for every key, so the keys overflow into the next 24 S-Buckets,
+        // like a segment fitted with a large error bound; the last one has room
+        LinearModel<key_t> model(0.0001, 0);
+        Segment<key_t, 4> seg(in_array.size(), 0.5, model, in_array.begin(), in_array.end());
+        EXPECT_EQ(49, seg.num_bucket_);
+
+        // the search covers the recorded error, and is exact for keys in and between the S-Buckets
+        check_pivots(seg, keys);
+        KeyValue<key_t, uintptr_t> kvptr, next_kvptr;
+        for (key_t key : keys) {
+            EXPECT_TRUE(seg.lb_lookup(key + 5, kvptr, next_kvptr));
+            EXPECT_EQ(key, kvptr.key_);
+        }
+        EXPECT_EQ(std::numeric_limits<key_t>::max(), seg.next_pivot(970));
+
+        // the model is as good as when the segment was built: the segment is updated in place
+        EXPECT_FALSE(seg.needs_retrain());
+        std::vector<KeyValue<key_t, uintptr_t>> new_pivots;
+        new_pivots.push_back(KeyValue<key_t, uintptr_t>(970, 1));
+        new_pivots.push_back(KeyValue<key_t, uintptr_t>(975, 2));
+        EXPECT_TRUE(seg.batch_update(new_pivots[0], new_pivots, false));
+        keys.push_back(975);
+        check_pivots(seg, keys);
+    }
+
+    TEST(Segment, needs_retrain){
+        std::vector<KeyValue<key_t, uintptr_t>> in_array;
+        for (key_t i = 0; i < 64; i++) {
+            in_array.push_back(KeyValue<key_t, uintptr_t>(i * 100, i));
+        }
+        LinearModel<key_t> model(0.01, 0);
+        Segment<key_t, 4> seg(in_array.size(), 0.25, model, in_array.begin(), in_array.end());
+        EXPECT_FALSE(seg.needs_retrain());
+
+        // ascending inserts into one key range push its keys, and the pivots, forward by rebalances
+        std::vector<key_t> keys;
+        for (key_t i = 0; i < 64; i++) keys.push_back(i * 100);
+        for (key_t key = 1001; key < 1100; key++) {
+            KeyValue<key_t, uintptr_t> kv(key, key);
+            if (!seg.insert(kv)) break;
+            keys.push_back(key);
+        }
+        EXPECT_TRUE(seg.needs_retrain());
+        check_pivots(seg, keys);
+
+        // the segment is rebuilt instead of updated in place, with a new model
+        std::vector<KeyValue<key_t, uintptr_t>> new_pivots;
+        new_pivots.push_back(KeyValue<key_t, uintptr_t>(2000, 1));
+        new_pivots.push_back(KeyValue<key_t, uintptr_t>(2050, 2));
+        EXPECT_FALSE(seg.batch_update(new_pivots[0], new_pivots, false));
+        std::vector<KeyValue<key_t, uintptr_t>> new_segs;
+        EXPECT_TRUE(seg.segment_and_batch_update(0.5, new_pivots, new_segs));
+        for (auto &kv : new_segs) {
+            Segment<key_t, 4> *new_seg = (Segment<key_t, 4> *)kv.value_;
+            EXPECT_FALSE(new_seg->needs_retrain());
+            delete new_seg;
+        }
+    }
+
     TEST(Segment, insert_fail){
         key_t keys[] = {0,20,40,60,80,100,120,140};
         std::vector<KeyValue<key_t, uintptr_t>> in_array;
@@ -1012,9 +1124,11 @@ namespace buckindex {
         // expect 2 s-buckets
         EXPECT_EQ(2, seg.num_bucket_);
 
-        typedef Bucket<KeyValueList<key_t, uintptr_t, 4>, key_t, uintptr_t, 4> BucketType;
+        typedef Bucket<KeyListValueList<key_t, uintptr_t, 4>, key_t, uintptr_t, 4> BucketType;
         size_t meta_size = sizeof(LinearModel<key_t>)+sizeof(int)+sizeof(BucketType*);
         meta_size += sizeof(BucketType)*2;
+        meta_size += sizeof(key_t*)+sizeof(key_t)*2; // the pivots
+        meta_size += sizeof(unsigned int)*2; // the errors of the model
         EXPECT_LE(meta_size, seg.mem_size());
         EXPECT_GT(meta_size+10, seg.mem_size());
         // expect the mem_size should be a little bit larger than the expected value
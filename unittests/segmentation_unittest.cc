@@ -2,6 +2,8 @@
 #include "keyvalue.h"
 #include "segmentation.h"
 
+#include <random>
+
 #define BUCKINDEX_DEBUG
 
 
@@ -55,8 +57,7 @@ namespace buckindex {
         for (uint64_t i = 0; i < length; i++) {
             in_kv_array.push_back(KeyValue<uint64_t, uint64_t>(keys[i], keys[i]));
         }
-#ifdef BUCKINDEX_USE_LINEAR_REGRESSION
-        Segmentation<vector<KeyValue<uint64_t, uint64_t>>, uint64_t>::compute_dynamic_segmentation(
+        Segmentation<vector<KeyValue<uint64_t, uint64_t>>, uint64_t, RegressionModel>::compute_dynamic_segmentation(
             in_kv_array, cuts, models, error_bound);
 
         EXPECT_EQ(4u, cuts.size());
@@ -80,7 +81,6 @@ namespace buckindex {
         EXPECT_EQ(3u, cuts[3].size_);
         EXPECT_NEAR(1.0, models[3].get_slope(), 1e-2);
         EXPECT_NEAR(-8.0, models[3].get_offset(), 1e-2);
-#endif
     }
 
     TEST(Segmentation, multiple_segments_and_use_endpoints) {
@@ -94,7 +94,7 @@ namespace buckindex {
         for (uint64_t i = 0; i < length; i++) {
             in_kv_array.push_back(KeyValue<uint64_t, uint64_t>(keys[i], keys[i]));
         }
-        Segmentation<vector<KeyValue<uint64_t, uint64_t>>, uint64_t>::compute_dynamic_segmentation(
+        Segmentation<vector<KeyValue<uint64_t, uint64_t>>, uint64_t, EndpointModel>::compute_dynamic_segmentation(
             in_kv_array, cuts, models, error_bound);
 
         EXPECT_EQ(4u, cuts.size());
@@ -144,4 +144,37 @@ namespace buckindex {
         EXPECT_EQ(2u, cuts[3].size_);
     }
 
+
+    TEST(Segmentation, parallel_segmentation) {
+        // skewed keys, so the cuts are of very different lengths and rarely aligned with the chunks
+        vector<KeyValue<uint64_t, uint64_t>> in_kv_array;
+        std::mt19937_64 gen(7);
+        uint64_t key = 0;
+        for (uint64_t i = 0; i < 100000; i++) {
+            key += (i / 1000) % 3 == 0 ? gen() % 10 + 1 : gen() % 10000 + 1;
+            in_kv_array.push_back(KeyValue<uint64_t, uint64_t>(key, i));
+        }
+
+        TaskPool pool(3);
+        for (uint64_t error_bound : {1, 8, 64}) {
+            vector<Cut<uint64_t>> cuts, parallel_cuts;
+            vector<LinearModel<uint64_t>> models, parallel_models;
+            Segmentation<vector<KeyValue<uint64_t, uint64_t>>, uint64_t>::compute_dynamic_segmentation(
+                in_kv_array, cuts, models, error_bound);
+            for (uint64_t min_chunk_size : {100, 4096, 1 << 20}) {
+                parallel_cuts.clear();
+                parallel_models.clear();
+                Segmentation<vector<KeyValue<uint64_t, uint64_t>>, uint64_t>::compute_dynamic_segmentation_parallel(
+                    in_kv_array, parallel_cuts, parallel_models, error_bound, pool, min_chunk_size);
+                ASSERT_EQ(cuts.size(), parallel_cuts.size());
+                ASSERT_EQ(models.size(), parallel_models.size());
+                for (size_t i = 0; i < cuts.size(); i++) {
+                    ASSERT_EQ(cuts[i].start_, parallel_cuts[i].start_);
+                    ASSERT_EQ(cuts[i].size_, parallel_cuts[i].size_);
+                    ASSERT_EQ(models[i].get_slope(), parallel_models[i].get_slope());
+                    ASSERT_EQ(models[i].get_offset(), parallel_models[i].get_offset());
+                }
+            }
+        }
+    }
 }
@@ -0,0 +1,75 @@
+#include "gtest/gtest.h"
+
+#include "task_pool.h"
+
+#include<atomic>
+#include<vector>
+#include<thread>
+#include<random>
+
+
+namespace buckindex {
+    TEST(TaskPool, parallel_for) {
+        TaskPool pool(3);
+        const size_t N = 10000;
+        std::vector<int> visits(N, 0);
+        for (size_t grain : std::vector<size_t>{0, 1, 7, 100, N}) {
+            pool.parallel_for(0, N, grain, [&visits, grain](size_t begin, size_t end) {
+                if (grain > 0) EXPECT_LE(end - begin, grain);
+                for (size_t i = begin; i < end; i++) visits[i]++;
+            });
+        }
+        for (size_t i = 0; i < N; i++) EXPECT_EQ(5, visits[i]);
+        pool.parallel_for(5, 5, 0, [](size_t begin, size_t end) { FAIL(); }); // empty range
+    }
+
+    TEST(TaskPool, nested) {
+        // a task waiting for a nested parallel_for() runs chunks itself, so the pool does not deadlock
+        TaskPool pool(2);
+        std::atomic<size_t> sum(0);
+        pool.parallel_for(0, 8, 1, [&](size_t begin, size_t end) {
+            pool.parallel_for(0, 100, 10, [&](size_t b, size_t e) {
+                for (size_t i = b; i < e; i++) sum += i;
+            });
+        });
+        EXPECT_EQ(8u * 4950, sum.load());
+    }
+
+    TEST(TaskPool, concurrent_callers) {
+        TaskPool pool(2);
+        std::vector<std::thread> callers;
+        std::atomic<size_t> sum(0);
+        for (int t = 0; t < 4; t++) {
+            callers.emplace_back([&]() {
+                for (int r = 0; r < 100; r++) {
+                    pool.parallel_for(0, 64, 4, [&](size_t b, size_t e) { sum += e - b; });
+                }
+            });
+        }
+        for (auto &caller : callers) caller.join();
+        EXPECT_EQ(4u * 100 * 64, sum.load());
+    }
+
+    TEST(TaskPool, default_workers) {
+        // one worker per core, besides the calling thread; started on the first parallel_for()
+        TaskPool pool;
+        EXPECT_EQ(std::max(1u, std::thread::hardware_concurrency()) - 1, pool.num_workers());
+        size_t n = 0;
+        pool.parallel_for(0, 10, 10, [&n](size_t b, size_t e) { n += e - b; }); // one chunk, run by the caller
+        EXPECT_EQ(10u, n);
+    }
+
+    TEST(TaskPool, parallel_stable_sort) {
+        TaskPool pool(3);
+        std::mt19937_64 gen(11);
+        for (size_t n : {0, 1, 1000, 100000}) {
+            std::vector<std::pair<uint64_t, size_t>> v(n); // (key, input position)
+            for (size_t i = 0; i < n; i++) v[i] = std::make_pair(gen() % 1000, i);
+            pool.parallel_stable_sort(v.begin(), v.end(), [](const std::pair<uint64_t, size_t> &a,
+                                                            const std::pair<uint64_t, size_t> &b) {
+                return a.first < b.first;
+            }, 100);
+            for (size_t i = 1; i < n; i++) ASSERT_TRUE(v[i-1] < v[i]); // sorted, and stable for equal keys
+        }
+    }
+}
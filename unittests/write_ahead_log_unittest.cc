@@ -0,0 +1,99 @@
+#include "gtest/gtest.h"
+
+#include "write_ahead_log.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+
+namespace buckindex {
+    using Log = WriteAheadLog<uint64_t, uint64_t>;
+
+    TEST(WriteAheadLog, append_and_replay) {
+        const std::string path = testing::TempDir() + "bli_wal";
+        std::remove(path.c_str());
+        {
+            Log log(path, std::chrono::microseconds(100), 10); // LSNs start after 10
+            for (uint64_t i = 1; i <= 1000; i++) {
+                uint64_t lsn = log.append(WAL_INSERT, KeyValue<uint64_t, uint64_t>(i, i * 2));
+                EXPECT_EQ(10 + i, lsn);
+            }
+            log.flush();
+            EXPECT_EQ(1010u, log.durable_lsn());
+        }
+
+        std::vector<uint64_t> keys;
+        uint64_t base_lsn;
+        Log::replay(path, 500, [&keys](uint64_t lsn, WalRecordType type, const KeyValue<uint64_t, uint64_t> &kv) {
+            EXPECT_EQ(WAL_INSERT, type);
+            EXPECT_EQ(lsn - 10, kv.key_);
+            EXPECT_EQ(kv.key_ * 2, kv.value_);
+            keys.push_back(kv.key_);
+        }, &base_lsn);
+        EXPECT_EQ(10u, base_lsn);
+        ASSERT_EQ(510u, keys.size()); // after LSN 500
+        EXPECT_EQ(491u, keys[0]);
+
+        // a torn tail is cut off when the log is reopened, and the next LSNs follow the last valid record
+        struct stat st;
+        ASSERT_EQ(0, stat(path.c_str(), &st));
+        ASSERT_EQ(0, truncate(path.c_str(), st.st_size - 3));
+        {
+            Log log(path, std::chrono::microseconds(100));
+            EXPECT_EQ(1009u, log.last_lsn());
+            uint64_t lsn = log.append(WAL_INSERT, KeyValue<uint64_t, uint64_t>(7, 7));
+            EXPECT_EQ(1010u, lsn);
+            log.wait_durable(lsn);
+        }
+        size_t num_records = 0;
+        Log::replay(path, 0, [&num_records](uint64_t, WalRecordType, const KeyValue<uint64_t, uint64_t> &) { num_records++; });
+        EXPECT_EQ(1000u, num_records);
+
+        // restart: an empty log after the last LSN
+        {
+            Log log(path, std::chrono::microseconds(100));
+            log.restart();
+            EXPECT_EQ(1011u, log.append(WAL_INSERT, KeyValue<uint64_t, uint64_t>(8, 8)));
+        }
+        num_records = 0;
+        Log::replay(path, 0, [&num_records](uint64_t, WalRecordType, const KeyValue<uint64_t, uint64_t> &) { num_records++; }, &base_lsn);
+        EXPECT_EQ(1u, num_records);
+        EXPECT_EQ(1010u, base_lsn);
+        std::remove(path.c_str());
+    }
+
+    TEST(WriteAheadLog, group_commit) {
+        // many writers wait for their records; each sync covers a group of them
+        const std::string path = testing::TempDir() + "bli_wal";
+        std::remove(path.c_str());
+        const int num_threads = 8;
+        const uint64_t N = 200;
+        {
+            Log log(path, std::chrono::microseconds(500));
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads; t++) {
+                threads.emplace_back([&log, t, N]() {
+                    for (uint64_t i = 0; i < N; i++) {
+                        uint64_t lsn = log.append(WAL_INSERT, KeyValue<uint64_t, uint64_t>(t * N + i, t));
+                        log.wait_durable(lsn);
+                        EXPECT_GE(log.durable_lsn(), lsn);
+                    }
+                });
+            }
+            for (auto &thread : threads) thread.join();
+            EXPECT_EQ(num_threads * N, log.durable_lsn());
+        }
+        std::vector<bool> seen(num_threads * N, false);
+        Log::replay(path, 0, [&seen](uint64_t, WalRecordType, const KeyValue<uint64_t, uint64_t> &kv) {
+            EXPECT_FALSE(seen[kv.key_]);
+            seen[kv.key_] = true;
+        });
+        for (bool s : seen) EXPECT_TRUE(s);
+        EXPECT_THROW(Log::replay(path + ".missing", 0, [](uint64_t, WalRecordType, const KeyValue<uint64_t, uint64_t> &) {}),
+                     std::runtime_error);
+        std::remove(path.c_str());
+    }
+}